@@ -0,0 +1,186 @@
+#include "atlas_texture.h"
+
+#include <QOpenGLPixelTransferOptions>
+
+/**
+ * @brief createAtlasTexture Create the texture for an atlas layout and allocate its storage, without uploading any data.
+ * Images use a texture array with an atlas per layer, volumes a single 3D texture. Requires a current OpenGL context.
+ * @param container
+ * @return The texture, owned by the caller.
+ */
+QOpenGLTexture *createAtlasTexture(const AtlasContainer &container)
+{
+    QOpenGLTexture *texture;
+    if (container.draw_type == DrawType::IMAGE) {
+        texture = new QOpenGLTexture(QOpenGLTexture::Target2DArray);
+        texture->setMinMagFilters(QOpenGLTexture::LinearMipMapLinear, QOpenGLTexture::Linear);
+        texture->setWrapMode(QOpenGLTexture::ClampToEdge);
+
+        // The mip levels are built with the atlas, as generating them on the GPU would mix neighbouring blocks.
+        texture->setLayers(container.dims[2]);
+        texture->setSize(container.dims[0], container.dims[1]);
+        texture->setMipLevels(container.num_levels);
+        texture->setMipMaxLevel(container.num_levels - 1);
+        texture->setFormat(QOpenGLTexture::RGBA8_UNorm);
+    } else {
+        texture = new QOpenGLTexture(QOpenGLTexture::Target3D);
+        texture->setWrapMode(QOpenGLTexture::ClampToEdge);
+        texture->setMinMagFilters(QOpenGLTexture::Linear, QOpenGLTexture::Linear);
+        texture->setSize(container.dims[0], container.dims[1], container.dims[2]);
+        texture->setFormat(QOpenGLTexture::R8_UNorm);
+    }
+    texture->allocateStorage();
+    return texture;
+}
+
+/**
+ * @brief uploadAtlasPage Upload a single page of the atlas data, so the atlas can be uploaded while the rest is still being built.
+ * Image pages are uploaded with all their mip levels. Requires a current OpenGL context.
+ * @param texture
+ * @param container
+ * @param page Index of the image atlas, or of the slab of volume blocks.
+ * @param page_data
+ */
+void uploadAtlasPage(QOpenGLTexture *texture, const AtlasContainer &container, size_t page, const unsigned char *page_data)
+{
+    if (container.draw_type == DrawType::IMAGE) {
+        for (size_t level = 0; level < container.num_levels; ++level)
+            texture->setData(level, page, QOpenGLTexture::BGRA, QOpenGLTexture::UInt8, page_data + container.levelOffset(level));
+        return;
+    }
+
+    QOpenGLPixelTransferOptions transfer_options;
+    transfer_options.setAlignment(1);
+    texture->setData(
+        0, 0, page * container.block_dims[2],
+        container.dims[0], container.dims[1], container.block_dims[2],
+        QOpenGLTexture::Red, QOpenGLTexture::UInt8, page_data, &transfer_options
+    );
+}
+
+/**
+ * @brief createOccupancyTexture Create the texture of the occupancy grid of a volume atlas, filled with the grid of the container if it has one.
+ * Requires a current OpenGL context.
+ * @param container
+ * @return The texture, owned by the caller.
+ */
+QOpenGLTexture *createOccupancyTexture(const AtlasContainer &container)
+{
+    auto occupancy_dims = container.occupancyDims();
+    QOpenGLTexture *texture = new QOpenGLTexture(QOpenGLTexture::Target3D);
+    texture->setMinMagFilters(QOpenGLTexture::Nearest, QOpenGLTexture::Nearest);
+    texture->setWrapMode(QOpenGLTexture::ClampToEdge);
+    texture->setSize(occupancy_dims[0], occupancy_dims[1], occupancy_dims[2]);
+    texture->setFormat(QOpenGLTexture::RG8_UNorm);
+    texture->allocateStorage();
+
+    if (!container.occupancy.isEmpty()) {
+        QOpenGLPixelTransferOptions transfer_options;
+        transfer_options.setAlignment(1);
+        texture->setData(QOpenGLTexture::RG, QOpenGLTexture::UInt8, container.occupancy.constData(), &transfer_options);
+    }
+    return texture;
+}
+
+/**
+ * @brief uploadOccupancyBlock Upload the occupancy grid of a single volume, see createVolumeOccupancyBlock. Requires a current OpenGL context.
+ * @param texture
+ * @param container
+ * @param slot Block of the volume.
+ * @param block_data
+ */
+void uploadOccupancyBlock(QOpenGLTexture *texture, const AtlasContainer &container, size_t slot, const unsigned char *block_data)
+{
+    QOpenGLPixelTransferOptions transfer_options;
+    transfer_options.setAlignment(1);
+    auto [x, y, z] = container.occupancyOrigin(slot);
+    auto occupancy_block_dims = container.occupancyBlockDims();
+    texture->setData(
+        x, y, z,
+        occupancy_block_dims[0], occupancy_block_dims[1], occupancy_block_dims[2],
+        QOpenGLTexture::RG, QOpenGLTexture::UInt8, block_data, &transfer_options
+    );
+}
+
+/**
+ * @brief createGradientTexture Create the texture of the gradients of a volume atlas and allocate its storage, without uploading any data.
+ * The texture has the dims of the atlas, so the gradients of a volume share its texture coordinates. Requires a current OpenGL context.
+ * @param container
+ * @return The texture, owned by the caller.
+ */
+QOpenGLTexture *createGradientTexture(const AtlasContainer &container)
+{
+    QOpenGLTexture *texture = new QOpenGLTexture(QOpenGLTexture::Target3D);
+    texture->setMinMagFilters(QOpenGLTexture::Linear, QOpenGLTexture::Linear);
+    texture->setWrapMode(QOpenGLTexture::ClampToEdge);
+    texture->setSize(container.dims[0], container.dims[1], container.dims[2]);
+    texture->setFormat(QOpenGLTexture::RGB10A2);
+    texture->allocateStorage();
+    return texture;
+}
+
+/**
+ * @brief uploadGradientPage Upload the gradients of a single page of a volume atlas, see createVolumeGradientPage. Requires a current OpenGL context.
+ * @param texture
+ * @param container
+ * @param page Index of the slab of volume blocks.
+ * @param page_data
+ */
+void uploadGradientPage(QOpenGLTexture *texture, const AtlasContainer &container, size_t page, const quint32 *page_data)
+{
+    texture->setData(
+        0, 0, page * container.block_dims[2],
+        container.dims[0], container.dims[1], container.block_dims[2],
+        QOpenGLTexture::RGBA, QOpenGLTexture::UInt32_RGB10A2_Rev, page_data
+    );
+}
+
+/**
+ * @brief uploadGradientBlock Upload the gradients of a single volume, see createVolumeGradientBlock. Requires a current OpenGL context.
+ * @param texture
+ * @param container
+ * @param slot Block of the volume.
+ * @param block_data
+ */
+void uploadGradientBlock(QOpenGLTexture *texture, const AtlasContainer &container, size_t slot, const quint32 *block_data)
+{
+    auto [x, y, z] = container.blockOrigin(slot);
+    texture->setData(
+        x, y, z,
+        container.block_dims[0], container.block_dims[1], container.block_dims[2],
+        QOpenGLTexture::RGBA, QOpenGLTexture::UInt32_RGB10A2_Rev, block_data
+    );
+}
+
+/**
+ * @brief createPageTableTexture Create the page table of an atlas, which holds an entry for every element in rows of PAGE_TABLE_WIDTH.
+ * Every entry is the [u, v, w] origin of the block of the element, and 1 in the last component if the element is in the atlas. Requires a current OpenGL context.
+ * @param num_elements
+ * @return The texture, owned by the caller.
+ */
+QOpenGLTexture *createPageTableTexture(size_t num_elements)
+{
+    QOpenGLTexture *texture = new QOpenGLTexture(QOpenGLTexture::Target2D);
+    texture->setMinMagFilters(QOpenGLTexture::Nearest, QOpenGLTexture::Nearest);
+    texture->setWrapMode(QOpenGLTexture::ClampToEdge);
+    texture->setSize(PAGE_TABLE_WIDTH, std::max<size_t>(1, (num_elements + PAGE_TABLE_WIDTH - 1) / PAGE_TABLE_WIDTH));
+    texture->setFormat(QOpenGLTexture::RGBA32F);
+    texture->allocateStorage();
+    return texture;
+}
+
+/**
+ * @brief uploadPageTableRows Upload the changed rows of the page table. Requires a current OpenGL context.
+ * @param texture
+ * @param entries Entries of all elements, padded to whole rows.
+ * @param first_row
+ * @param last_row Last changed row, inclusive.
+ */
+void uploadPageTableRows(QOpenGLTexture *texture, const std::vector<QVector4D> &entries, size_t first_row, size_t last_row)
+{
+    texture->setData(
+        0, first_row, 0,
+        PAGE_TABLE_WIDTH, last_row - first_row + 1, 1,
+        QOpenGLTexture::RGBA, QOpenGLTexture::Float32, entries.data() + first_row * PAGE_TABLE_WIDTH
+    );
+}
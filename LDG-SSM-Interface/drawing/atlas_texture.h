@@ -0,0 +1,25 @@
+#ifndef ATLAS_TEXTURE_H
+#define ATLAS_TEXTURE_H
+
+#include <QOpenGLTexture>
+#include <QVector4D>
+#include <vector>
+
+#include "util/atlas_container.h"
+
+QOpenGLTexture *createAtlasTexture(const AtlasContainer &container);
+void uploadAtlasPage(QOpenGLTexture *texture, const AtlasContainer &container, size_t page, const unsigned char *page_data);
+
+QOpenGLTexture *createOccupancyTexture(const AtlasContainer &container);
+void uploadOccupancyBlock(QOpenGLTexture *texture, const AtlasContainer &container, size_t slot, const unsigned char *block_data);
+
+QOpenGLTexture *createGradientTexture(const AtlasContainer &container);
+void uploadGradientPage(QOpenGLTexture *texture, const AtlasContainer &container, size_t page, const quint32 *page_data);
+void uploadGradientBlock(QOpenGLTexture *texture, const AtlasContainer &container, size_t slot, const quint32 *block_data);
+
+const size_t PAGE_TABLE_WIDTH = 1024;               // Number of entries in a row of the page table texture.
+
+QOpenGLTexture *createPageTableTexture(size_t num_elements);
+void uploadPageTableRows(QOpenGLTexture *texture, const std::vector<QVector4D> &entries, size_t first_row, size_t last_row);
+
+#endif // ATLAS_TEXTURE_H
@@ -1,14 +1,21 @@
 #include "image_renderer.h"
+#include "drawing/atlas_texture.h"
 #include "drawing/model/mesh.h"
+#include "util/element_cache.h"
+#include "util/tree_functions.h"
 
 /**
  * @brief ImageRenderer::ImageRenderer
  * @param tree_properties
  * @param window_properties
- * @param texture_map
+ * @param atlas_container Layout of the atlas built for the tree.
+ * @param texture_array Texture array containing the atlasses. The renderer takes ownership.
  */
-ImageRenderer::ImageRenderer(TreeDrawProperties *tree_properties, WindowDrawProperties *window_properties):
-    texture_array(QOpenGLTexture::Target2DArray),
+ImageRenderer::ImageRenderer(TreeDrawProperties *tree_properties, WindowDrawProperties *window_properties, AtlasContainer atlas_container, QOpenGLTexture *texture_array):
+    texture_array(texture_array),
+    page_table_texture(nullptr),
+    atlas_container(atlas_container),
+    num_indices(0),
     Renderer(tree_properties, window_properties)
 {
 }
@@ -21,17 +28,17 @@ ImageRenderer::~ImageRenderer()
     gl->glDeleteVertexArrays(1, &vertex_array_object);
     gl->glDeleteBuffers(1, &vertex_buffer);
     gl->glDeleteBuffers(1, &texcoord_buffer);
-    gl->glDeleteBuffers(1, &texcoord_origin_buffer);
-    gl->glDeleteBuffers(1, &transformation_buffer);
     gl->glDeleteBuffers(1, &index_buffer);
 
     vertex_array_object = 0;
     vertex_buffer = 0;
     texcoord_buffer = 0;
-    transformation_buffer = 0;
     index_buffer = 0;
 
-    texture_array.destroy();
+    texture_array->destroy();
+    delete texture_array;
+    page_table_texture->destroy();
+    delete page_table_texture;
 }
 
 /**
@@ -50,7 +57,8 @@ void ImageRenderer::intialize(QOpenGLFunctions_4_1_Core *gl)
 
     initializeBuffers();
     initializeShaders();
-    initializeTextures();
+    initializePageTable();
+    initializeMesh();
 
     updateBuffers();
     updateUniforms();
@@ -74,20 +82,7 @@ void ImageRenderer::initializeBuffers()
     gl->glEnableVertexAttribArray(1);
     gl->glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
 
-    gl->glGenBuffers(1, &texcoord_origin_buffer);
-    gl->glBindBuffer(GL_ARRAY_BUFFER, texcoord_origin_buffer);
-    gl->glEnableVertexAttribArray(2);
-    gl->glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
-    gl->glVertexAttribDivisor(2, 1); // Instanced
-
-    // Mat4 requires 4 vertex attribute pointers
-    gl->glGenBuffers(1, &transformation_buffer);
-    gl->glBindBuffer(GL_ARRAY_BUFFER, transformation_buffer);
-    for (unsigned int idx = 0; idx < 4; ++idx) {
-        gl->glEnableVertexAttribArray(3 + idx);
-        gl->glVertexAttribPointer(3 + idx, 4, GL_FLOAT, GL_FALSE, sizeof(QMatrix4x4), (const GLvoid *)(sizeof(QVector4D) * idx));
-        gl->glVertexAttribDivisor(3 + idx, 1); // Instanced
-    }
+    initializeInstanceBuffer(2);
 
     gl->glGenBuffers(1, &index_buffer);
     gl->glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer);
@@ -106,42 +101,67 @@ void ImageRenderer::initializeShaders()
 }
 
 /**
- * @brief ImageRenderer::initializeTextures Initialize the texture atlasses and texture array. We can keep these in memory.
+ * @brief ImageRenderer::initializePageTable Create the page table. Every element has a fixed block in the atlas, so all entries are set up front.
+ */
+void ImageRenderer::initializePageTable()
+{
+    size_t num_elements = tree_properties->disparities.size() + 1;
+    std::vector<QVector4D> page_table((num_elements + PAGE_TABLE_WIDTH - 1) / PAGE_TABLE_WIDTH * PAGE_TABLE_WIDTH, QVector4D());
+    for (auto [element, coords] : atlas_container.mapping.asKeyValueRange())
+        page_table[element] = QVector4D(coords, 1.f);
+
+    page_table_texture = createPageTableTexture(num_elements);
+    uploadPageTableRows(page_table_texture, page_table, 0, page_table.size() / PAGE_TABLE_WIDTH - 1);
+}
+
+/**
+ * @brief ImageRenderer::uploadDrawnNodes Put the images of drawn nodes whose element is not in the atlas yet into the atlas, and prefetch the images of their children.
+ * @param nodes Drawn nodes to consider, which are only the newly instanced nodes as the rest are already in the atlas.
  */
-void ImageRenderer::initializeTextures()
+void ImageRenderer::uploadDrawnNodes(const std::vector<size_t> &nodes)
 {
-    GLint max_texture_size;
-    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture_size);
-    atlas_container = createImageAtlasContainer(tree_properties, max_texture_size);
-    size_t num_atlasses = atlas_container.dims[2];
-
-    texture_array.setMagnificationFilter(QOpenGLTexture::Linear);
-    texture_array.setWrapMode(QOpenGLTexture::ClampToEdge);
-    texture_array.setAutoMipMapGenerationEnabled(true);
-
-    texture_array.setLayers(num_atlasses);
-    texture_array.setSize(atlas_container.dims[0], atlas_container.dims[1]);
-    texture_array.setFormat(QOpenGLTexture::RGBA8_UNorm);
-    texture_array.allocateStorage();
-
-    // Load the atlasses
-    auto *data_ptr = atlas_container.data.data();
-    size_t size_per_atlas = atlas_container.data.size() / num_atlasses;
-    for (size_t idx = 0; idx < num_atlasses; ++idx) {
-        texture_array.setData(0, idx, QOpenGLTexture::BGRA, QOpenGLTexture::UInt8, data_ptr + idx * size_per_atlas);
+    for (size_t node : nodes) {
+        int element = tree_properties->elements[node];
+        if (element < 0 || resident_elements.contains(element))
+            continue;
+
+        auto image_data = tree_properties->element_cache->element(element);
+        if (image_data == nullptr)
+            continue;
+
+        QList<unsigned char> block = createImageAtlasBlock(tree_properties, atlas_container, image_data.get());
+        auto [x, y, atlas_idx] = atlas_container.blockOrigin(atlas_container.element_slots[element]);
+        const unsigned char *level_data = block.constData();
+        for (size_t level = 0; level < atlas_container.num_levels; ++level) {
+            size_t level_width = atlas_container.block_dims[0] >> level;
+            size_t level_height = atlas_container.block_dims[1] >> level;
+            texture_array->setData(
+                x >> level, y >> level, 0,
+                level_width, level_height, 1,
+                level, atlas_idx,
+                QOpenGLTexture::BGRA, QOpenGLTexture::UInt8, level_data
+            );
+            level_data += level_width * level_height * 4;
+        }
+        resident_elements.insert(element);
+    }
+
+    QList<size_t> prefetch_elements;
+    for (size_t element : getChildElements(nodes, tree_properties)) {
+        if (!resident_elements.contains(element))
+            prefetch_elements.append(element);
     }
+    tree_properties->element_cache->prefetch(prefetch_elements);
 }
 
 /**
- * @brief ImageRenderer::updateBuffers Update the data buffers. We calculate the position of the vertices in screen space and project them into world space.
+ * @brief ImageRenderer::initializeMesh Set the base to-be-instanced shape, texture coords and indices. The plane has unit size, and is scaled to the node in the shader.
  */
-void ImageRenderer::updateBuffers()
+void ImageRenderer::initializeMesh()
 {
-    // Set the base to-be-instanced shape, texture coords and indices
-    double base_side_len = window_properties->height_node_lens[tree_properties->tree_max_height] * window_properties->device_pixel_ratio;
     auto mesh = createPlane(
         QVector3D{ 0., 0., 0. },
-        base_side_len
+        1.
     );
     gl->glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
     gl->glBufferData(GL_ARRAY_BUFFER, sizeof(QVector3D) * mesh.vertices.size(), mesh.vertices.data(), GL_STATIC_DRAW);
@@ -158,40 +178,16 @@ void ImageRenderer::updateBuffers()
     gl->glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer);
     gl->glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * mesh.indices.size(), mesh.indices.data(), GL_STATIC_DRAW);
     num_indices = mesh.indices.size();
+}
 
-    // Set data per instance
-    QList<QVector3D> texcoords_origins;
-    QList<QMatrix4x4> transformation_matrices;
-
-    float spacing = window_properties->device_pixel_ratio * window_properties->node_spacing;
-    for (auto &[height, index] : tree_properties->draw_array) {
-        float side_len = window_properties->height_node_lens[height] * window_properties->device_pixel_ratio;
-        auto [num_rows, num_cols] = tree_properties->height_dims[height];
-        double x = index % num_cols;
-        double y = index / num_cols;
-
-        // Transformation translates to the origin of the cell and then scales down to the appropriates sizes.
-        QMatrix4x4 transformation;
-        QVector3D origin{
-            static_cast<float>(x * (side_len + spacing)),
-            static_cast<float>(y * (side_len + spacing)),
-            0.
-        };
-        float factor = side_len / base_side_len;
-        transformation.translate(origin);
-        transformation.scale(factor, factor);
-        transformation_matrices.append(transformation);
-
-        // For the texture coordinate, we can simply pass the origin of the current texture to translate in the shader
-        texcoords_origins.append(atlas_container.mapping[{ height, index }]);
-    }
-
-    // Bind and set data
-    gl->glBindBuffer(GL_ARRAY_BUFFER, texcoord_origin_buffer);
-    gl->glBufferData(GL_ARRAY_BUFFER, sizeof(QVector3D) * texcoords_origins.size(), texcoords_origins.data(), GL_STATIC_DRAW);
-
-    gl->glBindBuffer(GL_ARRAY_BUFFER, transformation_buffer);
-    gl->glBufferData(GL_ARRAY_BUFFER, sizeof(QMatrix4x4) * transformation_matrices.size(), transformation_matrices.data(), GL_STATIC_DRAW);
+/**
+ * @brief ImageRenderer::updateBuffers Update the instances of the visible drawn nodes, and put the images of newly instanced nodes into the atlas when loading lazily.
+ */
+void ImageRenderer::updateBuffers()
+{
+    updateInstances();
+    if (tree_properties->loading_mode == LoadingMode::LAZY)
+        uploadDrawnNodes(added_instances);
 }
 
 /**
@@ -212,6 +208,25 @@ void ImageRenderer::updateUniforms()
     auto &scale_vector = tree_properties->gl_space_scale_vector;
     gl->glUniform3f(screen_space_projection_uniform, scale_vector.x(), scale_vector.y(), scale_vector.z());
 
+    element_size_uniform = shader.uniformLocation("element_size");
+    gl->glUniform2f(element_size_uniform, tree_properties->data_dims[0], tree_properties->data_dims[1]);
+
+    element_shape_uniform = shader.uniformLocation("element_shape");
+    auto shape = tree_properties->elementShape();
+    gl->glUniform3f(element_shape_uniform, shape.x(), shape.y(), shape.z());
+
+    max_level_uniform = shader.uniformLocation("max_level");
+    gl->glUniform1f(max_level_uniform, atlas_container.num_levels - 1);
+
+    node_textures_uniform = shader.uniformLocation("node_textures");
+    gl->glUniform1i(node_textures_uniform, 0);
+
+    page_table_uniform = shader.uniformLocation("page_table");
+    gl->glUniform1i(page_table_uniform, 1);
+
+    // The shader places the images from their place in the grid, and derives their on-screen size to pick the mip level.
+    setLayoutUniforms(&shader);
+
     shader.release();
 }
 
@@ -224,13 +239,15 @@ void ImageRenderer::render()
     gl->glDepthFunc(GL_LEQUAL);
 
     shader.bind();
-    texture_array.bind();
+    texture_array->bind();
+    page_table_texture->bind(1, QOpenGLTexture::ResetTextureUnit);
     gl->glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
 
     gl->glBindVertexArray(vertex_array_object);
-    gl->glDrawElementsInstanced(GL_TRIANGLES, num_indices, GL_UNSIGNED_INT, nullptr, tree_properties->draw_array.size());
+    gl->glDrawElementsInstanced(GL_TRIANGLES, num_indices, GL_UNSIGNED_INT, nullptr, instance_slots.size());
     gl->glBindVertexArray(0);
 
-    texture_array.release();
+    page_table_texture->release(1, QOpenGLTexture::ResetTextureUnit);
+    texture_array->release();
     shader.release();
 }
@@ -3,6 +3,8 @@
 
 #include <QOpenGLBuffer>
 #include <QOpenGLTexture>
+#include <QSet>
+#include <vector>
 
 #include "util/atlas_container.h"
 #include "renderer.h"
@@ -12,23 +14,28 @@
  */
 class ImageRenderer : public Renderer
 {    
-    QOpenGLTexture texture_array;
+    QOpenGLTexture *texture_array;
+    QOpenGLTexture *page_table_texture;             // Origin of the block of every element in the atlas, see createPageTableTexture.
     QOpenGLShaderProgram shader;
 
     GLint model_view_projection_uniform, screen_space_projection_uniform, screen_origin_uniform;
+    GLint element_size_uniform, element_shape_uniform, max_level_uniform, node_textures_uniform, page_table_uniform;
     GLuint vertex_array_object;
-    GLuint vertex_buffer, texcoord_buffer, texcoord_origin_buffer, transformation_buffer, index_buffer;
+    GLuint vertex_buffer, texcoord_buffer, index_buffer;
 
     AtlasContainer atlas_container;
+    QSet<size_t> resident_elements;                 // Elements that are in the atlas when loading lazily.
 
     size_t num_indices;
 
     void initializeBuffers();
     void initializeShaders();
-    void initializeTextures();
+    void initializePageTable();
+    void uploadDrawnNodes(const std::vector<size_t> &nodes);
+    void initializeMesh();
 
 public:
-    ImageRenderer(TreeDrawProperties *tree_properties, WindowDrawProperties *window_properties);
+    ImageRenderer(TreeDrawProperties *tree_properties, WindowDrawProperties *window_properties, AtlasContainer atlas_container, QOpenGLTexture *texture_array);
     ~ImageRenderer() override;
 
     void intialize(QOpenGLFunctions_4_1_Core *gl) override;
@@ -0,0 +1,112 @@
+#include "instance_slots.h"
+
+#include <algorithm>
+
+const size_t RANGE_MERGE_GAP = 16;                  // Changed ranges at most this many slots apart are uploaded as one, as every upload has a fixed cost.
+
+/**
+ * @brief InstanceSlots::clear Free all slots, so the next nodes are assigned from the first slot on.
+ */
+void InstanceSlots::clear()
+{
+    node_slots.clear();
+    free_slots.clear();
+    changed_slots.clear();
+    num_slots = 0;
+}
+
+/**
+ * @brief InstanceSlots::contains
+ * @param node
+ * @return True if the node has a slot.
+ */
+bool InstanceSlots::contains(size_t node) const
+{
+    return node_slots.contains(node);
+}
+
+/**
+ * @brief InstanceSlots::insert Assign a slot to a node that has none, reusing the most recently freed slot if there is one.
+ * @param node
+ * @return The slot of the node, which should be written.
+ */
+size_t InstanceSlots::insert(size_t node)
+{
+    size_t slot;
+    if (free_slots.empty()) {
+        slot = num_slots++;
+    } else {
+        slot = free_slots.back();
+        free_slots.pop_back();
+    }
+    node_slots.insert(node, slot);
+    changed_slots.push_back(slot);
+    return slot;
+}
+
+/**
+ * @brief InstanceSlots::remove Free the slot of a node.
+ * @param node
+ * @param slot Receives the slot of the node, which should be written as a hidden instance.
+ * @return False if the node has no slot.
+ */
+bool InstanceSlots::remove(size_t node, size_t &slot)
+{
+    auto entry = node_slots.find(node);
+    if (entry == node_slots.end())
+        return false;
+
+    slot = entry.value();
+    node_slots.remove(node);
+    free_slots.push_back(slot);
+    changed_slots.push_back(slot);
+    return true;
+}
+
+/**
+ * @brief InstanceSlots::size
+ * @return Number of slots including the free ones, which is the number of instances to draw.
+ */
+size_t InstanceSlots::size() const
+{
+    return num_slots;
+}
+
+/**
+ * @brief InstanceSlots::numFree
+ * @return Number of slots holding hidden instances.
+ */
+size_t InstanceSlots::numFree() const
+{
+    return free_slots.size();
+}
+
+/**
+ * @brief InstanceSlots::nodes Write the nodes that have a slot to a list, in no particular order. The list is reused, so it only allocates when it grows.
+ * @param nodes
+ */
+void InstanceSlots::nodes(std::vector<size_t> &nodes) const
+{
+    nodes.clear();
+    for (auto [node, slot] : node_slots.asKeyValueRange())
+        nodes.push_back(node);
+}
+
+/**
+ * @brief InstanceSlots::takeChangedRanges Get the slots written since the last call, as ranges to upload.
+ * @return Sorted, non-overlapping [first slot, number of slots] ranges.
+ */
+std::vector<std::pair<size_t, size_t>> InstanceSlots::takeChangedRanges()
+{
+    std::sort(changed_slots.begin(), changed_slots.end());
+
+    std::vector<std::pair<size_t, size_t>> ranges;
+    for (size_t slot : changed_slots) {
+        if (!ranges.empty() && slot <= ranges.back().first + ranges.back().second + RANGE_MERGE_GAP)
+            ranges.back().second = std::max(ranges.back().second, slot - ranges.back().first + 1);
+        else
+            ranges.emplace_back(slot, 1);
+    }
+    changed_slots.clear();
+    return ranges;
+}
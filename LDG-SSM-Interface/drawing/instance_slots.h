@@ -0,0 +1,34 @@
+#ifndef INSTANCE_SLOTS_H
+#define INSTANCE_SLOTS_H
+
+#include <QHash>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief The InstanceSlots class Assigns every drawn node a stable slot in the instance buffers of a renderer, so a change to the drawn nodes only touches their own slots.
+ * Freed slots are reused before new slots are added. Until then they stay in the buffers as hidden instances.
+ */
+class InstanceSlots
+{
+    QHash<size_t, size_t> node_slots;
+    std::vector<size_t> free_slots;
+    std::vector<size_t> changed_slots;              // Slots written since the changes were last taken, in any order and possibly repeated.
+    size_t num_slots = 0;
+
+public:
+    void clear();
+
+    bool contains(size_t node) const;
+    size_t insert(size_t node);
+    bool remove(size_t node, size_t &slot);
+
+    size_t size() const;
+    size_t numFree() const;
+    void nodes(std::vector<size_t> &nodes) const;
+
+    std::vector<std::pair<size_t, size_t>> takeChangedRanges();
+};
+
+#endif // INSTANCE_SLOTS_H
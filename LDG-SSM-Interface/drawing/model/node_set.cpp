@@ -0,0 +1,111 @@
+#include "drawing/model/node_set.h"
+
+#include <algorithm>
+
+/**
+ * @brief NodeSet::NodeSet
+ * @param num_nodes Number of node ids the set can hold.
+ */
+NodeSet::NodeSet(size_t num_nodes)
+{
+    resize(num_nodes);
+}
+
+/**
+ * @brief NodeSet::resize Resize the set to hold the given number of node ids. This clears the set.
+ * @param num_nodes
+ */
+void NodeSet::resize(size_t num_nodes)
+{
+    this->num_nodes = num_nodes;
+    words.assign((num_nodes + 63) / 64, 0);
+    count = 0;
+}
+
+/**
+ * @brief NodeSet::clear
+ */
+void NodeSet::clear()
+{
+    std::fill(words.begin(), words.end(), 0);
+    count = 0;
+}
+
+/**
+ * @brief NodeSet::contains
+ * @param node
+ * @return
+ */
+bool NodeSet::contains(size_t node) const
+{
+    return node < num_nodes && (words[node / 64] >> (node % 64)) & 1;
+}
+
+/**
+ * @brief NodeSet::insert
+ * @param node
+ * @return True if the node was not in the set yet.
+ */
+bool NodeSet::insert(size_t node)
+{
+    uint64_t bit = uint64_t(1) << (node % 64);
+    uint64_t &word = words[node / 64];
+    if (word & bit)
+        return false;
+
+    word |= bit;
+    ++count;
+    return true;
+}
+
+/**
+ * @brief NodeSet::remove
+ * @param node
+ * @return True if the node was in the set.
+ */
+bool NodeSet::remove(size_t node)
+{
+    if (!contains(node))
+        return false;
+
+    words[node / 64] &= ~(uint64_t(1) << (node % 64));
+    --count;
+    return true;
+}
+
+/**
+ * @brief NodeSet::size
+ * @return Number of nodes in the set.
+ */
+size_t NodeSet::size() const
+{
+    return count;
+}
+
+/**
+ * @brief NodeSet::isEmpty
+ * @return
+ */
+bool NodeSet::isEmpty() const
+{
+    return count == 0;
+}
+
+/**
+ * @brief NodeSet::capacity
+ * @return Number of node ids the set can hold.
+ */
+size_t NodeSet::capacity() const
+{
+    return num_nodes;
+}
+
+/**
+ * @brief NodeSet::values Write the nodes in the set to a list in ascending order. The list is reused, so it only allocates when it grows.
+ * @param nodes
+ */
+void NodeSet::values(std::vector<size_t> &nodes) const
+{
+    nodes.clear();
+    forEach([&nodes](size_t node) { nodes.push_back(node); });
+}
@@ -0,0 +1,78 @@
+#ifndef NODE_SET_H
+#define NODE_SET_H
+
+#include <QtAlgorithms>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @brief The NodeSet class Set of linear node ids stored as a bitset. Lookups and updates are a single bit operation and never allocate.
+ */
+class NodeSet
+{
+    std::vector<uint64_t> words;
+    size_t num_nodes;
+    size_t count;
+
+public:
+    NodeSet(size_t num_nodes = 0);
+
+    void resize(size_t num_nodes);
+    void clear();
+
+    bool contains(size_t node) const;
+    bool insert(size_t node);
+    bool remove(size_t node);
+
+    size_t size() const;
+    bool isEmpty() const;
+    size_t capacity() const;
+
+    void values(std::vector<size_t> &nodes) const;
+
+    template<typename Function>
+    void forEach(Function function) const;
+    template<typename Function>
+    void forEachInRange(size_t first, size_t last, Function function) const;
+};
+
+/**
+ * @brief NodeSet::forEach Call the function for every node in the set, in ascending order. Empty stretches of 64 nodes are skipped at once.
+ * @param function
+ */
+template<typename Function>
+void NodeSet::forEach(Function function) const
+{
+    for (size_t word_idx = 0; word_idx < words.size(); ++word_idx) {
+        for (uint64_t word = words[word_idx]; word != 0; word &= word - 1)
+            function(word_idx * 64 + qCountTrailingZeroBits(static_cast<quint64>(word)));
+    }
+}
+
+/**
+ * @brief NodeSet::forEachInRange Call the function for every node in the set from first to last inclusive, in ascending order. Only the words covering the range are read.
+ * @param first
+ * @param last
+ * @param function
+ */
+template<typename Function>
+void NodeSet::forEachInRange(size_t first, size_t last, Function function) const
+{
+    if (first > last || first >= num_nodes)
+        return;
+
+    last = std::min(last, num_nodes - 1);
+    for (size_t word_idx = first / 64; word_idx <= last / 64; ++word_idx) {
+        uint64_t word = words[word_idx];
+        if (word_idx == first / 64)
+            word &= ~uint64_t(0) << (first % 64);
+        if (word_idx == last / 64 && last % 64 != 63)
+            word &= (uint64_t(1) << (last % 64 + 1)) - 1;
+        for (; word != 0; word &= word - 1)
+            function(word_idx * 64 + qCountTrailingZeroBits(static_cast<quint64>(word)));
+    }
+}
+
+#endif // NODE_SET_H
@@ -0,0 +1,118 @@
+#include "transfer_function.h"
+#include "input/json.h"
+
+#include <QJsonArray>
+#include <QMap>
+#include <algorithm>
+#include <cmath>
+
+/**
+ * @brief TransferFunction::TransferFunction Create the default transfer function, which colors ten bands of values and increases the opacity with the value.
+ * The maximum value is fully transparent.
+ */
+TransferFunction::TransferFunction():
+    table(TRANSFER_FUNCTION_SIZE)
+{
+    const QVector3D band_colors[] = {
+        { 0.19483f, 0.08339f, 0.26149f },
+        { 0.27648f, 0.48144f, 0.95064f },
+        { 0.96187f, 0.41093f, 0.09310f },
+        { 0.49321f, 0.01963f, 0.00955f },
+        { 0.11167f, 0.80569f, 0.84525f },
+        { 0.12733f, 0.91701f, 0.67627f },
+        { 0.63323f, 0.99195f, 0.23937f },
+        { 0.99438f, 0.66386f, 0.19971f },
+        { 0.86079f, 0.22945f, 0.02875f },
+        { 0.57103f, 0.04474f, 0.00529f }
+    };
+
+    for (size_t idx = 0; idx + 1 < TRANSFER_FUNCTION_SIZE; ++idx) {
+        float value = static_cast<float>(idx) / (TRANSFER_FUNCTION_SIZE - 1);
+        table[idx] = QVector4D(band_colors[static_cast<size_t>(value * 10)], value * 0.05f);
+    }
+}
+
+/**
+ * @brief TransferFunction::fromJSONFile Read a transfer function given as control points, which are interpolated linearly.
+ * Every point has a value between 0 and 1, an RGB color between 0 and 1 and an opacity. Values outside the points take the color of the nearest point.
+ * @param file_name
+ * @return True if the transfer function was read, else the transfer function is unchanged.
+ */
+bool TransferFunction::fromJSONFile(QString file_name)
+{
+    auto [json, success] = readJSONFromFile(file_name);
+    if (!success)
+        return false;
+
+    if (!json.contains(KEYWORD_CONTROL_POINTS) || json[KEYWORD_CONTROL_POINTS].toArray().isEmpty()) {
+        qDebug() << "Missing keyword" << KEYWORD_CONTROL_POINTS << "in transfer function.";
+        return false;
+    }
+
+    QMap<float, QVector4D> control_points;
+    for (const auto &point_value : json[KEYWORD_CONTROL_POINTS].toArray()) {
+        auto point = point_value.toObject();
+        auto color = point[KEYWORD_COLOR].toArray();
+        if (!point.contains(KEYWORD_VALUE) || !point.contains(KEYWORD_OPACITY) || color.size() != 3) {
+            qDebug() << "Control points of transfer function should have a" << KEYWORD_VALUE << KEYWORD_COLOR << "and" << KEYWORD_OPACITY;
+            return false;
+        }
+        control_points.insert(
+            static_cast<float>(point[KEYWORD_VALUE].toDouble()),
+            QVector4D(color[0].toDouble(), color[1].toDouble(), color[2].toDouble(), point[KEYWORD_OPACITY].toDouble())
+        );
+    }
+
+    for (size_t idx = 0; idx < TRANSFER_FUNCTION_SIZE; ++idx) {
+        float value = static_cast<float>(idx) / (TRANSFER_FUNCTION_SIZE - 1);
+        auto next = control_points.lowerBound(value);
+        if (next == control_points.begin()) {
+            table[idx] = next.value();
+        } else if (next == control_points.end()) {
+            table[idx] = std::prev(next).value();
+        } else {
+            auto previous = std::prev(next);
+            float weight = (value - previous.key()) / (next.key() - previous.key());
+            table[idx] = previous.value() * (1.f - weight) + next.value() * weight;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief TransferFunction::opacitySums
+ * @return Sum of the opacities of all entries before every entry, with an extra sum of all entries at the end.
+ * The range of values [first, last] is transparent if the sums at last + 1 and at first are equal.
+ */
+std::vector<float> TransferFunction::opacitySums() const
+{
+    std::vector<float> sums(TRANSFER_FUNCTION_SIZE + 1, 0.f);
+    for (size_t idx = 0; idx < TRANSFER_FUNCTION_SIZE; ++idx)
+        sums[idx + 1] = sums[idx] + std::max(table[idx].w(), 0.f);
+    return sums;
+}
+
+/**
+ * @brief TransferFunction::preIntegratedTable Average the transfer function over every range of values between two consecutive samples of a ray.
+ * The opacity is the mean opacity over the range, and the color is weighted by opacity, so thin features between samples aren't missed.
+ * @return Entry of every [front, back] pair of values, with the back value along the rows.
+ */
+std::vector<QVector4D> TransferFunction::preIntegratedTable() const
+{
+    std::vector<float> opacity_sums = opacitySums();
+    std::vector<QVector3D> color_sums(TRANSFER_FUNCTION_SIZE + 1);
+    for (size_t idx = 0; idx < TRANSFER_FUNCTION_SIZE; ++idx)
+        color_sums[idx + 1] = color_sums[idx] + table[idx].toVector3D() * std::max(table[idx].w(), 0.f);
+
+    std::vector<QVector4D> pre_integrated(TRANSFER_FUNCTION_SIZE * TRANSFER_FUNCTION_SIZE);
+    for (size_t back = 0; back < TRANSFER_FUNCTION_SIZE; ++back) {
+        for (size_t front = 0; front < TRANSFER_FUNCTION_SIZE; ++front) {
+            size_t first = std::min(front, back);
+            size_t last = std::max(front, back);
+            float opacity_sum = opacity_sums[last + 1] - opacity_sums[first];
+            QVector3D color = opacity_sum > 0.f ? (color_sums[last + 1] - color_sums[first]) / opacity_sum : table[back].toVector3D();
+            pre_integrated[back * TRANSFER_FUNCTION_SIZE + front] = QVector4D(color, opacity_sum / (last - first + 1));
+        }
+    }
+    return pre_integrated;
+}
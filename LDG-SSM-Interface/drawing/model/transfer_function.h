@@ -0,0 +1,31 @@
+#ifndef TRANSFER_FUNCTION_H
+#define TRANSFER_FUNCTION_H
+
+#include <QString>
+#include <QVector4D>
+#include <vector>
+
+const size_t TRANSFER_FUNCTION_SIZE = 256;              // Number of entries of the lookup table, one for every voxel value.
+const QString TRANSFER_FUNCTION_FILE_NAME = "transfer_function.json";
+
+/**
+ * @brief The TransferFunction struct Maps voxel values to colors, as a lookup table with an RGBA entry for every voxel value.
+ */
+struct TransferFunction
+{
+    std::vector<QVector4D> table;
+
+    TransferFunction();
+
+    bool fromJSONFile(QString file_name);
+    std::vector<float> opacitySums() const;
+    std::vector<QVector4D> preIntegratedTable() const;
+
+private:
+    const QString KEYWORD_CONTROL_POINTS = "control_points";
+    const QString KEYWORD_VALUE = "value";
+    const QString KEYWORD_COLOR = "color";
+    const QString KEYWORD_OPACITY = "opacity";
+};
+
+#endif // TRANSFER_FUNCTION_H
@@ -1,10 +1,140 @@
 #include "drawing/model/tree_draw_properties.h"
 
+#include <algorithm>
+
 /**
  * @brief TreeDrawProperties::TreeDrawProperties
  */
 TreeDrawProperties::TreeDrawProperties():
     draw_type(DrawType::IMAGE),
+    is_draw_array_replaced(true),
+    loading_mode(LoadingMode::EAGER),
+    element_cache(nullptr),
     background_color({ 1., 1., 1. })
 {
 }
+
+/**
+ * @brief TreeDrawProperties::numNodes
+ * @return Number of nodes over all heights.
+ */
+size_t TreeDrawProperties::numNodes() const
+{
+    return elements.size();
+}
+
+/**
+ * @brief TreeDrawProperties::nodeId Get the linear id of a node.
+ * @param height
+ * @param index
+ * @return
+ */
+size_t TreeDrawProperties::nodeId(size_t height, size_t index) const
+{
+    return height_offsets[height] + index;
+}
+
+/**
+ * @brief TreeDrawProperties::nodeLocation Get the height and index of a node from its linear id.
+ * @param node
+ * @return [height, index] of the node.
+ */
+std::pair<size_t, size_t> TreeDrawProperties::nodeLocation(size_t node) const
+{
+    size_t height = 0;
+    while (height < tree_max_height && node >= height_offsets[height + 1])
+        ++height;
+    return { height, node - height_offsets[height] };
+}
+
+/**
+ * @brief TreeDrawProperties::nodeDisparity
+ * @param node
+ * @return Disparity of the element assigned to the node, or 0 for void nodes.
+ */
+double TreeDrawProperties::nodeDisparity(size_t node) const
+{
+    int element = elements[node];
+    return element < 0 ? 0. : disparities[element];
+}
+
+/**
+ * @brief TreeDrawProperties::drawNode Put a node in the draw array, and record the change for the renderer.
+ * @param node
+ * @return True if the node wasn't drawn yet.
+ */
+bool TreeDrawProperties::drawNode(size_t node)
+{
+    if (!draw_array.insert(node))
+        return false;
+
+    if (!is_draw_array_replaced) {
+        drawn_nodes_added.push_back(node);
+        dropDrawArrayChangesIfLarge();
+    }
+    return true;
+}
+
+/**
+ * @brief TreeDrawProperties::hideNode Take a node out of the draw array, and record the change for the renderer.
+ * @param node
+ * @return True if the node was drawn.
+ */
+bool TreeDrawProperties::hideNode(size_t node)
+{
+    if (!draw_array.remove(node))
+        return false;
+
+    if (!is_draw_array_replaced) {
+        drawn_nodes_removed.push_back(node);
+        dropDrawArrayChangesIfLarge();
+    }
+    return true;
+}
+
+/**
+ * @brief TreeDrawProperties::hideAllNodes Clear the draw array, after which the renderer rebuilds its instances.
+ */
+void TreeDrawProperties::hideAllNodes()
+{
+    draw_array.clear();
+    is_draw_array_replaced = true;
+    drawn_nodes_added.clear();
+    drawn_nodes_removed.clear();
+}
+
+/**
+ * @brief TreeDrawProperties::dropDrawArrayChangesIfLarge Once more changes are recorded than there are drawn nodes, rebuilding is cheaper than applying them, so the changes are dropped.
+ */
+void TreeDrawProperties::dropDrawArrayChangesIfLarge()
+{
+    if (drawn_nodes_added.size() + drawn_nodes_removed.size() > draw_array.size() + 1) {
+        is_draw_array_replaced = true;
+        drawn_nodes_added.clear();
+        drawn_nodes_removed.clear();
+    }
+}
+
+/**
+ * @brief TreeDrawProperties::clearDrawArrayChanges Mark the changes as handled, once the renderer matches the draw array.
+ */
+void TreeDrawProperties::clearDrawArrayChanges()
+{
+    is_draw_array_replaced = false;
+    drawn_nodes_added.clear();
+    drawn_nodes_removed.clear();
+}
+
+/**
+ * @brief TreeDrawProperties::elementShape Get the extent of an element relative to its longest side, which is the part of a node it covers.
+ * The channels of images are not part of their shape, so their depth is always 1.
+ * @return [x, y, z] extent in (0, 1].
+ */
+QVector3D TreeDrawProperties::elementShape() const
+{
+    auto [x_dim, y_dim, z_dim] = data_dims;
+    if (draw_type == DrawType::IMAGE)
+        z_dim = 1;
+    float max_dim = static_cast<float>(std::max({ x_dim, y_dim, z_dim }));
+    return QVector3D{ x_dim / max_dim, y_dim / max_dim, draw_type == DrawType::IMAGE ? 1.f : z_dim / max_dim };
+}
@@ -1,10 +1,15 @@
 #ifndef TREEDRAWPROPERTIES_H
 #define TREEDRAWPROPERTIES_H
 
+#include "drawing/model/node_set.h"
 #include "drawing/model/types.h"
 #include <cstddef>
 #include <QList>
+#include <QStringList>
 #include <QMatrix4x4>
+#include <vector>
+
+class ElementCache;
 
 /**
  * @brief The TreeDrawProperties class Properties needed to draw the quad tree in a simple POD container.
@@ -14,16 +19,23 @@ struct TreeDrawProperties
     // Tree dimensions
     size_t tree_max_height;
     QList<std::pair<size_t, size_t>> height_dims;
+    QList<size_t> height_offsets;                               // Node id of the first node of every height. Node ids are the offset of the height plus the index.
 
     // General draw info
     DrawType draw_type;
-    QSet<std::pair<size_t, size_t>> draw_array;                 // The elements that should be drawn, consisting of [height, index] pairs.
-    QSet<std::pair<size_t, size_t>> invalid_nodes;              // Void tile nodes.
+    NodeSet draw_array;                                         // The nodes that should be drawn, by node id. Changed through drawNode, hideNode and hideAllNodes.
+    std::vector<size_t> drawn_nodes_added;                      // Nodes put in the draw array since the renderer last took the changes.
+    std::vector<size_t> drawn_nodes_removed;                    // Nodes taken out of the draw array since the renderer last took the changes.
+    bool is_draw_array_replaced;                                // Too much of the draw array changed to track, so the renderer rebuilds its instances.
+    NodeSet invalid_nodes;                                      // Void tile nodes, by node id.
 
     // Base data
-    QMap<QPair<size_t, size_t>, QList<unsigned char>> *data;    // The actual data, indexed by [height, index] pairs. The data consists of the raw data, which should be managed externally.
-    QMap<QPair<size_t, size_t>, double> disparities;            // Disparity value per node, indexed by [height, index] pairs.
+    LoadingMode loading_mode;                                   // Whether all elements are put in the atlas up front or only once they are drawn.
+    ElementCache *element_cache;                                // Access to the visualization data of the elements. Should be managed externally.
+    std::vector<int> elements;                                  // The element assigned to every node by node id, or -1 for void nodes.
+    std::vector<double> disparities;                            // Disparity value per element.
     std::array<size_t, 3> data_dims;
+    QStringList source_files;                                   // Files the dataset was read from.
 
     // OpenGL space - 3D projection
     QVector3D gl_space_scale_vector;                            // Scaling factor for scaling from sceen space to OpenGL world space.
@@ -31,6 +43,20 @@ struct TreeDrawProperties
     QVector3D background_color;
 
     TreeDrawProperties();
+
+    size_t numNodes() const;
+    size_t nodeId(size_t height, size_t index) const;
+    std::pair<size_t, size_t> nodeLocation(size_t node) const;
+    double nodeDisparity(size_t node) const;
+    QVector3D elementShape() const;
+
+    bool drawNode(size_t node);
+    bool hideNode(size_t node);
+    void hideAllNodes();
+    void clearDrawArrayChanges();
+
+private:
+    void dropDrawArrayChangesIfLarge();
 };
 
 #endif // TREEDRAWPROPERTIES_H
@@ -21,4 +21,13 @@ enum VolumeRenderingType
     ACCUMULATE
 };
 
+/**
+ * @brief The LoadingMode enum Moments at which the element data is read
+ */
+enum LoadingMode
+{
+    EAGER,
+    LAZY
+};
+
 #endif // TYPES_H
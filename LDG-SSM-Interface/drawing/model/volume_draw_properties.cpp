@@ -5,7 +5,9 @@
  */
 VolumeDrawProperties::VolumeDrawProperties():
     render_type(VolumeRenderingType::ACCUMULATE),
-    sample_steps(100)
+    sample_steps(100),
+    transfer_function_revision(0),
+    is_pre_integrated(false)
 {
     camera_view_transformation.setToIdentity();
 }
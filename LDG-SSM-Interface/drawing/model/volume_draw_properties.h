@@ -1,6 +1,7 @@
 #ifndef VOLUME_DRAW_PROPERTIES_H
 #define VOLUME_DRAW_PROPERTIES_H
 
+#include "drawing/model/transfer_function.h"
 #include "drawing/model/types.h"
 
 #include <QMatrix4x4>
@@ -15,6 +16,10 @@ struct VolumeDrawProperties
 
     size_t sample_steps;
 
+    TransferFunction transfer_function;
+    size_t transfer_function_revision;          // Changed with every change of the transfer function, so it's only uploaded when it changes.
+    bool is_pre_integrated;                     // Whether the accumulation uses the transfer function averaged between consecutive samples.
+
     // Isosurface specific
     float threshold;
 
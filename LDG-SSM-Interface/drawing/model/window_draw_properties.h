@@ -20,6 +20,7 @@ struct WindowDrawProperties
     QVector2D draw_origin;              // Start pixel coordinates for drawing.
     QVector2D base_window_size;         // The size of the window at a scaling of 1.
     QVector2D scaled_window_size;       // Base window size scaled by scale.
+    QVector2D viewport_size;            // Size of the visible part of the window, to cull the nodes outside of it.
 };
 
 #endif // WINDOW_DRAW_PROPERTIES_H
@@ -34,7 +34,8 @@ void OverlayPainter::drawOverlay()
     double pen_width = new_pen.width();
     double before_pixels = pen_width / 2;
 
-    for (auto &[height, index] : tree_properties->draw_array) {
+    tree_properties->draw_array.forEach([&](size_t node) {
+        auto [height, index] = tree_properties->nodeLocation(node);
         double side_len = window_properties->height_node_lens[height];
         auto [num_rows, num_cols] = tree_properties->height_dims[height];
         double x = index % num_cols;
@@ -46,5 +47,5 @@ void OverlayPainter::drawOverlay()
             side_len - pen_width,
             side_len - pen_width
         );
-    }
+    });
 }
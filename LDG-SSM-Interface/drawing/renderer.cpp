@@ -1,5 +1,9 @@
 #include "renderer.h"
 
+#include <QDebug>
+#include <cmath>
+#include <cstddef>
+
 /**
  * @brief Renderer::Renderer
  * @param tree_properties
@@ -7,7 +11,9 @@
  */
 Renderer::Renderer(TreeDrawProperties *tree_properties, WindowDrawProperties *window_properties):
     tree_properties(tree_properties),
-    window_properties(window_properties)
+    window_properties(window_properties),
+    instance_buffer(0),
+    instance_capacity(0)
 {
 }
 
@@ -16,6 +22,9 @@ Renderer::Renderer(TreeDrawProperties *tree_properties, WindowDrawProperties *wi
  */
 Renderer::~Renderer()
 {
+    if (instance_buffer != 0)
+        gl->glDeleteBuffers(1, &instance_buffer);
+    instance_buffer = 0;
 }
 
 /**
@@ -40,6 +49,238 @@ void Renderer::updateUniforms()
 {
 }
 
+/**
+ * @brief Renderer::initializeInstanceBuffer Create the instance buffer and point the attributes of the bound VAO to it.
+ * The grid position, height and drawn flag of a record are read as a uvec4 at the location, and its element as a uint at the next location.
+ * @param location
+ */
+void Renderer::initializeInstanceBuffer(GLuint location)
+{
+    gl->glGenBuffers(1, &instance_buffer);
+    gl->glBindBuffer(GL_ARRAY_BUFFER, instance_buffer);
+
+    gl->glEnableVertexAttribArray(location);
+    gl->glVertexAttribIPointer(location, 4, GL_UNSIGNED_SHORT, sizeof(InstanceRecord), (const GLvoid *)offsetof(InstanceRecord, column));
+    gl->glVertexAttribDivisor(location, 1); // Instanced
+
+    gl->glEnableVertexAttribArray(location + 1);
+    gl->glVertexAttribIPointer(location + 1, 1, GL_UNSIGNED_INT, sizeof(InstanceRecord), (const GLvoid *)offsetof(InstanceRecord, element));
+    gl->glVertexAttribDivisor(location + 1, 1); // Instanced
+}
+
+/**
+ * @brief Renderer::setInstance Write the record of a drawn node to its slot.
+ * @param slot
+ * @param node
+ */
+void Renderer::setInstance(size_t slot, size_t node)
+{
+    if (slot >= instance_records.size())
+        instance_records.resize(slot + 1);
+
+    auto [height, index] = tree_properties->nodeLocation(node);
+    auto [num_rows, num_cols] = tree_properties->height_dims[height];
+
+    // Nodes without an element point to the entry past the elements, which stays empty.
+    int element = tree_properties->elements[node];
+    instance_records[slot] = {
+        static_cast<quint16>(index % num_cols),
+        static_cast<quint16>(index / num_cols),
+        static_cast<quint16>(height),
+        1,
+        static_cast<quint32>(element >= 0 ? element : tree_properties->disparities.size())
+    };
+}
+
+/**
+ * @brief Renderer::hideInstance Collapse the instance in a free slot, so it covers no pixels.
+ * @param slot
+ */
+void Renderer::hideInstance(size_t slot)
+{
+    instance_records[slot] = { 0, 0, 0, 0, static_cast<quint32>(tree_properties->disparities.size()) };
+}
+
+/**
+ * @brief Renderer::uploadInstances Upload the written slots to the instance buffer. The buffer is reallocated with room to grow when it is rebuilt or full.
+ * @param is_rebuilt All slots were written.
+ */
+void Renderer::uploadInstances(bool is_rebuilt)
+{
+    size_t num_instances = instance_slots.size();
+    auto ranges = instance_slots.takeChangedRanges();
+    gl->glBindBuffer(GL_ARRAY_BUFFER, instance_buffer);
+    if (is_rebuilt || num_instances > instance_capacity) {
+        instance_capacity = std::max<size_t>(num_instances * 2, 64);
+        ranges = { { 0, num_instances } };
+        gl->glBufferData(GL_ARRAY_BUFFER, sizeof(InstanceRecord) * instance_capacity, nullptr, GL_DYNAMIC_DRAW);
+    }
+
+    for (auto [first, count] : ranges)
+        gl->glBufferSubData(GL_ARRAY_BUFFER, sizeof(InstanceRecord) * first, sizeof(InstanceRecord) * count, instance_records.data() + first);
+}
+
+/**
+ * @brief visibleIndices Find the cells along an axis of the grid that overlap the visible part of the window.
+ * @param origin Start of the first cell.
+ * @param step Length of a cell and the spacing after it.
+ * @param visible_len
+ * @param num_cells
+ * @return The first and last visible cell, or an empty range if none are visible.
+ */
+static std::pair<size_t, size_t> visibleIndices(double origin, double step, double visible_len, size_t num_cells)
+{
+    double first = std::max(0., std::floor(-origin / step));
+    double last = std::min(static_cast<double>(num_cells) - 1., std::floor((visible_len - origin) / step));
+    if (step <= 0. || last < first)
+        return { 1, 0 };
+    return { static_cast<size_t>(first), static_cast<size_t>(last) };
+}
+
+/**
+ * @brief GridRange::operator==
+ * @param other
+ * @return
+ */
+bool GridRange::operator==(const GridRange &other) const
+{
+    return first_row == other.first_row && last_row == other.last_row && first_column == other.first_column && last_column == other.last_column;
+}
+
+/**
+ * @brief Renderer::updateVisibleRanges Find the rows and columns of every height that overlap the visible part of the window.
+ * All nodes are visible until the size of the visible part is known.
+ * @return True if the ranges changed since the last call.
+ */
+bool Renderer::updateVisibleRanges()
+{
+    std::vector<GridRange> ranges(tree_properties->height_dims.size());
+    for (size_t height = 0; height < ranges.size(); ++height) {
+        auto [num_rows, num_cols] = tree_properties->height_dims[height];
+        if (window_properties->viewport_size.isNull() || static_cast<qsizetype>(height) >= window_properties->height_node_lens.size()) {
+            ranges[height] = { 0, num_rows - 1, 0, num_cols - 1 };
+            continue;
+        }
+
+        double step = window_properties->height_node_lens[height] + window_properties->node_spacing;
+        auto [first_row, last_row] = visibleIndices(window_properties->draw_origin.y(), step, window_properties->viewport_size.y(), num_rows);
+        auto [first_col, last_col] = visibleIndices(window_properties->draw_origin.x(), step, window_properties->viewport_size.x(), num_cols);
+        ranges[height] = { first_row, last_row, first_col, last_col };
+    }
+
+    if (ranges == visible_ranges)
+        return false;
+
+    visible_ranges = std::move(ranges);
+    return true;
+}
+
+/**
+ * @brief Renderer::isVisible
+ * @param node
+ * @return True if the node overlaps the visible part of the window.
+ */
+bool Renderer::isVisible(size_t node) const
+{
+    auto [height, index] = tree_properties->nodeLocation(node);
+    const GridRange &range = visible_ranges[height];
+    size_t num_cols = tree_properties->height_dims[height].second;
+    size_t row = index / num_cols;
+    size_t col = index % num_cols;
+    return row >= range.first_row && row <= range.last_row && col >= range.first_column && col <= range.last_column;
+}
+
+/**
+ * @brief Renderer::findVisibleNodes Collect the drawn nodes that are visible. Node ids of a row of the grid are consecutive, so only the visible columns of the visible rows of the draw array are read.
+ */
+void Renderer::findVisibleNodes()
+{
+    visible_nodes.clear();
+    for (size_t height = 0; height < visible_ranges.size(); ++height) {
+        const GridRange &range = visible_ranges[height];
+        size_t num_cols = tree_properties->height_dims[height].second;
+        for (size_t row = range.first_row; row <= range.last_row && range.first_column <= range.last_column; ++row) {
+            tree_properties->draw_array.forEachInRange(
+                tree_properties->nodeId(height, row * num_cols + range.first_column),
+                tree_properties->nodeId(height, row * num_cols + range.last_column),
+                [this](size_t node) { visible_nodes.push_back(node); }
+            );
+        }
+    }
+}
+
+/**
+ * @brief Renderer::updateInstances Update the instances of the visible drawn nodes and upload them.
+ * Every instanced node keeps its slot in the instance buffer, so changes to the drawn nodes and scrolling only upload the slots of nodes that appear or disappear.
+ * All instances are rebuilt when the draw array was replaced, or to compact the slots once half of them are free.
+ */
+void Renderer::updateInstances()
+{
+    bool is_rebuilt = tree_properties->is_draw_array_replaced || instance_slots.numFree() * 2 > instance_slots.size();
+    bool is_moved = updateVisibleRanges();
+    added_instances.clear();
+
+    size_t slot;
+    if (is_rebuilt) {
+        findVisibleNodes();
+        instance_slots.clear();
+        instance_records.resize(visible_nodes.size());
+        for (size_t node : visible_nodes)
+            setInstance(instance_slots.insert(node), node);
+        added_instances = visible_nodes;
+    } else if (is_moved) {
+        // Nodes that left the window are hidden, and drawn nodes that entered it get a slot.
+        instance_slots.nodes(visible_nodes);
+        for (size_t node : visible_nodes) {
+            if ((!tree_properties->draw_array.contains(node) || !isVisible(node)) && instance_slots.remove(node, slot))
+                hideInstance(slot);
+        }
+        findVisibleNodes();
+        for (size_t node : visible_nodes) {
+            if (!instance_slots.contains(node)) {
+                setInstance(instance_slots.insert(node), node);
+                added_instances.push_back(node);
+            }
+        }
+    } else {
+        // A node may have been drawn and hidden again since the last update, so only its final state counts.
+        for (size_t node : tree_properties->drawn_nodes_removed) {
+            if (!tree_properties->draw_array.contains(node) && instance_slots.remove(node, slot))
+                hideInstance(slot);
+        }
+        for (size_t node : tree_properties->drawn_nodes_added) {
+            if (tree_properties->draw_array.contains(node) && isVisible(node) && !instance_slots.contains(node)) {
+                setInstance(instance_slots.insert(node), node);
+                added_instances.push_back(node);
+            }
+        }
+    }
+
+    uploadInstances(is_rebuilt);
+    tree_properties->clearDrawArrayChanges();
+}
+
+/**
+ * @brief Renderer::setLayoutUniforms Set the sizes the vertex shaders place the instances with, in device pixels.
+ * The instances only hold their place in the grid, so zooming and resizing only change these uniforms.
+ * The volume cubes keep the depth of the nodes at the top of the tree, given as base_side_len.
+ * @param shader Bound shader.
+ */
+void Renderer::setLayoutUniforms(QOpenGLShaderProgram *shader)
+{
+    float pixel_ratio = window_properties->device_pixel_ratio;
+    auto &height_node_lens = window_properties->height_node_lens;
+    std::vector<GLfloat> node_lens(MAX_INSTANCE_HEIGHTS, 0.f);
+    if (static_cast<size_t>(height_node_lens.size()) > MAX_INSTANCE_HEIGHTS)
+        qDebug() << "Only the lowest" << MAX_INSTANCE_HEIGHTS << "heights of the tree can be drawn";
+    for (size_t height = 0; height < std::min<size_t>(height_node_lens.size(), MAX_INSTANCE_HEIGHTS); ++height)
+        node_lens[height] = height_node_lens[height] * pixel_ratio;
+
+    gl->glUniform1fv(shader->uniformLocation("node_lens"), MAX_INSTANCE_HEIGHTS, node_lens.data());
+    gl->glUniform1f(shader->uniformLocation("node_spacing"), window_properties->node_spacing * pixel_ratio);
+    gl->glUniform1f(shader->uniformLocation("base_side_len"), height_node_lens.isEmpty() ? 0.f : height_node_lens.last() * pixel_ratio);
+}
+
 /**
  * @brief Renderer::render
  */
@@ -4,9 +4,38 @@
 #include <QObject>
 #include <QOpenGLFunctions_4_1_Core>
 #include <QOpenGLShaderProgram>
+#include <vector>
 
 #include <drawing/model/window_draw_properties.h>
 #include "drawing/model/tree_draw_properties.h"
+#include "instance_slots.h"
+
+const size_t MAX_INSTANCE_HEIGHTS = 32;             // Size of the node_lens uniform of the vertex shaders.
+
+/**
+ * @brief The InstanceRecord struct Per-instance attributes of a drawn node. The vertex shaders derive its position on screen from its place in the grid.
+ */
+struct InstanceRecord
+{
+    quint16 column;
+    quint16 row;
+    quint16 height;
+    quint16 is_drawn;                               // 0 for free slots, whose instances are collapsed.
+    quint32 element;                                // Entry of the page table holding the block of the node in the atlas.
+};
+
+/**
+ * @brief The GridRange struct Rows and columns of a height of the grid, inclusive. Empty if the first row is past the last.
+ */
+struct GridRange
+{
+    size_t first_row;
+    size_t last_row;
+    size_t first_column;
+    size_t last_column;
+
+    bool operator==(const GridRange &other) const;
+};
 
 /**
  * @brief The Renderer class Interface for render classes.
@@ -26,6 +55,30 @@ protected:
     QOpenGLFunctions_4_1_Core *gl;
     TreeDrawProperties *tree_properties;
     WindowDrawProperties *window_properties;
+
+    // Instance records by slot, mirrored in the instance buffer.
+    InstanceSlots instance_slots;
+    std::vector<InstanceRecord> instance_records;
+    GLuint instance_buffer;
+    size_t instance_capacity;                       // Number of instances the buffer has room for.
+    std::vector<size_t> added_instances;            // Nodes that were given a slot by the last update.
+
+    void initializeInstanceBuffer(GLuint location);
+    void updateInstances();
+    void setLayoutUniforms(QOpenGLShaderProgram *shader);
+
+private:
+    // Only drawn nodes in the visible part of the window are instanced. The visible part of every height is a range of the grid.
+    std::vector<GridRange> visible_ranges;
+    std::vector<size_t> visible_nodes;
+
+    bool updateVisibleRanges();
+    bool isVisible(size_t node) const;
+    void findVisibleNodes();
+
+    void setInstance(size_t slot, size_t node);
+    void hideInstance(size_t slot);
+    void uploadInstances(bool is_rebuilt);
 };
 
 #endif // RENDERER_H
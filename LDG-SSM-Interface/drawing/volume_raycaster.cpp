@@ -1,17 +1,39 @@
 #include "volume_raycaster.h"
+#include "drawing/atlas_texture.h"
 #include "drawing/model/mesh.h"
+#include "util/element_cache.h"
+#include "util/tree_functions.h"
 
+#include <QDebug>
 #include <QOpenGLPixelTransferOptions>
+#include <QSet>
 
 /**
  * @brief VolumeRaycaster::VolumeRaycaster
  * @param tree_properties
  * @param window_properties
  * @param volume_properties
+ * @param atlas_container Layout of the atlas built for the tree.
+ * @param volume_texture 3D texture containing the volume atlas. The renderer takes ownership.
+ * @param gradient_texture 3D texture containing the gradients of the volume atlas, or nullptr if the atlas is paged. The renderer takes ownership.
+ * If the atlas is paged, the volumes of drawn nodes are put in it on demand, evicting the least recently drawn ones.
  */
-VolumeRaycaster::VolumeRaycaster(TreeDrawProperties *tree_properties, WindowDrawProperties *window_properties, VolumeDrawProperties *volume_properties):
+VolumeRaycaster::VolumeRaycaster(TreeDrawProperties *tree_properties, WindowDrawProperties *window_properties, VolumeDrawProperties *volume_properties, AtlasContainer atlas_container, QOpenGLTexture *volume_texture, QOpenGLTexture *gradient_texture):
     volume_properties(volume_properties),
-    volume_texture(QOpenGLTexture::Target3D),
+    atlas_container(atlas_container),
+    volume_texture(volume_texture),
+    page_table_texture(nullptr),
+    occupancy_texture(nullptr),
+    gradient_texture(gradient_texture),
+    first_changed_row(1),
+    last_changed_row(0),
+    residency(atlas_container.is_paged ? atlas_container.numPages() * atlas_container.blocksPerPage() : 0),
+    transfer_function_texture(nullptr),
+    opacity_sums_texture(nullptr),
+    pre_integrated_texture(nullptr),
+    transfer_function_revision(SIZE_MAX),
+    pre_integrated_revision(SIZE_MAX),
+    num_indices(0),
     Renderer(tree_properties, window_properties)
 {
 }
@@ -23,19 +45,28 @@ VolumeRaycaster::~VolumeRaycaster()
 {
     gl->glDeleteVertexArrays(1, &vertex_array_object);
     gl->glDeleteBuffers(1, &vertex_buffer);
-    gl->glDeleteBuffers(1, &transformation_buffer);
-    gl->glDeleteBuffers(1, &viewport_buffer);
-    gl->glDeleteBuffers(1, &texture_coords_buffer);
     gl->glDeleteBuffers(1, &index_buffer);
 
     vertex_array_object = 0;
     vertex_buffer = 0;
-    transformation_buffer = 0;
-    viewport_buffer = 0;
-    texture_coords_buffer = 0;
     index_buffer = 0;
 
-    volume_texture.destroy();
+    volume_texture->destroy();
+    delete volume_texture;
+    page_table_texture->destroy();
+    delete page_table_texture;
+    occupancy_texture->destroy();
+    delete occupancy_texture;
+    if (gradient_texture != nullptr)
+        gradient_texture->destroy();
+    delete gradient_texture;
+    transfer_function_texture->destroy();
+    delete transfer_function_texture;
+    opacity_sums_texture->destroy();
+    delete opacity_sums_texture;
+    if (pre_integrated_texture != nullptr)
+        pre_integrated_texture->destroy();
+    delete pre_integrated_texture;
     qDeleteAll(shaders);
 }
 
@@ -53,7 +84,15 @@ void VolumeRaycaster::intialize(QOpenGLFunctions_4_1_Core *gl)
 
     initializeBuffers();
     initializeShaders();
-    initializeTexture();
+    initializePageTable();
+    initializeMesh();
+
+    // The grid and gradients are kept by the textures, and updated per volume when they are put in the atlas later on.
+    // The gradient texture was filled while loading, and a paged atlas has none.
+    occupancy_texture = createOccupancyTexture(atlas_container);
+    atlas_container.occupancy = QList<unsigned char>();
+
+    initializeTransferFunction();
 
     updateBuffers();
     updateUniforms();
@@ -65,9 +104,7 @@ void VolumeRaycaster::intialize(QOpenGLFunctions_4_1_Core *gl)
 void VolumeRaycaster::initializeBuffers()
 {
     GLuint vertex_buf_loc = 0;
-    GLuint viewport_buf_loc = 1;
-    GLuint texture_coords_buf_loc = 2;
-    GLuint transformation_buf_loc = 3;
+    GLuint instance_buf_loc = 1;
 
     gl->glGenVertexArrays(1, &vertex_array_object);
     gl->glBindVertexArray(vertex_array_object);
@@ -77,26 +114,7 @@ void VolumeRaycaster::initializeBuffers()
     gl->glEnableVertexAttribArray(vertex_buf_loc);
     gl->glVertexAttribPointer(vertex_buf_loc, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
 
-    gl->glGenBuffers(1, &viewport_buffer);
-    gl->glBindBuffer(GL_ARRAY_BUFFER, viewport_buffer);
-    gl->glEnableVertexAttribArray(viewport_buf_loc);
-    gl->glVertexAttribPointer(viewport_buf_loc, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
-    gl->glVertexAttribDivisor(viewport_buf_loc, 1); // Instanced
-
-    gl->glGenBuffers(1, &texture_coords_buffer);
-    gl->glBindBuffer(GL_ARRAY_BUFFER, texture_coords_buffer);
-    gl->glEnableVertexAttribArray(texture_coords_buf_loc);
-    gl->glVertexAttribPointer(texture_coords_buf_loc, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
-    gl->glVertexAttribDivisor(texture_coords_buf_loc, 1); // Instanced
-
-    // Mat4 requires 4 vertex attribute pointers
-    gl->glGenBuffers(1, &transformation_buffer);
-    gl->glBindBuffer(GL_ARRAY_BUFFER, transformation_buffer);
-    for (unsigned int idx = 0; idx < 4; ++idx) {
-        gl->glEnableVertexAttribArray(transformation_buf_loc + idx);
-        gl->glVertexAttribPointer(transformation_buf_loc + idx, 4, GL_FLOAT, GL_FALSE, sizeof(QMatrix4x4), (const GLvoid *)(sizeof(QVector4D) * idx));
-        gl->glVertexAttribDivisor(transformation_buf_loc + idx, 1); // Instanced
-    }
+    initializeInstanceBuffer(instance_buf_loc);
 
     gl->glGenBuffers(1, &index_buffer);
     gl->glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer);
@@ -128,34 +146,173 @@ void VolumeRaycaster::initializeShaders()
 }
 
 /**
- * @brief VolumeRaycaster::initializeTexture Initialize the volume atlas.
+ * @brief VolumeRaycaster::initializePageTable Create the page table, with the volumes that are already in the atlas.
+ */
+void VolumeRaycaster::initializePageTable()
+{
+    size_t num_elements = tree_properties->disparities.size() + 1;
+    page_table.assign((num_elements + PAGE_TABLE_WIDTH - 1) / PAGE_TABLE_WIDTH * PAGE_TABLE_WIDTH, QVector4D());
+    if (tree_properties->loading_mode == LoadingMode::EAGER && !atlas_container.is_paged) {
+        for (auto [element, coords] : atlas_container.mapping.asKeyValueRange())
+            page_table[element] = QVector4D(coords, 1.f);
+    }
+
+    page_table_texture = createPageTableTexture(num_elements);
+    uploadPageTableRows(page_table_texture, page_table, 0, page_table.size() / PAGE_TABLE_WIDTH - 1);
+}
+
+/**
+ * @brief VolumeRaycaster::initializeTransferFunction Create the lookup textures of the transfer function, which are filled when the uniforms are updated.
+ */
+void VolumeRaycaster::initializeTransferFunction()
+{
+    transfer_function_texture = new QOpenGLTexture(QOpenGLTexture::Target1D);
+    transfer_function_texture->setMinMagFilters(QOpenGLTexture::Linear, QOpenGLTexture::Linear);
+    transfer_function_texture->setWrapMode(QOpenGLTexture::ClampToEdge);
+    transfer_function_texture->setSize(TRANSFER_FUNCTION_SIZE);
+    transfer_function_texture->setFormat(QOpenGLTexture::RGBA32F);
+    transfer_function_texture->allocateStorage();
+
+    opacity_sums_texture = new QOpenGLTexture(QOpenGLTexture::Target1D);
+    opacity_sums_texture->setMinMagFilters(QOpenGLTexture::Nearest, QOpenGLTexture::Nearest);
+    opacity_sums_texture->setWrapMode(QOpenGLTexture::ClampToEdge);
+    opacity_sums_texture->setSize(TRANSFER_FUNCTION_SIZE + 1);
+    opacity_sums_texture->setFormat(QOpenGLTexture::R32F);
+    opacity_sums_texture->allocateStorage();
+}
+
+/**
+ * @brief VolumeRaycaster::uploadTransferFunction Upload the transfer function if it changed since the last upload.
+ * Editing it only uploads the lookup table and its opacity sums. The pre-integrated table is only rebuilt while it's used.
+ */
+void VolumeRaycaster::uploadTransferFunction()
+{
+    auto &transfer_function = volume_properties->transfer_function;
+    size_t revision = volume_properties->transfer_function_revision;
+    if (transfer_function_revision != revision) {
+        transfer_function_texture->setData(QOpenGLTexture::RGBA, QOpenGLTexture::Float32, transfer_function.table.data());
+        opacity_sums_texture->setData(QOpenGLTexture::Red, QOpenGLTexture::Float32, transfer_function.opacitySums().data());
+        transfer_function_revision = revision;
+    }
+
+    if (volume_properties->is_pre_integrated && pre_integrated_revision != revision) {
+        if (pre_integrated_texture == nullptr) {
+            pre_integrated_texture = new QOpenGLTexture(QOpenGLTexture::Target2D);
+            pre_integrated_texture->setMinMagFilters(QOpenGLTexture::Linear, QOpenGLTexture::Linear);
+            pre_integrated_texture->setWrapMode(QOpenGLTexture::ClampToEdge);
+            pre_integrated_texture->setSize(TRANSFER_FUNCTION_SIZE, TRANSFER_FUNCTION_SIZE);
+            pre_integrated_texture->setFormat(QOpenGLTexture::RGBA32F);
+            pre_integrated_texture->allocateStorage();
+        }
+        pre_integrated_texture->setData(QOpenGLTexture::RGBA, QOpenGLTexture::Float32, transfer_function.preIntegratedTable().data());
+        pre_integrated_revision = revision;
+    }
+}
+
+/**
+ * @brief VolumeRaycaster::setPageTableEntry Change the entry of an element, to be uploaded with the next buffer update.
+ * @param element
+ * @param entry
+ */
+void VolumeRaycaster::setPageTableEntry(size_t element, QVector4D entry)
+{
+    page_table[element] = entry;
+    size_t row = element / PAGE_TABLE_WIDTH;
+    if (first_changed_row > last_changed_row) {
+        first_changed_row = row;
+        last_changed_row = row;
+    } else {
+        first_changed_row = std::min(first_changed_row, row);
+        last_changed_row = std::max(last_changed_row, row);
+    }
+}
+
+/**
+ * @brief VolumeRaycaster::isResident
+ * @param element
+ * @return True if the volume of the element is in the atlas.
  */
-void VolumeRaycaster::initializeTexture()
+bool VolumeRaycaster::isResident(size_t element) const
+{
+    return page_table[element].w() > 0.f;
+}
+
+/**
+ * @brief VolumeRaycaster::uploadDrawnNodes Put the volumes of drawn nodes whose element is not in the atlas yet into the atlas, and prefetch the volumes of their children.
+ * A paged atlas evicts the least recently drawn volumes to make room, but never the volumes that are drawn.
+ * @param nodes Drawn nodes to consider. These are all instanced nodes for a paged atlas, and otherwise only the newly instanced nodes as the rest are already in the atlas.
+ */
+void VolumeRaycaster::uploadDrawnNodes(const std::vector<size_t> &nodes)
 {
-    GLint max_texture_size;
-    glGetIntegerv(GL_MAX_3D_TEXTURE_SIZE, &max_texture_size);
-    atlas_container = createVolumeAtlasContainer(tree_properties, max_texture_size);
-
-    volume_texture.setWrapMode(QOpenGLTexture::ClampToEdge);
-    volume_texture.setMinMagFilters(QOpenGLTexture::Linear, QOpenGLTexture::Linear);
-    volume_texture.setSize(atlas_container.dims[0], atlas_container.dims[1], atlas_container.dims[2]);
-    volume_texture.setFormat(QOpenGLTexture::R8_UNorm);
-    volume_texture.allocateStorage();
     QOpenGLPixelTransferOptions transfer_options;
     transfer_options.setAlignment(1);
-    volume_texture.setData(0, QOpenGLTexture::Red, QOpenGLTexture::UInt8, atlas_container.data.data(), &transfer_options);
+
+    QSet<size_t> drawn_elements;
+    for (size_t node : nodes) {
+        int element = tree_properties->elements[node];
+        if (element >= 0)
+            drawn_elements.insert(element);
+    }
+
+    for (size_t element : drawn_elements) {
+        if (isResident(element)) {
+            if (atlas_container.is_paged)
+                residency.touch(element);
+            continue;
+        }
+
+        auto volume_data = tree_properties->element_cache->element(element);
+        if (volume_data == nullptr)
+            continue;
+
+        size_t slot;
+        if (atlas_container.is_paged) {
+            long long evicted_element;
+            if (!residency.acquire(element, drawn_elements, slot, evicted_element)) {
+                qDebug() << "Paged volume atlas can't hold all" << drawn_elements.size() << "drawn volumes";
+                break;
+            }
+            if (evicted_element >= 0)
+                setPageTableEntry(evicted_element, QVector4D());
+        } else {
+            slot = atlas_container.element_slots[element];
+        }
+
+        // Blocks have the dims of the volumes, so the volume is uploaded as is.
+        auto [x, y, z] = atlas_container.blockOrigin(slot);
+        volume_texture->setData(
+            x, y, z,
+            atlas_container.block_dims[0], atlas_container.block_dims[1], atlas_container.block_dims[2],
+            QOpenGLTexture::Red, QOpenGLTexture::UInt8, volume_data.get(), &transfer_options
+        );
+        uploadOccupancyBlock(occupancy_texture, atlas_container, slot, createVolumeOccupancyBlock(atlas_container, volume_data.get()).constData());
+        if (gradient_texture != nullptr)
+            uploadGradientBlock(gradient_texture, atlas_container, slot, createVolumeGradientBlock(atlas_container, volume_data.get()).constData());
+        setPageTableEntry(element, QVector4D(atlas_container.blockCoords(slot), 1.f));
+    }
+
+    if (first_changed_row <= last_changed_row) {
+        uploadPageTableRows(page_table_texture, page_table, first_changed_row, last_changed_row);
+        first_changed_row = 1;
+        last_changed_row = 0;
+    }
+
+    QList<size_t> prefetch_elements;
+    for (size_t element : getChildElements(nodes, tree_properties)) {
+        if (!isResident(element))
+            prefetch_elements.append(element);
+    }
+    tree_properties->element_cache->prefetch(prefetch_elements);
 }
 
 /**
- * @brief VolumeRaycaster::updateBuffers Put the appropriate volumes into memory
+ * @brief VolumeRaycaster::initializeMesh Set the base to-be-instanced shape and indices. The cube has unit size, and is scaled to the node in the shader.
  */
-void VolumeRaycaster::updateBuffers()
+void VolumeRaycaster::initializeMesh()
 {
-    // Set the base to-be-instanced shape and indices
-    double base_side_len = window_properties->height_node_lens[tree_properties->tree_max_height] * window_properties->device_pixel_ratio;
     auto mesh = createCube(
         QVector3D{ 0., 0., 0. },
-        base_side_len,
+        1.,
         -1
     );
     gl->glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
@@ -163,52 +320,21 @@ void VolumeRaycaster::updateBuffers()
     gl->glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer);
     gl->glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * mesh.indices.size(), mesh.indices.data(), GL_STATIC_DRAW);
     num_indices = mesh.indices.size();
+}
 
-    // Set data per instance
-    QList<QMatrix4x4> transformation_matrices;
-    QList<QVector3D> viewport_vectors;
-    QList<QVector3D> volume_coords;
-    float spacing = window_properties->node_spacing * window_properties->device_pixel_ratio;
-    float window_height = window_properties->scaled_window_size.y() * window_properties->device_pixel_ratio;
-    for (auto &[height, index] : tree_properties->draw_array) {
-        float side_len = window_properties->height_node_lens[height] * window_properties->device_pixel_ratio;
-        auto [num_rows, num_cols] = tree_properties->height_dims[height];
-        double x = index % num_cols;
-        double y = index / num_cols;
-
-        // Transformation translates to the origin of the cell and then scales down to the appropriates sizes.
-        // We remove 4 pixels from each side to deal with overdraw of the overlay.
-        QMatrix4x4 transformation;
-        QVector3D origin{
-            static_cast<float>(x * (side_len + spacing)) + 4,
-            static_cast<float>(y * (side_len + spacing)) + 4,
-            0.
-        };
-        float factor = (side_len - 8) / base_side_len;
-        transformation.translate(origin);
-        transformation.scale(factor, factor);
-        transformation_matrices.append(transformation);
-
-        // Viewport consists of the origin and side lengths
-        viewport_vectors.append({
-            origin.x(),
-            origin.y(),
-            side_len
-        });
-
-        // For the texture coordinates we just need to know the start of the texture
-        volume_coords.append(atlas_container.mapping[{ height, index }]);
+/**
+ * @brief VolumeRaycaster::updateBuffers Update the instances of the visible drawn nodes, and put the appropriate volumes into memory.
+ * A paged atlas may evict any volume that isn't instanced, so it considers all instanced nodes. Otherwise only the newly instanced nodes are considered.
+ */
+void VolumeRaycaster::updateBuffers()
+{
+    updateInstances();
+    if (atlas_container.is_paged) {
+        instance_slots.nodes(drawn_nodes);
+        uploadDrawnNodes(drawn_nodes);
+    } else if (tree_properties->loading_mode == LoadingMode::LAZY) {
+        uploadDrawnNodes(added_instances);
     }
-
-    // Bind and set data
-    gl->glBindBuffer(GL_ARRAY_BUFFER, transformation_buffer);
-    gl->glBufferData(GL_ARRAY_BUFFER, sizeof(QMatrix4x4) * transformation_matrices.size(), transformation_matrices.data(), GL_STATIC_DRAW);
-
-    gl->glBindBuffer(GL_ARRAY_BUFFER, viewport_buffer);
-    gl->glBufferData(GL_ARRAY_BUFFER, sizeof(QVector3D) * viewport_vectors.size(), viewport_vectors.data(), GL_STATIC_DRAW);
-
-    gl->glBindBuffer(GL_ARRAY_BUFFER, texture_coords_buffer);
-    gl->glBufferData(GL_ARRAY_BUFFER, sizeof(QVector3D) * volume_coords.size(), volume_coords.data(), GL_STATIC_DRAW);
 }
 
 /**
@@ -233,6 +359,42 @@ void VolumeRaycaster::updateUniforms()
     auto vector = tree_properties->gl_space_scale_vector;
     gl->glUniform3f(screen_space_projection_uniform, vector.x(), vector.y(), vector.z());
 
+    page_table_uniform = shader->uniformLocation("page_table");
+    gl->glUniform1i(page_table_uniform, 1);
+
+    // The shader places the volumes from their place in the grid.
+    setLayoutUniforms(shader);
+
+    uploadTransferFunction();
+
+    transfer_function_uniform = shader->uniformLocation("transfer_function");
+    gl->glUniform1i(transfer_function_uniform, 3);
+
+    opacity_sums_uniform = shader->uniformLocation("opacity_sums");
+    gl->glUniform1i(opacity_sums_uniform, 4);
+
+    pre_integrated_uniform = shader->uniformLocation("pre_integrated_transfer_function");
+    gl->glUniform1i(pre_integrated_uniform, 5);
+
+    is_pre_integrated_uniform = shader->uniformLocation("is_pre_integrated");
+    gl->glUniform1i(is_pre_integrated_uniform, volume_properties->is_pre_integrated && pre_integrated_texture != nullptr);
+
+    occupancy_uniform = shader->uniformLocation("occupancy");
+    gl->glUniform1i(occupancy_uniform, 2);
+
+    brick_size_uniform = shader->uniformLocation("brick_size");
+    auto [x_dim, y_dim, z_dim] = tree_properties->data_dims;
+    gl->glUniform3f(brick_size_uniform, float(OCCUPANCY_BRICK_SIZE) / x_dim, float(OCCUPANCY_BRICK_SIZE) / y_dim, float(OCCUPANCY_BRICK_SIZE) / z_dim);
+
+    gradients_uniform = shader->uniformLocation("gradients");
+    gl->glUniform1i(gradients_uniform, 6);
+
+    has_gradients_uniform = shader->uniformLocation("has_gradients");
+    gl->glUniform1i(has_gradients_uniform, gradient_texture != nullptr);
+
+    voxel_size_uniform = shader->uniformLocation("voxel_size");
+    gl->glUniform3f(voxel_size_uniform, 1.f / x_dim, 1.f / y_dim, 1.f / z_dim);
+
     texture_coords_offset_uniform = shader->uniformLocation("texture_coords_offset");
     gl->glUniform3f(texture_coords_offset_uniform, atlas_container.coord_offsets.x(), atlas_container.coord_offsets.y(), atlas_container.coord_offsets.z());
 
@@ -242,8 +404,10 @@ void VolumeRaycaster::updateUniforms()
         2,
         1.
     );
-    auto origin = mesh.vertices.first();
-    auto end = mesh.vertices.last();
+    // The box is shrunk to the shape of the volumes, so rays only pass through voxels of the volume.
+    auto shape = tree_properties->elementShape();
+    auto origin = mesh.vertices.first() * shape;
+    auto end = mesh.vertices.last() * shape;
     auto center = (origin + end) / 2.;
 
     QMatrix3x3 bounding_box;
@@ -275,14 +439,30 @@ void VolumeRaycaster::render()
     gl->glDepthFunc(GL_LEQUAL);
 
     shaders[volume_properties->render_type]->bind();
-    volume_texture.bind();
+    volume_texture->bind();
+    page_table_texture->bind(1, QOpenGLTexture::ResetTextureUnit);
+    occupancy_texture->bind(2, QOpenGLTexture::ResetTextureUnit);
+    transfer_function_texture->bind(3, QOpenGLTexture::ResetTextureUnit);
+    opacity_sums_texture->bind(4, QOpenGLTexture::ResetTextureUnit);
+    if (pre_integrated_texture != nullptr)
+        pre_integrated_texture->bind(5, QOpenGLTexture::ResetTextureUnit);
+    if (gradient_texture != nullptr)
+        gradient_texture->bind(6, QOpenGLTexture::ResetTextureUnit);
     gl->glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
 
     gl->glBindVertexArray(vertex_array_object);
-    gl->glDrawElementsInstanced(GL_TRIANGLES, num_indices, GL_UNSIGNED_INT, nullptr, tree_properties->draw_array.size());
+    gl->glDrawElementsInstanced(GL_TRIANGLES, num_indices, GL_UNSIGNED_INT, nullptr, instance_slots.size());
     gl->glBindVertexArray(0);
 
-    volume_texture.release();
+    if (gradient_texture != nullptr)
+        gradient_texture->release(6, QOpenGLTexture::ResetTextureUnit);
+    if (pre_integrated_texture != nullptr)
+        pre_integrated_texture->release(5, QOpenGLTexture::ResetTextureUnit);
+    opacity_sums_texture->release(4, QOpenGLTexture::ResetTextureUnit);
+    transfer_function_texture->release(3, QOpenGLTexture::ResetTextureUnit);
+    occupancy_texture->release(2, QOpenGLTexture::ResetTextureUnit);
+    page_table_texture->release(1, QOpenGLTexture::ResetTextureUnit);
+    volume_texture->release();
     shaders[volume_properties->render_type]->release();
 }
 
@@ -4,10 +4,13 @@
 #include "renderer.h"
 
 #include <QOpenGLTexture>
+#include <QVector4D>
+#include <vector>
 
 #include <drawing/model/volume_draw_properties.h>
 
 #include <util/atlas_container.h>
+#include <util/atlas_residency.h>
 
 /**
  * @brief The VolumeRaycaster class Renderer for performing volume raycasting
@@ -18,22 +21,43 @@ class VolumeRaycaster : public Renderer
     QMap<VolumeRenderingType, QOpenGLShaderProgram *> shaders;
 
     GLint projection_matrix_uniform, model_view_uniform, screen_origin_uniform, screen_space_projection_uniform, texture_coords_offset_uniform, bounding_box_uniform, num_samples_uniform, threshold_uniform;
-    GLint background_color_uniform;
+    GLint background_color_uniform, page_table_uniform, occupancy_uniform, brick_size_uniform, gradients_uniform, has_gradients_uniform, voxel_size_uniform;
+    GLint transfer_function_uniform, opacity_sums_uniform, pre_integrated_uniform, is_pre_integrated_uniform;
 
     GLuint vertex_array_object;
-    GLuint vertex_buffer, transformation_buffer, viewport_buffer, texture_coords_buffer, index_buffer;
+    GLuint vertex_buffer, index_buffer;
 
     AtlasContainer atlas_container;
-    QOpenGLTexture volume_texture;
+    QOpenGLTexture *volume_texture;
+    QOpenGLTexture *page_table_texture;
+    QOpenGLTexture *occupancy_texture;              // [min, max] value of every brick of the volumes, to skip bricks that can't contribute.
+    QOpenGLTexture *gradient_texture;               // Gradient of every voxel to shade isosurfaces. None for paged atlasses, whose gradients are estimated while drawing.
+    std::vector<QVector4D> page_table;              // Block of every element in the atlas, see createPageTableTexture. The entry past the elements stays empty, for nodes without an element.
+    size_t first_changed_row, last_changed_row;     // Rows of the page table that haven't been uploaded yet. None if the first is past the last.
+    AtlasResidency residency;                       // Elements occupying the blocks of a paged atlas.
+
+    QOpenGLTexture *transfer_function_texture;
+    QOpenGLTexture *opacity_sums_texture;
+    QOpenGLTexture *pre_integrated_texture;         // Only created once pre-integration is used.
+    size_t transfer_function_revision;              // Revisions of the transfer function in the textures, to upload only changes.
+    size_t pre_integrated_revision;
 
     size_t num_indices;
 
+    std::vector<size_t> drawn_nodes;               // Instanced nodes, whose volumes a paged atlas keeps.
+
     void initializeBuffers();
     void initializeShaders();
-    void initializeTexture();
+    void initializePageTable();
+    void initializeTransferFunction();
+    void uploadTransferFunction();
+    void setPageTableEntry(size_t element, QVector4D entry);
+    bool isResident(size_t element) const;
+    void uploadDrawnNodes(const std::vector<size_t> &nodes);
+    void initializeMesh();
 
 public:
-    VolumeRaycaster(TreeDrawProperties *draw_properties, WindowDrawProperties *window_properties, VolumeDrawProperties *volume_properties);
+    VolumeRaycaster(TreeDrawProperties *draw_properties, WindowDrawProperties *window_properties, VolumeDrawProperties *volume_properties, AtlasContainer atlas_container, QOpenGLTexture *volume_texture, QOpenGLTexture *gradient_texture);
     ~VolumeRaycaster() override;
 
     void intialize(QOpenGLFunctions_4_1_Core *gl) override;
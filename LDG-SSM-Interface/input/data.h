@@ -1,97 +1,105 @@
 #ifndef DATA_H
 #define DATA_H
 
-#include <bzlib.h>
+#include "input/input_buffer.h"
+#include "input/parallel_bzip2.h"
+#include "input/seekable_zstd.h"
+#include "util/progress.h"
 
 #include <QDebug>
 #include <cstddef>
-#include <fstream>
+#include <cstring>
+#include <memory>
 
 /**
- * @brief readRawFile Read data from a .raw file into a buffer.
- * @param buf
+ * @brief readRawFile Map a .raw file into memory. The data is not copied, the buffer reads straight from the mapped pages.
+ * @param buffer
  * @param file_name
+ * @param advice Expected access pattern of the data, used as read-ahead hint.
  * @return
  */
 template<typename DataType>
-long readRawFile(std::vector<DataType> &buffer, std::string file_name)
+long readRawFile(InputBuffer<DataType> &buffer, QString file_name, MappingAdvice advice)
 {
-    std::ifstream file_stream(file_name.c_str(), std::ios::in|std::ios::binary|std::ios::ate);
-
-    if(!file_stream.is_open()) {
-        qDebug() << "Could not open file: " << file_name;
+    auto mapping = std::make_shared<MappedFile>();
+    if (!mapping->open(file_name))
         return -1;
-    }
 
-    size_t size = file_stream.tellg();
-    size_t num_elements = size / sizeof(DataType);
-
-    file_stream.seekg(0, std::ios::beg);
-    buffer.resize(num_elements);
-    file_stream.read((char*)&buffer[0], num_elements * sizeof(DataType));
+    mapping->advise(advice);
+    buffer.storage.clear();
+    buffer.mapping = mapping;
 
     return buffer.size();
 }
 
 /**
- * @brief readBZipFile Read data from a .raw.bz2 file into a buffer.
- * @param output_buffer
+ * @brief readBZipFile Decompress a .raw.bz2 file straight into a buffer of known size.
+ * Apart from the destination, only a few blocks per thread or a small streaming window are kept in memory.
+ * @param destination Buffer with room for exactly num_elements elements.
+ * @param num_elements Expected number of elements in the file.
  * @param file_name
- * @return
+ * @param progress Optional callback receiving the number of decompressed bytes and the expected total.
+ * @return Number of elements read, or -1 on an error or when the file contains more than num_elements elements.
  */
 template<typename DataType>
-long readBZipFile(std::vector<DataType> &output_buffer, std::string file_name)
+long readBZipFile(DataType *destination, size_t num_elements, QString file_name, const ProgressCallback &progress = nullptr)
 {
-    std::ifstream file_stream(file_name, std::ios::binary);
-    if (!file_stream.is_open()) {
-        qDebug() << "Could not open file: " << file_name;
-        return -1;
-    }
-
-    // Find file size
-    file_stream.seekg(0, std::ios::end);
-    int file_size = file_stream.tellg();
-    file_stream.seekg(0, std::ios::beg);
-
-    // Create buffers
-    uint output_buf_size = output_buffer.size() * sizeof(DataType) > file_size ? output_buffer.size() * sizeof(DataType) : file_size * 2;
-    output_buffer.resize(output_buf_size / sizeof(DataType));
-    std::vector<char> input_buffer(file_size);
-
-    // Read data and decompress
-    file_stream.read(input_buffer.data(), file_size);
-    int bz_error = BZ2_bzBuffToBuffDecompress(
-        reinterpret_cast<char *>(output_buffer.data()),
-        &output_buf_size,
-        input_buffer.data(),
-        file_size,
-        0,
-        0
-        );
+    unsigned char *output = reinterpret_cast<unsigned char *>(destination);
+    long num_bytes = decompressBZip2(file_name, num_elements * sizeof(DataType), [output](size_t offset, const unsigned char *data, size_t size) {
+        std::memcpy(output + offset, data, size);
+    }, progress);
+    return num_bytes < 0 ? num_bytes : num_bytes / sizeof(DataType);
+}
 
-    if (bz_error != BZ_OK) {
-        qDebug() << "Could not decompress file: " << file_name;
+/**
+ * @brief readSeekableZstdFile Read data from a seekable .raw.zst file into a buffer. All frames are decompressed in parallel.
+ * @param buffer
+ * @param file_name
+ * @param num_elements Exact number of elements the file should contain.
+ * @param progress Optional callback receiving the number of decompressed bytes and the total.
+ * @return Number of elements read, or -1 on an error.
+ */
+template<typename DataType>
+long readSeekableZstdFile(InputBuffer<DataType> &buffer, QString file_name, size_t num_elements, const ProgressCallback &progress = nullptr)
+{
+    SeekableZstdFile file;
+    if (!file.open(file_name))
         return -1;
-    }
 
-    output_buffer.resize(output_buf_size / sizeof(DataType));
-    return output_buffer.size();
+    buffer.mapping.reset();
+    buffer.storage.resize(num_elements);
+    long num_bytes = file.readAll(reinterpret_cast<unsigned char *>(buffer.storage.data()), num_elements * sizeof(DataType), progress);
+    return num_bytes < 0 ? num_bytes : num_bytes / sizeof(DataType);
 }
 
 /**
  * @brief readFileIntoBuffer Read data into a buffer using the appropriate function.
  * @param buffer
  * @param file_name
+ * @param num_elements Exact number of elements the file should contain. Decompression buffers are sized accordingly.
+ * @param advice Expected access pattern of the data, used as read-ahead hint for mapped files.
+ * @param progress Optional progress callback for decompression.
  * @return
  */
 template<typename DataType>
-long readFileIntoBuffer(std::vector<DataType> &buffer, QString file_name)
+long readFileIntoBuffer(
+    InputBuffer<DataType> &buffer,
+    QString file_name,
+    size_t num_elements,
+    MappingAdvice advice = MappingAdvice::SEQUENTIAL,
+    const ProgressCallback &progress = nullptr
+)
 {
     if (file_name.endsWith(".bz2")) {
-        return readBZipFile(buffer, file_name.toStdString());
+        buffer.mapping.reset();
+        buffer.storage.resize(num_elements);
+        return readBZipFile(buffer.storage.data(), num_elements, file_name, progress);
+    }
+    if (file_name.endsWith(".zst")) {
+        return readSeekableZstdFile(buffer, file_name, num_elements, progress);
     }
     if (file_name.endsWith(".raw")) {
-        return readRawFile(buffer, file_name.toStdString());
+        return readRawFile(buffer, file_name, advice);
     }
     return -1;
 }
@@ -2,6 +2,8 @@
 
 #include "QtCore/qdebug.h"
 #include "input/data.h"
+#include "input/dataset_container.h"
+#include "util/element_cache.h"
 #include "input_configuration.h"
 #include "visualization_configuration.h"
 
@@ -22,15 +24,52 @@ QString fixPath(QString file_path, QString config_dir)
 }
 
 /**
- * @brief readInput
+ * @brief DatasetInput::setGridDims Set the dims of every height of the tree and their ranges in the node buffers, given the dims of the bottom grid.
+ * @param num_rows
+ * @param num_cols
+ */
+void DatasetInput::setGridDims(size_t num_rows, size_t num_cols)
+{
+    size_t idx = num_rows * num_cols;
+    start_ends = { { 0, idx } };
+    height_dims = { { num_rows, num_cols } };
+    while (num_rows != 1 || num_cols != 1) {
+        num_rows = num_rows / 2 + num_rows % 2;
+        num_cols = num_cols / 2 + num_cols % 2;
+        start_ends.append({ idx, idx + num_rows * num_cols });
+        height_dims.append({ num_rows, num_cols });
+        idx += num_rows * num_cols;
+    }
+}
+
+/**
+ * @brief DatasetInput::numNodes
+ * @return Number of nodes over all heights.
+ */
+size_t DatasetInput::numNodes() const
+{
+    return start_ends.isEmpty() ? 0 : start_ends.last().second;
+}
+
+/**
+ * @brief DatasetInput::elementSize
+ * @return Size of a single element in bytes.
+ */
+size_t DatasetInput::elementSize() const
+{
+    return data_dims[0] * data_dims[1] * data_dims[2];
+}
+
+/**
+ * @brief readDatasetFiles Read all buffers of a dataset exported as JSON configs with separate data files.
  * @param visualization_configuration_path
+ * @param input
+ * @param loading_mode Whether all element data is read up front, or elements are read when they are needed.
+ * @param progress Optional callback reporting the progress of reading the visualization data.
  * @return True if the operation succeeded, else false
  */
-bool readInput(QString visualization_configuration_path, TreeDrawProperties &tree_properties)
+bool readDatasetFiles(QString visualization_configuration_path, DatasetInput &input, LoadingMode loading_mode, const ProgressCallback &progress)
 {
-    QElapsedTimer timer;
-    timer.start();
-
     // Load all config files
     VisualizationConfiguration config;
     if (!config.fromJSONFile(visualization_configuration_path))
@@ -50,79 +89,191 @@ bool readInput(QString visualization_configuration_path, TreeDrawProperties &tre
         return false;
     }
 
-    // Load the assignment
-    size_t max_height = 1;
-    auto [num_rows, num_cols] = disparity_config.grid_dims;
-    size_t idx = num_rows * num_cols;
-    QList<QPair<size_t, size_t>> start_ends{ { 0, idx } };
-    QList<QPair<size_t, size_t>> height_dims{ { num_rows, num_cols } };
-    while (num_rows != 1 || num_cols != 1) {      
-        num_rows = num_rows / 2 + num_rows % 2;
-        num_cols = num_cols / 2 + num_cols % 2;
-        start_ends.append({ idx, idx + num_rows * num_cols });
-        height_dims.append({ num_rows, num_cols });
-        idx += num_rows * num_cols;
-        ++max_height;
-    }
+    input.setGridDims(disparity_config.grid_dims.first, disparity_config.grid_dims.second);
+    input.data_dims = vis_data_config.data_dims;
+    input.num_elements = vis_data_config.num_elements;
+    input.source_files = {
+        visualization_configuration_path,
+        fixPath(config.disparity_config_path, config_dir_path),
+        fixPath(config.visualization_config_path, config_dir_path)
+    };
 
-    std::vector<int> assignment_buffer(idx, -1);
+    // Load the assignment
+    size_t num_nodes = input.numNodes();
     QString data_path = fixPath(config.assignment_path, config_dir_path);
-    if (readFileIntoBuffer(assignment_buffer, data_path) != idx) {
-        qDebug() << "Sizes:" << assignment_buffer.size() << idx;
+    if (readFileIntoBuffer(input.assignment, data_path, num_nodes) != num_nodes) {
+        qDebug() << "Sizes:" << input.assignment.size() << num_nodes;
         qDebug() << "Unable to load data from file \"" << data_path << "\"\n";
         return false;
     }
+    input.source_files.append(data_path);
 
-    // Load visualization data
-    size_t data_elem_size = vis_data_config.data_dims[0] * vis_data_config.data_dims[1] * vis_data_config.data_dims[2];
-    std::vector<unsigned char> data_buffer(vis_data_config.num_elements * data_elem_size);
+    // Load visualization data.
+    size_t data_size = input.num_elements * input.elementSize();
     data_path = fixPath(vis_data_config.data_path, (QFileInfo(fixPath(config.visualization_config_path, config_dir_path))).path());
-    if (readFileIntoBuffer(data_buffer, data_path) != vis_data_config.num_elements * data_elem_size) {
-        qDebug() << "Sizes:" << data_buffer.size() << vis_data_config.num_elements * data_elem_size;
-        qDebug() << "Unable to load data from file \"" << data_path << "\"\n";
-        return false;
+    bool is_compressed = data_path.endsWith(".bz2") || data_path.endsWith(".zst");
+    input.source_files.append(data_path);
+    if (loading_mode == LoadingMode::EAGER && is_compressed) {
+        // Compressed data is only decompressed when building the atlas, straight into the atlas.
+        input.elements = std::make_shared<StreamedElementSource>(data_path, input.elementSize(), input.num_elements);
+    } else if (loading_mode == LoadingMode::LAZY && data_path.endsWith(".zst")) {
+        // Seekable files are decompressed per element when the element is needed.
+        auto source = std::make_shared<SeekableZstdElementSource>(input.elementSize());
+        if (!source->open(data_path) || source->numElements() != input.num_elements) {
+            qDebug() << "Sizes:" << source->numElements() << input.num_elements;
+            qDebug() << "Unable to load data from file \"" << data_path << "\"\n";
+            return false;
+        }
+        input.elements = source;
+    } else {
+        // Mapped elements are accessed in assignment order when loading eagerly, or at random when loading lazily.
+        InputBuffer<unsigned char> data;
+        MappingAdvice advice = loading_mode == LoadingMode::LAZY ? MappingAdvice::RANDOM : MappingAdvice::WILL_NEED;
+        if (readFileIntoBuffer(data, data_path, data_size, advice, progress) != data_size) {
+            qDebug() << "Sizes:" << data.size() << data_size;
+            qDebug() << "Unable to load data from file \"" << data_path << "\"\n";
+            return false;
+        }
+        input.elements = std::make_shared<BufferElementSource>(std::move(data), input.elementSize(), input.num_elements);
     }
 
     // Load disparities
-    std::vector<double> disparity_buffer(idx, -1);
     data_path = fixPath(disparity_config.data_path, (QFileInfo(fixPath(config.disparity_config_path, config_dir_path))).path());
-    if (readFileIntoBuffer(disparity_buffer, data_path) != disparity_config.num_elements) {
-        qDebug() << "Sizes:" << disparity_buffer.size() << disparity_config.num_elements;
+    if (readFileIntoBuffer(input.disparities, data_path, disparity_config.num_elements) != disparity_config.num_elements) {
+        qDebug() << "Sizes:" << input.disparities.size() << disparity_config.num_elements;
         qDebug() << "Unable to load data from file \"" << data_path << "\"\n";
         return false;
     }
+    input.source_files.append(data_path);
+
+    return true;
+}
+
+/**
+ * @brief readInput Read a dataset, either from its JSON config or a dataset container, and set up the tree properties for it.
+ * @param dataset_path
+ * @param tree_properties
+ * @param loading_mode Whether all element data is read up front, or elements are read when they are needed.
+ * @param progress Optional callback reporting the progress of reading the visualization data.
+ * @return True if the operation succeeded, else false
+ */
+bool readInput(QString dataset_path, TreeDrawProperties &tree_properties, LoadingMode loading_mode, const ProgressCallback &progress)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    DatasetInput input;
+    bool is_read = dataset_path.endsWith(DATASET_CONTAINER_EXTENSION) ?
+        readDatasetContainer(dataset_path, input, loading_mode) :
+        readDatasetFiles(dataset_path, input, loading_mode, progress);
+    if (!is_read)
+        return false;
+
+    // Validate the assignment before any element is read.
+    for (size_t node = 0; node < input.numNodes(); ++node) {
+        int assigned_idx = input.assignment[node];
+        if (assigned_idx >= static_cast<int>(input.num_elements) || assigned_idx >= static_cast<int>(input.disparities.size())) {
+            qDebug() << "Node" << node << "is assigned to non-existing element" << assigned_idx;
+            return false;
+        }
+    }
+
+    // Node ids follow the layout of the node buffers, so the assignment can be used as-is.
+    size_t max_height = input.height_dims.size();
+    size_t num_nodes = input.numNodes();
+    QList<size_t> height_offsets;
+    for (auto &[start, end] : input.start_ends)
+        height_offsets.append(start);
+
+    NodeSet invalid_nodes(num_nodes);
+    std::vector<bool> is_used(input.num_elements, false);
+    size_t num_valid_nodes = 0;
+    size_t num_unique_elements = 0;
+    for (size_t node = 0; node < num_nodes; ++node) {
+        int assigned_idx = input.assignment[node];
+        if (assigned_idx < 0) {
+            invalid_nodes.insert(node);
+            continue;
+        }
 
-    // Combine everything into a single data map
-    QMap<QPair<size_t, size_t>, QList<unsigned char>> *data_map = new QMap<QPair<size_t, size_t>, QList<unsigned char>>;
-    QMap<QPair<size_t, size_t>, double> disparity_map;
-    QSet<QPair<size_t, size_t>> invalid_nodes;
-    for (size_t height = 0; height < max_height; ++height) {
-        auto [start, end] = start_ends[height];
-        for (size_t idx = 0; start + idx < end;  ++idx) {
-            int assigned_idx = assignment_buffer[start + idx];
-            if (assigned_idx >= 0) {
-                unsigned char *start_ptr = data_buffer.data() + data_elem_size * assigned_idx;
-                disparity_map[{ height, idx }] = disparity_buffer[assigned_idx];
-                (*data_map)[{ height, idx }] = QList<unsigned char>(start_ptr, start_ptr + data_elem_size);
-            } else {
-                invalid_nodes.insert({ height, idx });
-            }
+        ++num_valid_nodes;
+        if (!is_used[assigned_idx]) {
+            is_used[assigned_idx] = true;
+            ++num_unique_elements;
         }
     }
 
+    // Nodes sharing an element share its storage and atlas block.
+    qDebug() << num_valid_nodes << "nodes are assigned to" << num_unique_elements << "unique elements, dedup ratio"
+             << (num_unique_elements == 0 ? 1. : static_cast<double>(num_valid_nodes) / static_cast<double>(num_unique_elements));
+
     // Set loaded properties. Some other properties will be set dynamically later as they depend on the screen size.
     tree_properties.tree_max_height = max_height - 1;
-    tree_properties.height_dims = height_dims;
-    tree_properties.draw_type = vis_data_config.data_dims[2] > 4 ? DrawType::VOLUME : DrawType::IMAGE;
-    tree_properties.draw_array = { { max_height - 1, 0 } };
+    tree_properties.height_dims = input.height_dims;
+    tree_properties.height_offsets = height_offsets;
+    tree_properties.draw_type = input.data_dims[2] > 4 ? DrawType::VOLUME : DrawType::IMAGE;
     tree_properties.invalid_nodes = invalid_nodes;
-    tree_properties.disparities = disparity_map;
-    tree_properties.data_dims = vis_data_config.data_dims;
+    tree_properties.draw_array.resize(num_nodes);
+    tree_properties.drawNode(tree_properties.nodeId(max_height - 1, 0));
+    tree_properties.elements.assign(input.assignment.data(), input.assignment.data() + num_nodes);
+    tree_properties.disparities.assign(input.disparities.data(), input.disparities.data() + input.disparities.size());
+    tree_properties.data_dims = input.data_dims;
+    tree_properties.loading_mode = loading_mode;
+    tree_properties.source_files = input.source_files;
 
-    delete tree_properties.data;
-    tree_properties.data = data_map;
+    // Elements that are read eagerly are read once when building the atlas, so caching them would only cost memory.
+    delete tree_properties.element_cache;
+    tree_properties.element_cache = new ElementCache(input.elements, loading_mode == LoadingMode::LAZY ? ELEMENT_CACHE_SIZE : 0);
 
     qDebug() << "Loading input took" << timer.elapsed() << "milliseconds";
 
     return true;
 }
+
+/**
+ * @brief makeElementsRandomAccess Replace elements that can only be streamed in order by a source that reads them at random.
+ * This is needed when elements are read while drawing, like for a paged atlas. Seekable .zst files are decompressed per element
+ * and cached, other compressed files are decompressed into memory as a whole.
+ * @param tree_properties
+ * @param progress Optional callback reporting the progress of decompressing the elements.
+ * @return True if the elements can be read at random.
+ */
+bool makeElementsRandomAccess(TreeDrawProperties &tree_properties, const ProgressCallback &progress)
+{
+    auto streamed = std::dynamic_pointer_cast<StreamedElementSource>(tree_properties.element_cache->elementSource());
+    if (!streamed)
+        return true;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    QString data_path = streamed->fileName();
+    size_t element_size = streamed->elementSize();
+    size_t num_elements = streamed->numElements();
+    std::shared_ptr<ElementSource> elements;
+    if (data_path.endsWith(".zst")) {
+        auto source = std::make_shared<SeekableZstdElementSource>(element_size);
+        if (!source->open(data_path) || source->numElements() != num_elements) {
+            qDebug() << "Sizes:" << source->numElements() << num_elements;
+            qDebug() << "Unable to load data from file \"" << data_path << "\"\n";
+            return false;
+        }
+        elements = source;
+    } else {
+        InputBuffer<unsigned char> data;
+        size_t data_size = num_elements * element_size;
+        if (readFileIntoBuffer(data, data_path, data_size, MappingAdvice::RANDOM, progress) != data_size) {
+            qDebug() << "Sizes:" << data.size() << data_size;
+            qDebug() << "Unable to load data from file \"" << data_path << "\"\n";
+            return false;
+        }
+        elements = std::make_shared<BufferElementSource>(std::move(data), element_size, num_elements);
+    }
+
+    delete tree_properties.element_cache;
+    tree_properties.element_cache = new ElementCache(elements, ELEMENT_CACHE_SIZE);
+
+    qDebug() << "Preparing random access to the elements took" << timer.elapsed() << "milliseconds";
+
+    return true;
+}
@@ -2,10 +2,37 @@
 #define DATA_BUFFER_H
 
 #include "drawing/model/tree_draw_properties.h"
+#include "input/data.h"
+#include "input/element_source.h"
 #include <QImage>
 #include <QMap>
 #include <QString>
+#include <QStringList>
 
-bool readInput(QString visualization_configuration_path, TreeDrawProperties &tree_properties);
+/**
+ * @brief The DatasetInput struct All buffers of a dataset, independent of the format they were stored in.
+ */
+struct DatasetInput
+{
+    QList<QPair<size_t, size_t>> height_dims;       // [rows, columns] per height.
+    QList<QPair<size_t, size_t>> start_ends;        // [start, end) of every height in the node buffers.
+    std::array<size_t, 3> data_dims;
+    size_t num_elements;
+
+    InputBuffer<int> assignment;                    // Assigned element per node, or -1 for void nodes.
+    InputBuffer<double> disparities;                // Disparity per element.
+    std::shared_ptr<ElementSource> elements;        // Element data.
+    QStringList source_files;                       // Files the dataset was read from.
+
+    void setGridDims(size_t num_rows, size_t num_cols);
+    size_t numNodes() const;
+    size_t elementSize() const;
+};
+
+bool readDatasetFiles(QString visualization_configuration_path, DatasetInput &input, LoadingMode loading_mode = LoadingMode::EAGER, const ProgressCallback &progress = nullptr);
+
+bool readInput(QString dataset_path, TreeDrawProperties &tree_properties, LoadingMode loading_mode = LoadingMode::EAGER, const ProgressCallback &progress = nullptr);
+
+bool makeElementsRandomAccess(TreeDrawProperties &tree_properties, const ProgressCallback &progress = nullptr);
 
 #endif // DATA_BUFFER_H
@@ -0,0 +1,216 @@
+#include "input/dataset_container.h"
+#include "input/data_buffer.h"
+
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QFile>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <vector>
+
+/**
+ * @brief alignTo Round the value up to a multiple of the alignment.
+ * @param value
+ * @param alignment
+ * @return
+ */
+size_t alignTo(size_t value, size_t alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+/**
+ * @brief readDatasetContainer Read a dataset container. The container is mapped, so the element data is read straight from the file.
+ * @param file_name
+ * @param input
+ * @param loading_mode Whether all element data is read up front, or elements are read when they are needed.
+ * @return True if the container is valid.
+ */
+bool readDatasetContainer(QString file_name, DatasetInput &input, LoadingMode loading_mode)
+{
+    auto mapping = std::make_shared<MappedFile>();
+    if (!mapping->open(file_name))
+        return false;
+
+    // Validate the header
+    const unsigned char *data = mapping->data();
+    size_t size = mapping->size();
+    if (size < sizeof(DatasetContainerHeader)) {
+        qDebug() << "File is too small to be a dataset container: " << file_name;
+        return false;
+    }
+
+    DatasetContainerHeader header;
+    std::memcpy(&header, data, sizeof(DatasetContainerHeader));
+    if (std::memcmp(header.magic, DATASET_CONTAINER_MAGIC, sizeof(header.magic)) != 0) {
+        qDebug() << "File is not a dataset container: " << file_name;
+        return false;
+    }
+    if (header.byte_order != DATASET_CONTAINER_BYTE_ORDER) {
+        qDebug() << "Dataset container was written with a different byte order: " << file_name;
+        return false;
+    }
+    if (header.version != DATASET_CONTAINER_VERSION) {
+        qDebug() << "Dataset container version" << header.version << "is not supported: " << file_name;
+        return false;
+    }
+
+    input.setGridDims(header.grid_rows, header.grid_columns);
+    input.data_dims = { header.data_dims[0], header.data_dims[1], header.data_dims[2] };
+    input.num_elements = header.num_elements;
+    input.source_files = { file_name };
+
+    if (
+        header.num_heights != static_cast<uint64_t>(input.height_dims.size()) ||
+        header.num_nodes != input.numNodes() ||
+        header.element_stride == 0 || header.element_stride < input.elementSize() ||
+        header.height_dims_offset > size || header.num_heights > (size - header.height_dims_offset) / (2 * sizeof(uint64_t)) ||
+        header.node_table_offset > size || header.num_nodes > (size - header.node_table_offset) / sizeof(DatasetContainerNode) ||
+        header.payload_offset > size || header.num_elements > (size - header.payload_offset) / header.element_stride
+    ) {
+        qDebug() << "Dataset container has an inconsistent layout: " << file_name;
+        return false;
+    }
+
+    const uint64_t *height_dims = reinterpret_cast<const uint64_t *>(data + header.height_dims_offset);
+    for (size_t height = 0; height < header.num_heights; ++height) {
+        if (height_dims[2 * height] != input.height_dims[height].first || height_dims[2 * height + 1] != input.height_dims[height].second) {
+            qDebug() << "Dataset container has inconsistent height dims: " << file_name;
+            return false;
+        }
+    }
+
+    // Resolve the node table into the assignment and per-element disparities.
+    mapping->advise(MappingAdvice::WILL_NEED, header.node_table_offset, header.num_nodes * sizeof(DatasetContainerNode));
+    const DatasetContainerNode *nodes = reinterpret_cast<const DatasetContainerNode *>(data + header.node_table_offset);
+    input.assignment.mapping.reset();
+    input.assignment.storage.assign(header.num_nodes, -1);
+    input.disparities.mapping.reset();
+    input.disparities.storage.assign(header.num_elements, std::numeric_limits<double>::quiet_NaN());
+    for (size_t node = 0; node < header.num_nodes; ++node) {
+        auto &entry = nodes[node];
+        if (entry.element < 0)
+            continue;
+
+        if (
+            static_cast<uint64_t>(entry.element) >= header.num_elements ||
+            entry.data_offset != header.payload_offset + entry.element * header.element_stride
+        ) {
+            qDebug() << "Dataset container node" << node << "points to invalid data: " << file_name;
+            return false;
+        }
+        input.assignment.storage[node] = entry.element;
+        input.disparities.storage[entry.element] = entry.disparity;
+    }
+
+    // Lazily loaded elements are read at random, so only the pages of the elements that are drawn get read.
+    MappingAdvice advice = loading_mode == LoadingMode::LAZY ? MappingAdvice::RANDOM : MappingAdvice::WILL_NEED;
+    mapping->advise(advice, header.payload_offset, header.num_elements * header.element_stride);
+    InputBuffer<unsigned char> payload;
+    payload.mapping = mapping;
+    input.elements = std::make_shared<BufferElementSource>(std::move(payload), input.elementSize(), input.num_elements, header.payload_offset, header.element_stride);
+
+    return true;
+}
+
+/**
+ * @brief writeDatasetContainer Write a dataset into a single container file.
+ * @param input
+ * @param file_name
+ * @param progress Optional callback receiving the progress of reading the elements.
+ * @return True if the container was written.
+ */
+bool writeDatasetContainer(const DatasetInput &input, QString file_name, const ProgressCallback &progress)
+{
+    QFile file(file_name);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qDebug() << "Could not open file for writing: " << file_name;
+        return false;
+    }
+
+    // Determine the layout
+    size_t num_heights = input.height_dims.size();
+    size_t num_nodes = input.numNodes();
+    size_t element_size = input.elementSize();
+
+    DatasetContainerHeader header;
+    std::memcpy(header.magic, DATASET_CONTAINER_MAGIC, sizeof(header.magic));
+    header.version = DATASET_CONTAINER_VERSION;
+    header.byte_order = DATASET_CONTAINER_BYTE_ORDER;
+    header.grid_rows = input.height_dims.first().first;
+    header.grid_columns = input.height_dims.first().second;
+    header.data_dims[0] = input.data_dims[0];
+    header.data_dims[1] = input.data_dims[1];
+    header.data_dims[2] = input.data_dims[2];
+    header.num_heights = num_heights;
+    header.num_nodes = num_nodes;
+    header.num_elements = input.num_elements;
+    header.element_stride = alignTo(element_size, DATASET_CONTAINER_ELEMENT_ALIGNMENT);
+    header.height_dims_offset = sizeof(DatasetContainerHeader);
+    header.node_table_offset = header.height_dims_offset + num_heights * 2 * sizeof(uint64_t);
+    header.payload_offset = alignTo(header.node_table_offset + num_nodes * sizeof(DatasetContainerNode), DATASET_CONTAINER_PAGE_SIZE);
+
+    // Header and tables
+    std::vector<uint64_t> height_dims;
+    for (auto &[num_rows, num_cols] : input.height_dims) {
+        height_dims.push_back(num_rows);
+        height_dims.push_back(num_cols);
+    }
+
+    std::vector<DatasetContainerNode> nodes(num_nodes);
+    for (size_t node = 0; node < num_nodes; ++node) {
+        int element = input.assignment[node];
+        nodes[node] = element < 0 ?
+            DatasetContainerNode{ -1, std::numeric_limits<double>::quiet_NaN(), 0 } :
+            DatasetContainerNode{ element, input.disparities[element], header.payload_offset + element * header.element_stride };
+    }
+
+    std::vector<char> padding(std::max(header.element_stride, DATASET_CONTAINER_PAGE_SIZE), 0);
+    bool is_written =
+        file.write(reinterpret_cast<const char *>(&header), sizeof(header)) == sizeof(header) &&
+        file.write(reinterpret_cast<const char *>(height_dims.data()), height_dims.size() * sizeof(uint64_t)) == static_cast<qint64>(height_dims.size() * sizeof(uint64_t)) &&
+        file.write(reinterpret_cast<const char *>(nodes.data()), nodes.size() * sizeof(DatasetContainerNode)) == static_cast<qint64>(nodes.size() * sizeof(DatasetContainerNode)) &&
+        file.write(padding.data(), header.payload_offset - file.pos()) >= 0;
+
+    // Element payload, every element is written exactly once and in order, so compressed data is streamed into the container.
+    size_t element_padding = header.element_stride - element_size;
+    is_written = is_written && input.elements->forEachElement([&](size_t element, const unsigned char *data) {
+        is_written = is_written &&
+            file.write(reinterpret_cast<const char *>(data), element_size) == static_cast<qint64>(element_size) &&
+            file.write(padding.data(), element_padding) == static_cast<qint64>(element_padding);
+    }, progress) && is_written;
+
+    if (!is_written) {
+        qDebug() << "Could not write dataset container: " << file_name << file.errorString();
+        file.close();
+        file.remove();
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief convertToDatasetContainer Convert an exported dataset to a dataset container.
+ * @param visualization_configuration_path
+ * @param file_name
+ * @return True if the conversion succeeded.
+ */
+bool convertToDatasetContainer(QString visualization_configuration_path, QString file_name)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    DatasetInput input;
+    if (!readDatasetFiles(visualization_configuration_path, input))
+        return false;
+
+    if (!writeDatasetContainer(input, file_name))
+        return false;
+
+    qDebug() << "Converting dataset to container took" << timer.elapsed() << "milliseconds";
+
+    return true;
+}
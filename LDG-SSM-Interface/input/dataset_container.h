@@ -0,0 +1,65 @@
+#ifndef DATASET_CONTAINER_H
+#define DATASET_CONTAINER_H
+
+#include "drawing/model/types.h"
+#include "util/progress.h"
+
+#include <QString>
+#include <cstddef>
+#include <cstdint>
+
+struct DatasetInput;
+
+const QString DATASET_CONTAINER_EXTENSION = ".ldgssm";
+const char DATASET_CONTAINER_MAGIC[8] = { 'L', 'D', 'G', 'S', 'S', 'M', 'C', '\0' };
+const uint64_t DATASET_CONTAINER_VERSION = 2;
+const uint64_t DATASET_CONTAINER_BYTE_ORDER = 0x0102030405060708;   // Reads back differently on a host with another byte order.
+const size_t DATASET_CONTAINER_PAGE_SIZE = 4096;            // Alignment of the payload, so it can be mapped directly.
+const size_t DATASET_CONTAINER_ELEMENT_ALIGNMENT = 64;      // Alignment of every element within the payload.
+
+/**
+ * @brief The DatasetContainerHeader struct Header at the start of a dataset container. All values are stored in the byte order of the host that wrote
+ * the container, which is recorded by the byte_order marker. Containers written with another byte order are rejected.
+ *
+ * The header is followed by the [rows, columns] of every height, the node table and finally the page aligned element payload.
+ * Nodes are stored height by height, so the node at [height, index] is found at the start of its height plus its index.
+ */
+struct DatasetContainerHeader
+{
+    char magic[8];
+    uint64_t version;
+    uint64_t byte_order;
+    uint64_t grid_rows;
+    uint64_t grid_columns;
+    uint64_t data_dims[3];
+    uint64_t num_heights;
+    uint64_t num_nodes;
+    uint64_t num_elements;
+    uint64_t element_stride;
+    uint64_t height_dims_offset;
+    uint64_t node_table_offset;
+    uint64_t payload_offset;
+};
+
+/**
+ * @brief The DatasetContainerNode struct Entry of the node table.
+ */
+struct DatasetContainerNode
+{
+    int64_t element;            // Assigned element, or -1 for void nodes.
+    double disparity;           // Disparity of the assigned element, NaN for void nodes.
+    uint64_t data_offset;       // Byte offset of the element data in the file, 0 for void nodes.
+};
+
+static_assert(sizeof(DatasetContainerHeader) == 120, "Dataset container header should not contain padding");
+static_assert(sizeof(DatasetContainerNode) == 24, "Dataset container node should not contain padding");
+
+size_t alignTo(size_t value, size_t alignment);
+
+bool readDatasetContainer(QString file_name, DatasetInput &input, LoadingMode loading_mode = LoadingMode::EAGER);
+
+bool writeDatasetContainer(const DatasetInput &input, QString file_name, const ProgressCallback &progress = nullptr);
+
+bool convertToDatasetContainer(QString visualization_configuration_path, QString file_name);
+
+#endif // DATASET_CONTAINER_H
@@ -0,0 +1,135 @@
+#include "element_pipeline.h"
+
+#include <QMutexLocker>
+#include <QThread>
+#include <algorithm>
+#include <cstring>
+
+/**
+ * @brief ChunkQueue::ChunkQueue
+ */
+ChunkQueue::ChunkQueue():
+    is_closed(false)
+{
+}
+
+/**
+ * @brief ChunkQueue::push Add a chunk and wake up a waiting stage.
+ * @param chunk
+ */
+void ChunkQueue::push(ElementChunk *chunk)
+{
+    QMutexLocker locker(&mutex);
+    chunks.push_back(chunk);
+    is_changed.wakeOne();
+}
+
+/**
+ * @brief ChunkQueue::pop Take the oldest chunk, waiting until one is available.
+ * @return The chunk, or nullptr if the queue is closed and empty.
+ */
+ElementChunk *ChunkQueue::pop()
+{
+    QMutexLocker locker(&mutex);
+    while (chunks.empty() && !is_closed)
+        is_changed.wait(&mutex);
+
+    if (chunks.empty())
+        return nullptr;
+
+    ElementChunk *chunk = chunks.front();
+    chunks.pop_front();
+    return chunk;
+}
+
+/**
+ * @brief ChunkQueue::close Mark that no chunks will be added anymore. Waiting stages return once the queue is empty.
+ */
+void ChunkQueue::close()
+{
+    QMutexLocker locker(&mutex);
+    is_closed = true;
+    is_changed.wakeAll();
+}
+
+/**
+ * @brief forEachChunkPipelined Pass all elements of the source to the callback in chunks of consecutive elements, while the next chunks are read on another thread.
+ * Only a fixed number of chunks is in flight, so reading never runs far ahead of the callback.
+ * @param source
+ * @param callback Called on the calling thread.
+ * @param progress Optional callback receiving the progress of reading the elements, called on the reading thread.
+ * @return True if all elements were read.
+ */
+bool forEachChunkPipelined(const ElementSource &source, const ChunkCallback &callback, const ProgressCallback &progress)
+{
+    size_t element_size = source.elementSize();
+    size_t elements_per_chunk = std::max<size_t>(1, ELEMENT_PIPELINE_CHUNK_SIZE / std::max<size_t>(1, element_size));
+
+    // Elements that can be read without copying stay valid, so only their pointers are passed on.
+    bool is_direct = source.numElements() > 0 && source.elementData(0) != nullptr;
+
+    std::vector<ElementChunk> pool(ELEMENT_PIPELINE_DEPTH);
+    ChunkQueue free_chunks;
+    ChunkQueue filled_chunks;
+    for (auto &chunk : pool) {
+        chunk.elements.reserve(elements_per_chunk);
+        chunk.data.reserve(elements_per_chunk);
+        if (!is_direct)
+            chunk.storage.resize(elements_per_chunk * element_size);
+        free_chunks.push(&chunk);
+    }
+
+    bool is_read = false;
+    QThread *reader = QThread::create([&]() {
+        ElementChunk *chunk = nullptr;
+        is_read = source.forEachElement([&](size_t element, const unsigned char *data) {
+            if (chunk == nullptr) {
+                chunk = free_chunks.pop();
+                chunk->elements.clear();
+                chunk->data.clear();
+            }
+
+            if (!is_direct) {
+                unsigned char *copy = chunk->storage.data() + chunk->elements.size() * element_size;
+                std::memcpy(copy, data, element_size);
+                data = copy;
+            }
+            chunk->elements.push_back(element);
+            chunk->data.push_back(data);
+
+            if (chunk->elements.size() == elements_per_chunk) {
+                filled_chunks.push(chunk);
+                chunk = nullptr;
+            }
+        }, progress);
+
+        if (chunk != nullptr)
+            filled_chunks.push(chunk);
+        filled_chunks.close();
+    });
+    reader->start();
+
+    for (ElementChunk *chunk = filled_chunks.pop(); chunk != nullptr; chunk = filled_chunks.pop()) {
+        callback(*chunk);
+        free_chunks.push(chunk);
+    }
+
+    reader->wait();
+    delete reader;
+    return is_read;
+}
+
+/**
+ * @brief forEachElementPipelined Pass every element of the source to the callback in order, while the next elements are read on another thread.
+ * @param source
+ * @param callback Receives every element, called on the calling thread.
+ * @param progress Optional callback receiving the progress of reading the elements, called on the reading thread.
+ * @return True if all elements were read.
+ */
+bool forEachElementPipelined(const ElementSource &source, const ElementCallback &callback, const ProgressCallback &progress)
+{
+    return forEachChunkPipelined(source, [&](const ElementChunk &chunk) {
+        for (size_t idx = 0; idx < chunk.elements.size(); ++idx)
+            callback(chunk.elements[idx], chunk.data[idx]);
+    }, progress);
+}
@@ -0,0 +1,51 @@
+#ifndef ELEMENT_PIPELINE_H
+#define ELEMENT_PIPELINE_H
+
+#include "input/element_source.h"
+#include "input/element_stream.h"
+#include "util/progress.h"
+
+#include <QMutex>
+#include <QWaitCondition>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <vector>
+
+const size_t ELEMENT_PIPELINE_CHUNK_SIZE = size_t(16) << 20;    // Number of bytes of elements passed between the stages at once.
+const size_t ELEMENT_PIPELINE_DEPTH = 4;                        // Number of chunks in flight, which bounds the memory used by the pipeline.
+
+/**
+ * @brief The ElementChunk class Consecutive elements passed from the reading stage to the processing stage.
+ */
+struct ElementChunk
+{
+    std::vector<size_t> elements;
+    std::vector<const unsigned char *> data;        // Data of every element, pointing into the storage or straight into the source.
+    std::vector<unsigned char> storage;             // Copies of elements whose data is only valid while they are read.
+};
+
+using ChunkCallback = std::function<void(const ElementChunk &chunk)>;     // Receives consecutive elements at once, so they can be processed in parallel.
+
+/**
+ * @brief The ChunkQueue class Blocking queue of chunks between two pipeline stages.
+ */
+class ChunkQueue
+{
+    QMutex mutex;
+    QWaitCondition is_changed;
+    std::deque<ElementChunk *> chunks;
+    bool is_closed;
+
+public:
+    ChunkQueue();
+
+    void push(ElementChunk *chunk);
+    ElementChunk *pop();
+    void close();
+};
+
+bool forEachChunkPipelined(const ElementSource &source, const ChunkCallback &callback, const ProgressCallback &progress = nullptr);
+bool forEachElementPipelined(const ElementSource &source, const ElementCallback &callback, const ProgressCallback &progress = nullptr);
+
+#endif // ELEMENT_PIPELINE_H
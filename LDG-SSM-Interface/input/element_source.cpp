@@ -0,0 +1,225 @@
+#include "input/element_source.h"
+#include "input/parallel_bzip2.h"
+
+#include <QDebug>
+#include <cstring>
+#include <vector>
+
+/**
+ * @brief ElementSource::ElementSource
+ * @param element_size Size of a single element in bytes.
+ * @param num_elements
+ */
+ElementSource::ElementSource(size_t element_size, size_t num_elements):
+    element_size(element_size),
+    num_elements(num_elements)
+{
+}
+
+/**
+ * @brief ElementSource::~ElementSource
+ */
+ElementSource::~ElementSource()
+{
+}
+
+/**
+ * @brief ElementSource::elementSize
+ * @return
+ */
+size_t ElementSource::elementSize() const
+{
+    return element_size;
+}
+
+/**
+ * @brief ElementSource::numElements
+ * @return
+ */
+size_t ElementSource::numElements() const
+{
+    return num_elements;
+}
+
+/**
+ * @brief ElementSource::elementData Direct access to the data of an element.
+ * @param element
+ * @return Pointer to the element data, or nullptr if the element has to be read with readElement.
+ */
+const unsigned char *ElementSource::elementData(size_t element) const
+{
+    return nullptr;
+}
+
+/**
+ * @brief ElementSource::readElement Copy or decode the element into the destination.
+ * @param element
+ * @param destination Buffer with room for a single element.
+ * @return
+ */
+bool ElementSource::readElement(size_t element, unsigned char *destination) const
+{
+    const unsigned char *data = elementData(element);
+    if (data == nullptr)
+        return false;
+
+    std::memcpy(destination, data, element_size);
+    return true;
+}
+
+/**
+ * @brief ElementSource::prefetch Hint that the element will be read soon.
+ * @param element
+ */
+void ElementSource::prefetch(size_t element) const
+{
+}
+
+/**
+ * @brief ElementSource::forEachElement Pass every element to the callback, in order.
+ * @param callback
+ * @param progress Optional callback receiving the number of elements read and the total.
+ * @return True if all elements were read.
+ */
+bool ElementSource::forEachElement(const ElementCallback &callback, const ProgressCallback &progress) const
+{
+    std::vector<unsigned char> element_data;
+    for (size_t element = 0; element < num_elements; ++element) {
+        const unsigned char *data = elementData(element);
+        if (data == nullptr) {
+            element_data.resize(element_size);
+            if (!readElement(element, element_data.data()))
+                return false;
+            data = element_data.data();
+        }
+        callback(element, data);
+
+        if (progress && !progress(element + 1, num_elements))
+            return false;
+    }
+    return true;
+}
+
+/**
+ * @brief BufferElementSource::BufferElementSource
+ * @param buffer
+ * @param element_size
+ * @param num_elements
+ * @param offset Byte offset of the first element in the buffer.
+ * @param stride Bytes between the starts of consecutive elements. Defaults to the element size.
+ */
+BufferElementSource::BufferElementSource(InputBuffer<unsigned char> buffer, size_t element_size, size_t num_elements, size_t offset, size_t stride):
+    ElementSource(element_size, num_elements),
+    buffer(std::move(buffer)),
+    offset(offset),
+    stride(stride == 0 ? element_size : stride)
+{
+}
+
+/**
+ * @brief BufferElementSource::elementData
+ * @param element
+ * @return
+ */
+const unsigned char *BufferElementSource::elementData(size_t element) const
+{
+    return buffer.data() + offset + element * stride;
+}
+
+/**
+ * @brief BufferElementSource::prefetch Ask the OS to read the pages of the element ahead, if the buffer is mapped.
+ * @param element
+ */
+void BufferElementSource::prefetch(size_t element) const
+{
+    if (buffer.mapping)
+        buffer.mapping->advise(MappingAdvice::WILL_NEED, offset + element * stride, element_size);
+}
+
+/**
+ * @brief SeekableZstdElementSource::SeekableZstdElementSource
+ * @param element_size
+ */
+SeekableZstdElementSource::SeekableZstdElementSource(size_t element_size):
+    ElementSource(element_size, 0)
+{
+}
+
+/**
+ * @brief SeekableZstdElementSource::open Open the file, which determines the number of elements.
+ * @param file_name
+ * @return
+ */
+bool SeekableZstdElementSource::open(QString file_name)
+{
+    if (!file.open(file_name))
+        return false;
+
+    num_elements = file.decompressedSize() / element_size;
+    if (!file.isAlignedTo(element_size))
+        qDebug() << "Frames of" << file_name << "are not aligned to elements, elements will be decompressed from multiple frames.";
+    return true;
+}
+
+/**
+ * @brief SeekableZstdElementSource::readElement
+ * @param element
+ * @param destination
+ * @return
+ */
+bool SeekableZstdElementSource::readElement(size_t element, unsigned char *destination) const
+{
+    return file.readElement(element, element_size, destination);
+}
+
+/**
+ * @brief StreamedElementSource::StreamedElementSource
+ * @param file_name A .bz2 file or a seekable .zst file.
+ * @param element_size
+ * @param num_elements Exact number of elements the file should contain.
+ */
+StreamedElementSource::StreamedElementSource(QString file_name, size_t element_size, size_t num_elements):
+    ElementSource(element_size, num_elements),
+    file_name(file_name)
+{
+}
+
+/**
+ * @brief StreamedElementSource::fileName
+ * @return The compressed file the elements are read from.
+ */
+QString StreamedElementSource::fileName() const
+{
+    return file_name;
+}
+
+/**
+ * @brief StreamedElementSource::forEachElement Decompress the file and pass every element on as soon as it is complete.
+ * @param callback
+ * @param progress Optional callback receiving the number of decompressed bytes and the total.
+ * @return True if the file contained exactly all elements.
+ */
+bool StreamedElementSource::forEachElement(const ElementCallback &callback, const ProgressCallback &progress) const
+{
+    size_t size = num_elements * element_size;
+    ElementAssembler assembler(element_size, num_elements, callback);
+    ByteSink sink = [&assembler](size_t offset, const unsigned char *data, size_t size) {
+        assembler.append(offset, data, size);
+    };
+
+    long num_bytes = -1;
+    if (file_name.endsWith(".bz2")) {
+        num_bytes = decompressBZip2(file_name, size, sink, progress);
+    } else if (file_name.endsWith(".zst")) {
+        SeekableZstdFile file;
+        if (file.open(file_name) && file.decompressedSize() == size)
+            num_bytes = file.stream(sink, progress);
+    }
+
+    if (num_bytes != static_cast<long>(size)) {
+        qDebug() << "Sizes:" << num_bytes << size;
+        qDebug() << "Unable to load data from file \"" << file_name << "\"\n";
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,81 @@
+#ifndef ELEMENT_SOURCE_H
+#define ELEMENT_SOURCE_H
+
+#include "input/element_stream.h"
+#include "input/input_buffer.h"
+#include "input/seekable_zstd.h"
+#include "util/progress.h"
+
+#include <QString>
+#include <cstddef>
+
+/**
+ * @brief The ElementSource class Random access to the elements (images or volumes) of a dataset. Elements can be read from multiple threads at once.
+ */
+class ElementSource
+{
+protected:
+    size_t element_size;
+    size_t num_elements;
+
+public:
+    ElementSource(size_t element_size, size_t num_elements);
+    virtual ~ElementSource();
+
+    size_t elementSize() const;
+    size_t numElements() const;
+
+    virtual const unsigned char *elementData(size_t element) const;
+    virtual bool readElement(size_t element, unsigned char *destination) const;
+    virtual void prefetch(size_t element) const;
+    virtual bool forEachElement(const ElementCallback &callback, const ProgressCallback &progress = nullptr) const;
+};
+
+/**
+ * @brief The BufferElementSource class Elements stored back to back in a buffer, which can be read without copying.
+ */
+class BufferElementSource : public ElementSource
+{
+    InputBuffer<unsigned char> buffer;
+    size_t offset;
+    size_t stride;
+
+public:
+    BufferElementSource(InputBuffer<unsigned char> buffer, size_t element_size, size_t num_elements, size_t offset = 0, size_t stride = 0);
+
+    const unsigned char *elementData(size_t element) const override;
+    void prefetch(size_t element) const override;
+};
+
+/**
+ * @brief The SeekableZstdElementSource class Elements in a seekable zstd file, which are decompressed when they are read.
+ */
+class SeekableZstdElementSource : public ElementSource
+{
+    SeekableZstdFile file;
+
+public:
+    SeekableZstdElementSource(size_t element_size);
+
+    bool open(QString file_name);
+
+    bool readElement(size_t element, unsigned char *destination) const override;
+};
+
+/**
+ * @brief The StreamedElementSource class Elements in a compressed file that are only read as a whole, in order.
+ * Nothing is decompressed until the elements are iterated, so they can be decompressed straight to where they are needed.
+ */
+class StreamedElementSource : public ElementSource
+{
+    QString file_name;
+
+public:
+    StreamedElementSource(QString file_name, size_t element_size, size_t num_elements);
+
+    QString fileName() const;
+
+    bool forEachElement(const ElementCallback &callback, const ProgressCallback &progress = nullptr) const override;
+};
+
+#endif // ELEMENT_SOURCE_H
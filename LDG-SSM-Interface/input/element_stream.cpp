@@ -0,0 +1,64 @@
+#include "input/element_stream.h"
+
+#include <algorithm>
+#include <cstring>
+
+/**
+ * @brief ElementAssembler::ElementAssembler
+ * @param element_size Size of a single element in bytes.
+ * @param num_elements Number of elements in the stream. Data after the last element is ignored.
+ * @param callback
+ */
+ElementAssembler::ElementAssembler(size_t element_size, size_t num_elements, const ElementCallback &callback):
+    element_size(element_size),
+    num_elements(num_elements),
+    callback(callback),
+    partial_element(element_size),
+    partial_size(0)
+{
+}
+
+/**
+ * @brief ElementAssembler::passOn
+ * @param element
+ * @param data
+ */
+void ElementAssembler::passOn(size_t element, const unsigned char *data)
+{
+    if (element < num_elements)
+        callback(element, data);
+}
+
+/**
+ * @brief ElementAssembler::append Add the next chunk of the stream.
+ * @param offset Offset of the chunk in the stream.
+ * @param data
+ * @param size
+ */
+void ElementAssembler::append(size_t offset, const unsigned char *data, size_t size)
+{
+    if (offset == 0)
+        partial_size = 0;
+
+    // Finish the element started by the previous chunk.
+    if (partial_size > 0) {
+        size_t num_bytes = std::min(size, element_size - partial_size);
+        std::memcpy(partial_element.data() + partial_size, data, num_bytes);
+        partial_size += num_bytes;
+        offset += num_bytes;
+        data += num_bytes;
+        size -= num_bytes;
+
+        if (partial_size < element_size)
+            return;
+        passOn(offset / element_size - 1, partial_element.data());
+        partial_size = 0;
+    }
+
+    // Whole elements are passed on straight from the chunk.
+    for (; size >= element_size; offset += element_size, data += element_size, size -= element_size)
+        passOn(offset / element_size, data);
+
+    std::memcpy(partial_element.data(), data, size);
+    partial_size = size;
+}
@@ -0,0 +1,32 @@
+#ifndef ELEMENT_STREAM_H
+#define ELEMENT_STREAM_H
+
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+using ByteSink = std::function<void(size_t offset, const unsigned char *data, size_t size)>;         // Receives decompressed data in order. An offset of 0 restarts the data.
+using ElementCallback = std::function<void(size_t element, const unsigned char *data)>;               // Receives the data of a complete element.
+
+/**
+ * @brief The ElementAssembler class Cuts a stream of decompressed data into complete elements.
+ * Elements that lie within a single chunk are passed on without copying, only elements spanning chunks are assembled in a buffer.
+ */
+class ElementAssembler
+{
+    size_t element_size;
+    size_t num_elements;
+    const ElementCallback &callback;
+
+    std::vector<unsigned char> partial_element;
+    size_t partial_size;
+
+    void passOn(size_t element, const unsigned char *data);
+
+public:
+    ElementAssembler(size_t element_size, size_t num_elements, const ElementCallback &callback);
+
+    void append(size_t offset, const unsigned char *data, size_t size);
+};
+
+#endif // ELEMENT_STREAM_H
@@ -0,0 +1,42 @@
+#ifndef INPUT_BUFFER_H
+#define INPUT_BUFFER_H
+
+#include "input/mapped_file.h"
+
+#include <memory>
+#include <vector>
+
+/**
+ * @brief The InputBuffer class Read-only buffer of input data. The data is either owned, for decompressed input, or memory-mapped straight from a raw file.
+ */
+template<typename DataType>
+struct InputBuffer
+{
+    std::vector<DataType> storage;          // Owned data, used when the input had to be decoded.
+    std::shared_ptr<MappedFile> mapping;    // Mapped data, used when the input can be read as-is.
+
+    /**
+     * @brief data
+     * @return Pointer to the first element.
+     */
+    const DataType *data() const
+    {
+        return mapping ? reinterpret_cast<const DataType *>(mapping->data()) : storage.data();
+    }
+
+    /**
+     * @brief size
+     * @return Number of elements in the buffer.
+     */
+    size_t size() const
+    {
+        return mapping ? mapping->size() / sizeof(DataType) : storage.size();
+    }
+
+    const DataType &operator[](size_t idx) const
+    {
+        return data()[idx];
+    }
+};
+
+#endif // INPUT_BUFFER_H
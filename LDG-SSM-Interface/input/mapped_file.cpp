@@ -0,0 +1,131 @@
+#include "input/mapped_file.h"
+
+#include <QDebug>
+#include <algorithm>
+
+#ifdef Q_OS_UNIX
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+/**
+ * @brief MappedFile::MappedFile
+ */
+MappedFile::MappedFile():
+    mapped_data(nullptr),
+    mapped_size(0)
+{
+}
+
+/**
+ * @brief MappedFile::~MappedFile
+ */
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+/**
+ * @brief MappedFile::open Map the complete file into memory. Any previous mapping is released.
+ * @param file_name
+ * @return True if the file could be mapped.
+ */
+bool MappedFile::open(QString file_name)
+{
+    close();
+
+    file.setFileName(file_name);
+    if (!file.open(QIODevice::ReadOnly)) {
+        qDebug() << "Could not open file: " << file_name;
+        return false;
+    }
+
+    // Empty files can't be mapped, but are valid nonetheless.
+    mapped_size = file.size();
+    if (mapped_size == 0)
+        return true;
+
+    mapped_data = file.map(0, mapped_size);
+    if (mapped_data == nullptr) {
+        qDebug() << "Could not map file: " << file_name << file.errorString();
+        mapped_size = 0;
+        file.close();
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief MappedFile::close Unmap and close the file.
+ */
+void MappedFile::close()
+{
+    if (mapped_data != nullptr)
+        file.unmap(const_cast<unsigned char *>(mapped_data));
+    if (file.isOpen())
+        file.close();
+
+    mapped_data = nullptr;
+    mapped_size = 0;
+}
+
+/**
+ * @brief MappedFile::advise Hint the expected access pattern of a range to the OS so it can read ahead or drop pages. This is a no-op on platforms without madvise.
+ * @param advice
+ * @param offset
+ * @param length
+ */
+void MappedFile::advise(MappingAdvice advice, size_t offset, size_t length) const
+{
+#ifdef Q_OS_UNIX
+    if (mapped_data == nullptr || offset >= mapped_size)
+        return;
+
+    // The start of the range has to be page aligned.
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t aligned_offset = offset - offset % page_size;
+    size_t aligned_length = std::min(length, mapped_size - offset) + (offset - aligned_offset);
+
+    int posix_advice = POSIX_MADV_NORMAL;
+    switch (advice) {
+    case MappingAdvice::SEQUENTIAL:
+        posix_advice = POSIX_MADV_SEQUENTIAL;
+        break;
+    case MappingAdvice::RANDOM:
+        posix_advice = POSIX_MADV_RANDOM;
+        break;
+    case MappingAdvice::WILL_NEED:
+        posix_advice = POSIX_MADV_WILLNEED;
+        break;
+    case MappingAdvice::DONT_NEED:
+        posix_advice = POSIX_MADV_DONTNEED;
+        break;
+    default:
+        break;
+    }
+    posix_madvise(const_cast<unsigned char *>(mapped_data) + aligned_offset, aligned_length, posix_advice);
+#else
+    Q_UNUSED(advice);
+    Q_UNUSED(offset);
+    Q_UNUSED(length);
+#endif
+}
+
+/**
+ * @brief MappedFile::data
+ * @return Pointer to the start of the mapping, or nullptr if nothing is mapped.
+ */
+const unsigned char *MappedFile::data() const
+{
+    return mapped_data;
+}
+
+/**
+ * @brief MappedFile::size
+ * @return Size of the mapping in bytes.
+ */
+size_t MappedFile::size() const
+{
+    return mapped_size;
+}
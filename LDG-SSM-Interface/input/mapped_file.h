@@ -0,0 +1,44 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <QFile>
+#include <QString>
+#include <cstddef>
+
+/**
+ * Access patterns that can be hinted to the OS for a mapped range, used for read-ahead.
+ */
+enum MappingAdvice
+{
+    NORMAL,
+    SEQUENTIAL,
+    RANDOM,
+    WILL_NEED,
+    DONT_NEED
+};
+
+/**
+ * @brief The MappedFile class Read-only memory mapping of a whole file. The mapped pages stay valid for the lifetime of the object.
+ */
+class MappedFile
+{
+    QFile file;
+    const unsigned char *mapped_data;
+    size_t mapped_size;
+
+public:
+    MappedFile();
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    bool open(QString file_name);
+    void close();
+    void advise(MappingAdvice advice, size_t offset = 0, size_t length = SIZE_MAX) const;
+
+    const unsigned char *data() const;
+    size_t size() const;
+};
+
+#endif // MAPPED_FILE_H
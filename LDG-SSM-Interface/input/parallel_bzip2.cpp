@@ -0,0 +1,411 @@
+#include "input/parallel_bzip2.h"
+#include "input/mapped_file.h"
+#include "util/parallel.h"
+
+#include <bzlib.h>
+
+#include <QDebug>
+#include <QElapsedTimer>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+const uint64_t BZIP2_BLOCK_MAGIC = 0x314159265359ULL;
+const uint64_t BZIP2_END_OF_STREAM_MAGIC = 0x177245385090ULL;
+const uint64_t BZIP2_MAGIC_MASK = 0xFFFFFFFFFFFFULL;
+const size_t BZIP2_MAGIC_BITS = 48;
+const size_t BZIP2_SCAN_CHUNK_SIZE = 1 << 24;
+
+/**
+ * Block or end of stream magic found in the compressed data.
+ */
+struct BZip2Marker
+{
+    size_t bit;
+    bool is_block;
+};
+
+/**
+ * @brief readBits Read 48 bits starting at the given bit position. Bits past the end of the data are read as 0.
+ * @param data
+ * @param size
+ * @param bit
+ * @return
+ */
+uint64_t readBits(const unsigned char *data, size_t size, size_t bit)
+{
+    size_t byte = bit / 8;
+    uint64_t window = 0;
+    for (size_t idx = 0; idx < 8; ++idx)
+        window = (window << 8) | (byte + idx < size ? data[byte + idx] : 0);
+    return (window >> (16 - bit % 8)) & BZIP2_MAGIC_MASK;
+}
+
+/**
+ * @brief isStreamHeader Check if a stream header ("BZh1" - "BZh9") directly precedes the byte.
+ * @param data
+ * @param byte
+ * @return
+ */
+bool isStreamHeader(const unsigned char *data, size_t byte)
+{
+    return byte >= 4 && data[byte - 4] == 'B' && data[byte - 3] == 'Z' && data[byte - 2] == 'h' && data[byte - 1] >= '1' && data[byte - 1] <= '9';
+}
+
+/**
+ * @brief findMarkers Find all block and end of stream magics, which are not byte aligned within a stream.
+ * Both magics contain a byte that is fixed for each of the 8 possible bit offsets, which is used to filter candidates before comparing all 48 bits.
+ * @param data
+ * @param size
+ * @return Markers sorted by bit position.
+ */
+QList<BZip2Marker> findMarkers(const unsigned char *data, size_t size)
+{
+    std::array<uint8_t, 256> block_offsets{};
+    std::array<uint8_t, 256> end_of_stream_offsets{};
+    for (size_t offset = 0; offset < 8; ++offset) {
+        block_offsets[(BZIP2_BLOCK_MAGIC >> (32 + offset)) & 0xFF] |= 1 << offset;
+        end_of_stream_offsets[(BZIP2_END_OF_STREAM_MAGIC >> (32 + offset)) & 0xFF] |= 1 << offset;
+    }
+
+    // The candidate byte is the second byte touched by the magic.
+    size_t num_chunks = size > 1 ? (size - 1 + BZIP2_SCAN_CHUNK_SIZE - 1) / BZIP2_SCAN_CHUNK_SIZE : 0;
+    std::vector<QList<BZip2Marker>> chunk_markers(num_chunks);
+    parallelFor(num_chunks, [&](size_t chunk) {
+        size_t start = 1 + chunk * BZIP2_SCAN_CHUNK_SIZE;
+        size_t end = std::min(size, start + BZIP2_SCAN_CHUNK_SIZE);
+        for (size_t byte = start; byte < end; ++byte) {
+            uint8_t candidates = block_offsets[data[byte]] | end_of_stream_offsets[data[byte]];
+            for (size_t offset = 0; candidates != 0; ++offset, candidates >>= 1) {
+                size_t bit = (byte - 1) * 8 + offset;
+                if ((candidates & 1) == 0 || bit + BZIP2_MAGIC_BITS > size * 8)
+                    continue;
+
+                uint64_t value = readBits(data, size, bit);
+                if (value == BZIP2_BLOCK_MAGIC)
+                    chunk_markers[chunk].append({ bit, true });
+                else if (value == BZIP2_END_OF_STREAM_MAGIC)
+                    chunk_markers[chunk].append({ bit, false });
+            }
+        }
+    });
+
+    QList<BZip2Marker> markers;
+    for (auto &chunk : chunk_markers)
+        markers.append(chunk);
+    return markers;
+}
+
+/**
+ * @brief findBZip2Segments Split a compressed file into independently decompressable blocks.
+ * This handles both concatenated streams and multiple blocks within a single stream. Since block boundaries aren't indexed, a magic can also
+ * occur by chance in compressed data. These false positives are not detected here, but make the decompression of the segment fail.
+ * @param data
+ * @param size
+ * @return The segments in file order, or an empty list if the layout isn't consistent.
+ */
+QList<BZip2Segment> findBZip2Segments(const unsigned char *data, size_t size)
+{
+    QList<BZip2Segment> segments;
+    int block_size_level = 0;           // 0 means we're not within a stream.
+    size_t block_start = SIZE_MAX;      // SIZE_MAX means there is no open block.
+
+    for (auto &marker : findMarkers(data, size)) {
+        bool is_stream_start = marker.bit % 8 == 0 && isStreamHeader(data, marker.bit / 8);
+
+        if (marker.is_block) {
+            if (is_stream_start) {
+                if (block_start != SIZE_MAX)
+                    return {};
+                block_size_level = data[marker.bit / 8 - 1] - '0';
+            } else if (block_size_level == 0) {
+                return {};
+            } else if (block_start != SIZE_MAX) {
+                segments.append({ block_start, marker.bit, block_size_level });
+            }
+            block_start = marker.bit;
+        } else {
+            // Empty streams consist of just a header and end of stream magic.
+            if (is_stream_start && block_start == SIZE_MAX)
+                continue;
+            if (block_size_level == 0 || block_start == SIZE_MAX)
+                return {};
+
+            segments.append({ block_start, marker.bit, block_size_level });
+            block_size_level = 0;
+            block_start = SIZE_MAX;
+        }
+    }
+
+    if (block_start != SIZE_MAX)
+        return {};
+    return segments;
+}
+
+/**
+ * @brief createSegmentStream Wrap a single block into a complete stream, like bzip2recover does.
+ * The combined stream CRC of a single block stream equals the CRC of its block.
+ * @param data
+ * @param segment
+ * @return
+ */
+std::vector<char> createSegmentStream(const unsigned char *data, size_t size, const BZip2Segment &segment)
+{
+    size_t num_bits = segment.end_bit - segment.start_bit;
+    size_t num_bytes = num_bits / 8;
+    std::vector<char> stream(4 + num_bytes + 12, 0);
+    stream[0] = 'B';
+    stream[1] = 'Z';
+    stream[2] = 'h';
+    stream[3] = '0' + segment.block_size_level;
+
+    // Copy the whole bytes of the block, realigning them if the block doesn't start at a byte boundary.
+    const unsigned char *source = data + segment.start_bit / 8;
+    unsigned char *target = reinterpret_cast<unsigned char *>(stream.data()) + 4;
+    size_t shift = segment.start_bit % 8;
+    if (shift == 0) {
+        std::memcpy(target, source, num_bytes);
+    } else {
+        for (size_t idx = 0; idx < num_bytes; ++idx)
+            target[idx] = (source[idx] << shift) | (source[idx + 1] >> (8 - shift));
+    }
+
+    // Write the remaining bits of the block, followed by the end of stream magic and the CRC.
+    size_t position = 4 + num_bytes;
+    unsigned char current_byte = 0;
+    size_t num_current_bits = 0;
+    auto write_bits = [&](uint64_t value, size_t num_value_bits) {
+        for (size_t idx = num_value_bits; idx > 0; --idx) {
+            current_byte = (current_byte << 1) | ((value >> (idx - 1)) & 1);
+            if (++num_current_bits == 8) {
+                stream[position++] = current_byte;
+                current_byte = 0;
+                num_current_bits = 0;
+            }
+        }
+    };
+
+    size_t num_remaining_bits = num_bits % 8;
+    write_bits(readBits(data, size, segment.start_bit + num_bytes * 8) >> (BZIP2_MAGIC_BITS - num_remaining_bits), num_remaining_bits);
+    write_bits(BZIP2_END_OF_STREAM_MAGIC, BZIP2_MAGIC_BITS);
+    write_bits(readBits(data, size, segment.start_bit + BZIP2_MAGIC_BITS) >> 16, 32);
+    if (num_current_bits > 0)
+        stream[position++] = current_byte << (8 - num_current_bits);
+
+    stream.resize(position);
+    return stream;
+}
+
+/**
+ * @brief decompressSegment Decompress a single segment into a buffer that grows as needed.
+ * @param data
+ * @param size
+ * @param segment
+ * @param output
+ * @return True if the segment decompressed into a complete, CRC-checked block.
+ */
+bool decompressSegment(const unsigned char *data, size_t size, const BZip2Segment &segment, std::vector<char> &output)
+{
+    std::vector<char> stream_data = createSegmentStream(data, size, segment);
+
+    bz_stream stream{};
+    if (BZ2_bzDecompressInit(&stream, 0, 0) != BZ_OK)
+        return false;
+
+    stream.next_in = stream_data.data();
+    stream.avail_in = stream_data.size();
+    output.resize(segment.block_size_level * 100000);
+
+    size_t bytes_written = 0;
+    int bz_error = BZ_OK;
+    while (bz_error == BZ_OK) {
+        // Runs can make a block decompress to more than its block size.
+        if (bytes_written == output.size())
+            output.resize(output.size() * 2);
+
+        stream.next_out = output.data() + bytes_written;
+        stream.avail_out = output.size() - bytes_written;
+        bz_error = BZ2_bzDecompress(&stream);
+
+        size_t new_bytes_written = output.size() - stream.avail_out;
+        if (bz_error == BZ_OK && stream.avail_in == 0 && new_bytes_written == bytes_written)
+            bz_error = BZ_UNEXPECTED_EOF;
+        bytes_written = new_bytes_written;
+    }
+    BZ2_bzDecompressEnd(&stream);
+
+    output.resize(bytes_written);
+    return bz_error == BZ_STREAM_END;
+}
+
+/**
+ * @brief decompressBZip2Parallel Decompress a .bz2 file by decompressing all of its blocks on the thread pool.
+ * Blocks are processed in batches and passed on in order, so the memory used is bounded by a few blocks per thread.
+ * @param file_name
+ * @param size Expected decompressed size in bytes.
+ * @param sink Receives the decompressed blocks in order.
+ * @param progress Optional callback receiving the number of decompressed bytes and the expected total.
+ * @return Number of bytes decompressed, -1 on an error or BZIP2_FALLBACK if the file should be streamed sequentially.
+ */
+long decompressBZip2Parallel(QString file_name, size_t size, const ByteSink &sink, const ProgressCallback &progress)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    MappedFile file;
+    if (!file.open(file_name))
+        return -1;
+    file.advise(MappingAdvice::WILL_NEED);
+
+    auto segments = findBZip2Segments(file.data(), file.size());
+    if (segments.size() < 2)
+        return BZIP2_FALLBACK;
+
+    size_t batch_size = numParallelWorkers() * 4;
+    std::vector<std::vector<char>> outputs(batch_size);
+    size_t bytes_written = 0;
+
+    for (size_t batch_start = 0; batch_start < segments.size(); batch_start += batch_size) {
+        size_t num_batch_segments = std::min<size_t>(batch_size, segments.size() - batch_start);
+
+        std::atomic<bool> is_valid = true;
+        parallelFor(num_batch_segments, [&](size_t idx) {
+            if (!decompressSegment(file.data(), file.size(), segments[batch_start + idx], outputs[idx]))
+                is_valid = false;
+        });
+        if (!is_valid) {
+            qDebug() << "Could not decompress file in parallel, falling back to streaming: " << file_name;
+            return BZIP2_FALLBACK;
+        }
+
+        for (size_t idx = 0; idx < num_batch_segments; ++idx) {
+            auto &output = outputs[idx];
+            if (bytes_written + output.size() > size) {
+                qDebug() << "File contains more than the expected" << size << "bytes: " << file_name;
+                return -1;
+            }
+            sink(bytes_written, reinterpret_cast<const unsigned char *>(output.data()), output.size());
+            bytes_written += output.size();
+        }
+
+        if (progress && !progress(bytes_written, size)) {
+            qDebug() << "Decompression was cancelled: " << file_name;
+            return -1;
+        }
+    }
+
+    qDebug() << "Decompressing" << segments.size() << "bzip2 blocks in parallel took" << timer.elapsed() << "milliseconds";
+
+    return bytes_written;
+}
+
+/**
+ * @brief streamBZip2File Stream-decompress a .bz2 file through a small fixed window.
+ * Concatenated streams, as written by parallel compressors, are decompressed one after another.
+ * @param file_name
+ * @param size Expected decompressed size in bytes.
+ * @param sink Receives the decompressed data in order.
+ * @param progress Optional callback receiving the number of decompressed bytes and the expected total.
+ * @return Number of bytes decompressed, or -1 on an error or when the file contains more than size bytes.
+ */
+long streamBZip2File(QString file_name, size_t size, const ByteSink &sink, const ProgressCallback &progress)
+{
+    std::ifstream file_stream(file_name.toStdString(), std::ios::binary);
+    if (!file_stream.is_open()) {
+        qDebug() << "Could not open file: " << file_name;
+        return -1;
+    }
+
+    bz_stream stream{};
+    if (BZ2_bzDecompressInit(&stream, 0, 0) != BZ_OK) {
+        qDebug() << "Could not initialize decompression for file: " << file_name;
+        return -1;
+    }
+
+    std::vector<char> input_window(BZIP2_WINDOW_SIZE);
+    std::vector<char> output_window(BZIP2_WINDOW_SIZE);
+    size_t bytes_written = 0;
+    bool is_valid = true;
+
+    while (true) {
+        // Refill the input window
+        if (stream.avail_in == 0) {
+            file_stream.read(input_window.data(), input_window.size());
+            stream.next_in = input_window.data();
+            stream.avail_in = file_stream.gcount();
+        }
+        bool is_input_exhausted = stream.avail_in == 0;
+
+        stream.next_out = output_window.data();
+        stream.avail_out = output_window.size();
+        int bz_error = BZ2_bzDecompress(&stream);
+
+        size_t num_bytes = output_window.size() - stream.avail_out;
+        if (bytes_written + num_bytes > size) {
+            qDebug() << "File contains more than the expected" << size << "bytes: " << file_name;
+            is_valid = false;
+            break;
+        }
+        if (num_bytes > 0)
+            sink(bytes_written, reinterpret_cast<const unsigned char *>(output_window.data()), num_bytes);
+        bytes_written += num_bytes;
+
+        if (bz_error == BZ_STREAM_END) {
+            // Check if another stream follows
+            if (stream.avail_in == 0) {
+                file_stream.read(input_window.data(), input_window.size());
+                stream.next_in = input_window.data();
+                stream.avail_in = file_stream.gcount();
+            }
+            if (stream.avail_in == 0)
+                break;
+
+            char *next_in = stream.next_in;
+            unsigned int avail_in = stream.avail_in;
+            BZ2_bzDecompressEnd(&stream);
+            stream = bz_stream{};
+            if (BZ2_bzDecompressInit(&stream, 0, 0) != BZ_OK) {
+                qDebug() << "Could not initialize decompression for file: " << file_name;
+                return -1;
+            }
+            stream.next_in = next_in;
+            stream.avail_in = avail_in;
+        } else if (bz_error != BZ_OK) {
+            qDebug() << "Could not decompress file: " << file_name << "error" << bz_error;
+            is_valid = false;
+            break;
+        } else if (is_input_exhausted && num_bytes == 0) {
+            qDebug() << "Unexpected end of compressed data in file: " << file_name;
+            is_valid = false;
+            break;
+        }
+
+        if (progress && !progress(bytes_written, size)) {
+            qDebug() << "Decompression was cancelled: " << file_name;
+            is_valid = false;
+            break;
+        }
+    }
+    BZ2_bzDecompressEnd(&stream);
+
+    return is_valid ? bytes_written : -1;
+}
+
+/**
+ * @brief decompressBZip2 Decompress a .bz2 file in parallel, or stream it if its blocks can't be decompressed independently.
+ * @param file_name
+ * @param size Expected decompressed size in bytes.
+ * @param sink Receives the decompressed data in order. When falling back to streaming, the data is passed on again from offset 0.
+ * @param progress Optional callback receiving the number of decompressed bytes and the expected total.
+ * @return Number of bytes decompressed, or -1 on an error.
+ */
+long decompressBZip2(QString file_name, size_t size, const ByteSink &sink, const ProgressCallback &progress)
+{
+    long num_bytes = decompressBZip2Parallel(file_name, size, sink, progress);
+    if (num_bytes == BZIP2_FALLBACK)
+        return streamBZip2File(file_name, size, sink, progress);
+    return num_bytes;
+}
@@ -0,0 +1,32 @@
+#ifndef PARALLEL_BZIP2_H
+#define PARALLEL_BZIP2_H
+
+#include "input/element_stream.h"
+#include "util/progress.h"
+
+#include <QList>
+#include <QString>
+#include <cstddef>
+
+const long BZIP2_FALLBACK = -2;                     // Returned when a file can't be split and should be streamed sequentially instead.
+const size_t BZIP2_WINDOW_SIZE = 1 << 20;           // Size of the compressed input window and the decompressed output window when streaming.
+
+/**
+ * @brief The BZip2Segment struct A single bzip2 block that can be decompressed independently, given as a bit range of the compressed file.
+ */
+struct BZip2Segment
+{
+    size_t start_bit;           // Start of the block magic.
+    size_t end_bit;             // End of the block, which is the start of the next block magic or end of stream magic.
+    int block_size_level;       // Block size level (1 - 9) of the stream the block belongs to.
+};
+
+QList<BZip2Segment> findBZip2Segments(const unsigned char *data, size_t size);
+
+long decompressBZip2Parallel(QString file_name, size_t size, const ByteSink &sink, const ProgressCallback &progress = nullptr);
+
+long streamBZip2File(QString file_name, size_t size, const ByteSink &sink, const ProgressCallback &progress = nullptr);
+
+long decompressBZip2(QString file_name, size_t size, const ByteSink &sink, const ProgressCallback &progress = nullptr);
+
+#endif // PARALLEL_BZIP2_H
@@ -0,0 +1,312 @@
+#include "input/seekable_zstd.h"
+#include "util/parallel.h"
+
+#include <QDebug>
+#include <QElapsedTimer>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#ifdef LDG_SSM_HAS_ZSTD
+#include <zstd.h>
+#endif
+
+const uint32_t ZSTD_SKIPPABLE_MAGIC = 0x184D2A5E;
+const uint32_t ZSTD_SEEKABLE_MAGIC = 0x8F92EAB1;
+const size_t ZSTD_SEEK_TABLE_FOOTER_SIZE = 9;
+const size_t ZSTD_SKIPPABLE_HEADER_SIZE = 8;
+const size_t STREAM_BATCH_BYTES_PER_WORKER = 4 << 20;   // Decompressed bytes a batch of a stream holds per worker, next to at least a frame per worker.
+
+/**
+ * @brief readLittleEndian32 Read an unsigned little endian 32 bit integer.
+ * @param data
+ * @return
+ */
+uint32_t readLittleEndian32(const unsigned char *data)
+{
+    return static_cast<uint32_t>(data[0]) | static_cast<uint32_t>(data[1]) << 8 | static_cast<uint32_t>(data[2]) << 16 | static_cast<uint32_t>(data[3]) << 24;
+}
+
+/**
+ * @brief SeekableZstdFile::open Map the file and read its seek table.
+ * @param file_name
+ * @return True if the file is a valid seekable zstd file.
+ */
+bool SeekableZstdFile::open(QString file_name)
+{
+    frames.clear();
+#ifndef LDG_SSM_HAS_ZSTD
+    qDebug() << "Can't read" << file_name << "as the interface was built without zstd support.";
+    return false;
+#else
+    if (!file.open(file_name))
+        return false;
+
+    if (!readSeekTable()) {
+        qDebug() << "File is not in the seekable zstd format: " << file_name;
+        file.close();
+        return false;
+    }
+
+    // Frames are decompressed in arbitrary order.
+    file.advise(MappingAdvice::RANDOM);
+    return true;
+#endif
+}
+
+/**
+ * @brief SeekableZstdFile::readSeekTable Parse the seek table at the end of the file into frame locations.
+ * @return
+ */
+bool SeekableZstdFile::readSeekTable()
+{
+    const unsigned char *data = file.data();
+    size_t size = file.size();
+    if (size < ZSTD_SKIPPABLE_HEADER_SIZE + ZSTD_SEEK_TABLE_FOOTER_SIZE)
+        return false;
+
+    // Footer: number of frames, descriptor and magic
+    const unsigned char *footer = data + size - ZSTD_SEEK_TABLE_FOOTER_SIZE;
+    if (readLittleEndian32(footer + 5) != ZSTD_SEEKABLE_MAGIC)
+        return false;
+
+    size_t num_frames = readLittleEndian32(footer);
+    bool has_checksums = (footer[4] & 0x80) != 0;
+    size_t entry_size = has_checksums ? 12 : 8;
+    size_t table_size = num_frames * entry_size + ZSTD_SEEK_TABLE_FOOTER_SIZE;
+    if (table_size + ZSTD_SKIPPABLE_HEADER_SIZE > size)
+        return false;
+
+    // The table is wrapped in a skippable frame.
+    const unsigned char *header = data + size - table_size - ZSTD_SKIPPABLE_HEADER_SIZE;
+    if (readLittleEndian32(header) != ZSTD_SKIPPABLE_MAGIC || readLittleEndian32(header + 4) != table_size)
+        return false;
+
+    const unsigned char *entry = header + ZSTD_SKIPPABLE_HEADER_SIZE;
+    size_t compressed_end = size - table_size - ZSTD_SKIPPABLE_HEADER_SIZE;
+    size_t compressed_offset = 0;
+    size_t decompressed_offset = 0;
+    frames.reserve(num_frames);
+    for (size_t idx = 0; idx < num_frames; ++idx, entry += entry_size) {
+        size_t compressed_size = readLittleEndian32(entry);
+        size_t decompressed_size = readLittleEndian32(entry + 4);
+        if (compressed_offset + compressed_size > compressed_end)
+            return false;
+
+        frames.append({ compressed_offset, compressed_size, decompressed_offset, decompressed_size });
+        compressed_offset += compressed_size;
+        decompressed_offset += decompressed_size;
+    }
+
+    return true;
+}
+
+/**
+ * @brief SeekableZstdFile::findFrame Find the frame containing the decompressed offset.
+ * @param decompressed_offset
+ * @return
+ */
+size_t SeekableZstdFile::findFrame(size_t decompressed_offset) const
+{
+    auto frame = std::upper_bound(frames.begin(), frames.end(), decompressed_offset, [](size_t offset, const SeekableZstdFrame &frame) {
+        return offset < frame.decompressed_offset;
+    });
+    return std::distance(frames.begin(), frame) - 1;
+}
+
+/**
+ * @brief SeekableZstdFile::decompressFrame Decompress a complete frame. Every thread keeps its own decompression context.
+ * @param frame
+ * @param destination Buffer with room for the decompressed frame.
+ * @return
+ */
+bool SeekableZstdFile::decompressFrame(const SeekableZstdFrame &frame, unsigned char *destination) const
+{
+#ifdef LDG_SSM_HAS_ZSTD
+    thread_local std::unique_ptr<ZSTD_DCtx, size_t (*)(ZSTD_DCtx *)> context(ZSTD_createDCtx(), ZSTD_freeDCtx);
+
+    size_t result = ZSTD_decompressDCtx(context.get(), destination, frame.decompressed_size, file.data() + frame.compressed_offset, frame.compressed_size);
+    if (ZSTD_isError(result)) {
+        qDebug() << "Could not decompress zstd frame:" << ZSTD_getErrorName(result);
+        return false;
+    }
+    return result == frame.decompressed_size;
+#else
+    Q_UNUSED(frame);
+    Q_UNUSED(destination);
+    return false;
+#endif
+}
+
+/**
+ * @brief SeekableZstdFile::decompressedSize
+ * @return Size of all decompressed data in bytes.
+ */
+size_t SeekableZstdFile::decompressedSize() const
+{
+    return frames.isEmpty() ? 0 : frames.last().decompressed_offset + frames.last().decompressed_size;
+}
+
+/**
+ * @brief SeekableZstdFile::numFrames
+ * @return
+ */
+size_t SeekableZstdFile::numFrames() const
+{
+    return frames.size();
+}
+
+/**
+ * @brief SeekableZstdFile::isAlignedTo Check if all frames start at an element boundary, so no element is split over multiple frames.
+ * @param element_size
+ * @return
+ */
+bool SeekableZstdFile::isAlignedTo(size_t element_size) const
+{
+    for (auto &frame : frames) {
+        if (frame.decompressed_offset % element_size != 0)
+            return false;
+    }
+    return true;
+}
+
+/**
+ * @brief SeekableZstdFile::readRange Decompress an arbitrary range. Only the frames overlapping the range are decompressed.
+ * @param offset
+ * @param size
+ * @param destination
+ * @return
+ */
+bool SeekableZstdFile::readRange(size_t offset, size_t size, unsigned char *destination) const
+{
+    if (offset + size > decompressedSize())
+        return false;
+
+    std::vector<unsigned char> frame_buffer;
+    for (size_t frame_idx = findFrame(offset); size > 0; ++frame_idx) {
+        auto &frame = frames[frame_idx];
+        size_t start = offset - frame.decompressed_offset;
+        size_t length = std::min(size, frame.decompressed_size - start);
+
+        // Frames that are needed completely can be decompressed in place.
+        if (start == 0 && length == frame.decompressed_size) {
+            if (!decompressFrame(frame, destination))
+                return false;
+        } else {
+            frame_buffer.resize(frame.decompressed_size);
+            if (!decompressFrame(frame, frame_buffer.data()))
+                return false;
+            std::memcpy(destination, frame_buffer.data() + start, length);
+        }
+
+        destination += length;
+        offset += length;
+        size -= length;
+    }
+
+    return true;
+}
+
+/**
+ * @brief SeekableZstdFile::readElement Decompress a single element.
+ * @param element
+ * @param element_size
+ * @param destination
+ * @return
+ */
+bool SeekableZstdFile::readElement(size_t element, size_t element_size, unsigned char *destination) const
+{
+    return readRange(element * element_size, element_size, destination);
+}
+
+/**
+ * @brief SeekableZstdFile::readAll Decompress all frames in parallel, straight into their final location.
+ * @param destination
+ * @param size Size of the destination, which should match the decompressed size.
+ * @param progress Optional callback receiving the number of decompressed bytes and the total.
+ * @return Number of bytes decompressed or -1 on an error.
+ */
+long SeekableZstdFile::readAll(unsigned char *destination, size_t size, const ProgressCallback &progress) const
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    if (size != decompressedSize()) {
+        qDebug() << "Sizes:" << decompressedSize() << size;
+        return -1;
+    }
+
+    // Frames are processed in batches so progress can be reported from this thread.
+    size_t batch_size = numParallelWorkers() * 16;
+    for (size_t batch_start = 0; batch_start < frames.size(); batch_start += batch_size) {
+        size_t num_batch_frames = std::min<size_t>(batch_size, frames.size() - batch_start);
+
+        std::atomic<bool> is_valid = true;
+        parallelFor(num_batch_frames, [&](size_t idx) {
+            auto &frame = frames[batch_start + idx];
+            if (!decompressFrame(frame, destination + frame.decompressed_offset))
+                is_valid = false;
+        });
+        if (!is_valid)
+            return -1;
+
+        auto &last_frame = frames[batch_start + num_batch_frames - 1];
+        if (progress && !progress(last_frame.decompressed_offset + last_frame.decompressed_size, size))
+            return -1;
+    }
+
+    qDebug() << "Decompressing" << frames.size() << "zstd frames took" << timer.elapsed() << "milliseconds";
+
+    return size;
+}
+
+/**
+ * @brief SeekableZstdFile::stream Decompress batches of frames in parallel and pass them on in order.
+ * Only a single batch is kept in memory, so the data can be placed elsewhere without holding all of it.
+ * A batch takes frames until it holds STREAM_BATCH_BYTES_PER_WORKER for every worker, but always takes a frame for every worker so large frames are still decompressed in parallel.
+ * @param sink Receives the decompressed frames in order.
+ * @param progress Optional callback receiving the number of decompressed bytes and the total.
+ * @return Number of bytes decompressed or -1 on an error.
+ */
+long SeekableZstdFile::stream(const ByteSink &sink, const ProgressCallback &progress) const
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    size_t size = decompressedSize();
+    size_t num_workers = numParallelWorkers();
+    size_t max_batch_bytes = num_workers * STREAM_BATCH_BYTES_PER_WORKER;
+    std::vector<unsigned char> batch_data;
+    for (size_t batch_start = 0, num_batch_frames = 0; batch_start < frames.size(); batch_start += num_batch_frames) {
+        size_t batch_bytes = 0;
+        num_batch_frames = 0;
+        while (batch_start + num_batch_frames < frames.size() && (num_batch_frames < num_workers || batch_bytes + frames[batch_start + num_batch_frames].decompressed_size <= max_batch_bytes))
+            batch_bytes += frames[batch_start + num_batch_frames++].decompressed_size;
+
+        auto &first_frame = frames[batch_start];
+        auto &last_frame = frames[batch_start + num_batch_frames - 1];
+        size_t batch_offset = first_frame.decompressed_offset;
+        batch_data.resize(last_frame.decompressed_offset + last_frame.decompressed_size - batch_offset);
+
+        std::atomic<bool> is_valid = true;
+        parallelFor(num_batch_frames, [&](size_t idx) {
+            auto &frame = frames[batch_start + idx];
+            if (!decompressFrame(frame, batch_data.data() + frame.decompressed_offset - batch_offset))
+                is_valid = false;
+        });
+        if (!is_valid)
+            return -1;
+
+        sink(batch_offset, batch_data.data(), batch_data.size());
+
+        if (progress && !progress(batch_offset + batch_data.size(), size))
+            return -1;
+    }
+
+    qDebug() << "Streaming" << frames.size() << "zstd frames took" << timer.elapsed() << "milliseconds";
+
+    return size;
+}
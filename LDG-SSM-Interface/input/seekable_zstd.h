@@ -0,0 +1,49 @@
+#ifndef SEEKABLE_ZSTD_H
+#define SEEKABLE_ZSTD_H
+
+#include "input/element_stream.h"
+#include "input/mapped_file.h"
+#include "util/progress.h"
+
+#include <QList>
+#include <QString>
+#include <cstddef>
+
+/**
+ * @brief The SeekableZstdFrame struct Location of a single zstd frame in both the compressed file and the decompressed data.
+ */
+struct SeekableZstdFrame
+{
+    size_t compressed_offset;
+    size_t compressed_size;
+    size_t decompressed_offset;
+    size_t decompressed_size;
+};
+
+/**
+ * @brief The SeekableZstdFile class Reader for files in the zstd seekable format: independent zstd frames followed by a seek table in a skippable frame.
+ * When the frames are aligned to element boundaries, every element can be decompressed on its own and in parallel.
+ */
+class SeekableZstdFile
+{
+    MappedFile file;
+    QList<SeekableZstdFrame> frames;
+
+    bool readSeekTable();
+    size_t findFrame(size_t decompressed_offset) const;
+    bool decompressFrame(const SeekableZstdFrame &frame, unsigned char *destination) const;
+
+public:
+    bool open(QString file_name);
+
+    size_t decompressedSize() const;
+    size_t numFrames() const;
+    bool isAlignedTo(size_t element_size) const;
+
+    bool readRange(size_t offset, size_t size, unsigned char *destination) const;
+    bool readElement(size_t element, size_t element_size, unsigned char *destination) const;
+    long readAll(unsigned char *destination, size_t size, const ProgressCallback &progress = nullptr) const;
+    long stream(const ByteSink &sink, const ProgressCallback &progress = nullptr) const;
+};
+
+#endif // SEEKABLE_ZSTD_H
@@ -1,10 +1,12 @@
 #include "ldg_ssm_interface.h"
 #include "./ui_ldg_ssm_interface.h"
 #include "QtGui/qevent.h"
-#include "input/data_buffer.h"
+#include "util/element_cache.h"
 #include "drawing/image_renderer.h"
 #include <QColorDialog>
+#include <QDir>
 #include <QFileDialog>
+#include <QFileInfo>
 #include <QMessageBox>
 #include <QWindow>
 #include <drawing/volume_raycaster.h>
@@ -34,10 +36,13 @@ LDGSSMInterface::LDGSSMInterface(QWidget *parent):
  */
 LDGSSMInterface::~LDGSSMInterface()
 {
+    delete dataset_loader;
     delete ui;
     delete render_view;
     delete scroll_area;
 
+    if (tree_properties != nullptr)
+        delete tree_properties->element_cache;
     delete tree_properties;
     delete volume_properties;
     delete window_properties;
@@ -45,33 +50,107 @@ LDGSSMInterface::~LDGSSMInterface()
 }
 
 /**
- * @brief LDGSSMInterface::openFile
+ * @brief LDGSSMInterface::openFile Start loading a dataset in the background. The current dataset stays interactive until the new one is loaded.
  */
 void LDGSSMInterface::openFile()
 {
     // Get the file
-    QString file_name = QFileDialog::getOpenFileName(this, tr("Select config"), "", tr("Config Files (*.json)"));
-    if (!readInput(file_name, *tree_properties)) {
+    QString file_name = QFileDialog::getOpenFileName(this, tr("Select config"), "", tr("Datasets (*.json *.ldgssm)"));
+    if (file_name.isEmpty())
+        return;
+
+    LoadingMode loading_mode = load_on_demand_action->isChecked() ? LoadingMode::LAZY : LoadingMode::EAGER;
+    dataset_loader->load(file_name, loading_mode, tree_properties->background_color);
+
+    progress_dialog->setWindowTitle("Opening " + QFileInfo(file_name).fileName());
+    progress_dialog->setValue(0);
+    progress_dialog->show();
+}
+
+/**
+ * @brief LDGSSMInterface::datasetLoaded Swap in the loaded dataset and initialize its renderer.
+ * @param is_loaded
+ * @param is_cancelled
+ */
+void LDGSSMInterface::datasetLoaded(bool is_loaded, bool is_cancelled)
+{
+    progress_dialog->hide();
+    if (is_cancelled)
+        return;
+
+    TreeDrawProperties *loaded_properties = dataset_loader->takeTreeProperties();
+    if (!is_loaded || loaded_properties == nullptr) {
         QMessageBox msg_box;
         msg_box.setText("The config couldn't be loaded.");
         msg_box.exec();
         return;
     }
+
+    // Replace the current dataset. The controllers and views keep pointing to the same properties.
+    render_view->deleteRenderer();
+    delete tree_properties->element_cache;
+    *tree_properties = std::move(*loaded_properties);
+    delete loaded_properties;
     is_ready = render_view != nullptr && scroll_area != nullptr && grid_controller != nullptr && tree_properties != nullptr && window_properties != nullptr && volume_properties != nullptr;
+    grid_controller->initializeCut();
 
     // Initialize renderer
-    render_view->deleteRenderer();
     scroll_area->fitWindow();
     if (tree_properties->draw_type == DrawType::IMAGE) {
-        render_view->setRenderer(new ImageRenderer(tree_properties, window_properties));
+        render_view->setRenderer(new ImageRenderer(tree_properties, window_properties, dataset_loader->takeAtlasContainer(), dataset_loader->takeAtlasTexture()));
     } else {
-        render_view->setRenderer(new VolumeRaycaster(tree_properties, window_properties, volume_properties));
+        render_view->setRenderer(new VolumeRaycaster(tree_properties, window_properties, volume_properties, dataset_loader->takeAtlasContainer(), dataset_loader->takeAtlasTexture(), dataset_loader->takeGradientTexture()));
     }
 
+    // The transfer function of the previous dataset is no longer watched. The new one is uploaded by the renderer that now exists.
+    if (!transfer_function_watcher->files().isEmpty())
+        transfer_function_watcher->removePaths(transfer_function_watcher->files());
+    loadTransferFunction();
+
     initializeUI();
     raise();
 }
 
+/**
+ * @brief LDGSSMInterface::loadTransferFunction Load the transfer function next to the config of the dataset, or the default one if there is none.
+ * Only the lookup table is uploaded again, the volumes stay in the atlas.
+ */
+void LDGSSMInterface::loadTransferFunction()
+{
+    if (tree_properties->draw_type != DrawType::VOLUME)
+        return;
+
+    TransferFunction transfer_function;
+    if (!tree_properties->source_files.isEmpty()) {
+        QString file_name = QFileInfo(tree_properties->source_files.first()).dir().filePath(TRANSFER_FUNCTION_FILE_NAME);
+        if (QFileInfo::exists(file_name) && !transfer_function.fromJSONFile(file_name)) {
+            qDebug() << "Transfer function" << file_name << "couldn't be read, using the default";
+            transfer_function = TransferFunction();
+        }
+
+        // Watch the file to apply edits. Editors that replace the file remove it from the watcher, so it's added again.
+        if (QFileInfo::exists(file_name) && !transfer_function_watcher->files().contains(file_name))
+            transfer_function_watcher->addPath(file_name);
+    }
+
+    volume_properties->transfer_function = std::move(transfer_function);
+    volume_properties->transfer_function_revision++;
+
+    if (is_ready)
+        render_view->updateUniforms();
+}
+
+/**
+ * @brief LDGSSMInterface::setPreIntegrated Toggle the pre-integrated transfer function for the accumulating render type.
+ * @param is_pre_integrated
+ */
+void LDGSSMInterface::setPreIntegrated(bool is_pre_integrated)
+{
+    volume_properties->is_pre_integrated = is_pre_integrated;
+    if (is_ready)
+        render_view->updateUniforms();
+}
+
 /**
  * @brief LDGSSMInterface::LDGSSMInterface Initialize the menus of the window.
  */
@@ -80,12 +159,18 @@ void LDGSSMInterface::initializeMenus()
     // Initialize the file menu shortcuts.
     file_menu = ui->menuFile;
     file_menu->addAction("Open", QKeySequence::Open, this, &LDGSSMInterface::openFile);
+    load_on_demand_action = file_menu->addAction("Load data on demand");
+    load_on_demand_action->setCheckable(true);
 
     // Initialize the view menu shortcuts.
     view_menu = ui->menuView;
     view_menu->addAction("Reset view", Qt::Key_R, this, &LDGSSMInterface::resetView);
     view_menu->addAction("Zoom in", QKeySequence::ZoomIn, scroll_area, &PannableScrollArea::zoomIn);
     view_menu->addAction("Zoom out", QKeySequence::ZoomOut, scroll_area, &PannableScrollArea::zoomOut);
+    view_menu->addSeparator();
+    pre_integrate_action = view_menu->addAction("Pre-integrate transfer function");
+    pre_integrate_action->setCheckable(true);
+    QObject::connect(pre_integrate_action, &QAction::toggled, this, &LDGSSMInterface::setPreIntegrated);
 }
 
 /**
@@ -163,6 +248,16 @@ void LDGSSMInterface::initializeModelController()
     grid_controller = new GridController(tree_properties, window_properties, volume_properties);
     screen_controller = new ScreenController(tree_properties, window_properties, volume_properties, grid_controller);
     render_view = new RenderView(scroll_area, tree_properties, window_properties);
+    dataset_loader = new DatasetLoader(render_view);
+
+    // Progress of loading a dataset, which doesn't block the current dataset.
+    progress_dialog = new QProgressDialog("Reading dataset", "Cancel", 0, 1000, this);
+    progress_dialog->setWindowModality(Qt::NonModal);
+    progress_dialog->setAutoClose(false);
+    progress_dialog->setAutoReset(false);
+    progress_dialog->reset();
+
+    transfer_function_watcher = new QFileSystemWatcher(this);
 
     scroll_area->intialize(window_properties, tree_properties, screen_controller);
     scroll_area->setWidget(render_view);
@@ -172,7 +267,12 @@ void LDGSSMInterface::initializeModelController()
     QObject::connect(screen_controller, &ScreenController::transformationChanged, render_view, &RenderView::updateUniforms);
     QObject::connect(window()->windowHandle(), &QWindow::screenChanged, scroll_area, &PannableScrollArea::screenChanged);
     QObject::connect(scroll_area, &PannableScrollArea::viewportSizeChanged, render_view, &RenderView::updateUniformsBuffers);
-    QObject::connect(scroll_area, &PannableScrollArea::viewportPositionChanged, render_view, &RenderView::updateUniforms);
+    QObject::connect(scroll_area, &PannableScrollArea::viewportPositionChanged, render_view, &RenderView::updateUniformsBuffers);
+    QObject::connect(dataset_loader, &DatasetLoader::phaseChanged, progress_dialog, &QProgressDialog::setLabelText);
+    QObject::connect(dataset_loader, &DatasetLoader::progressChanged, progress_dialog, &QProgressDialog::setValue);
+    QObject::connect(dataset_loader, &DatasetLoader::finished, this, &LDGSSMInterface::datasetLoaded);
+    QObject::connect(progress_dialog, &QProgressDialog::canceled, dataset_loader, &DatasetLoader::cancel);
+    QObject::connect(transfer_function_watcher, &QFileSystemWatcher::fileChanged, this, &LDGSSMInterface::loadTransferFunction);
 }
 
 /**
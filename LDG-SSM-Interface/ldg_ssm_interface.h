@@ -1,8 +1,11 @@
 #ifndef LDGSSMINTERFACE_H
 #define LDGSSMINTERFACE_H
 
+#include <QFileSystemWatcher>
 #include <QMainWindow>
+#include <QProgressDialog>
 
+#include "util/dataset_loader.h"
 #include "widgets/render_view.h"
 #include "widgets/pannable_scroll_area.h"
 
@@ -34,9 +37,14 @@ class LDGSSMInterface: public QMainWindow
     PannableScrollArea *scroll_area = nullptr;
     GridController *grid_controller = nullptr;
     ScreenController *screen_controller = nullptr;
+    DatasetLoader *dataset_loader = nullptr;
+    QProgressDialog *progress_dialog = nullptr;
+    QFileSystemWatcher *transfer_function_watcher = nullptr;
 
     QMenu *file_menu;
     QMenu *view_menu;
+    QAction *load_on_demand_action;
+    QAction *pre_integrate_action;
 
     void initializeMenus();
     void initializeUI();
@@ -48,7 +56,10 @@ public:
 
 public slots:
     void openFile();
+    void datasetLoaded(bool is_loaded, bool is_cancelled);
     void resetView();
+    void loadTransferFunction();
+    void setPreIntegrated(bool is_pre_integrated);
 
 private slots:
     void on_backgroundColorSelectButton_clicked();
@@ -1,11 +1,28 @@
 #include "ldg_ssm_interface.h"
+#include "input/dataset_container.h"
 
 #include <QApplication>
+#include <QCommandLineParser>
 
 int main(int argc, char *argv[])
 {
     QApplication a(argc, argv);
 
+    // Datasets can be converted to a container without opening the interface
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption convert_option("convert", "Convert the dataset with the given config into a dataset container and exit.", "config");
+    parser.addOption(convert_option);
+    parser.addPositionalArgument("container", "Path of the dataset container to write when converting.");
+    parser.process(a);
+
+    if (parser.isSet(convert_option)) {
+        auto arguments = parser.positionalArguments();
+        if (arguments.size() != 1)
+            parser.showHelp(1);
+        return convertToDatasetContainer(parser.value(convert_option), arguments.first()) ? 0 : 1;
+    }
+
     // Set surface format
     QSurfaceFormat glFormat;
     glFormat.setProfile(QSurfaceFormat::CoreProfile);
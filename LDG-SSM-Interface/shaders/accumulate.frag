@@ -29,6 +29,10 @@ struct BoundingBox {
 void findPosition(vec3 viewport, out BoundingBox bounding_box, out Ray ray);
 bool intersectBoundingBox(Ray ray, BoundingBox bounding_box, out float t_near, out float t_far);
 vec4 transferFunction(float value);
+vec4 transferFunctionSegment(float front_value, float back_value);
+bool isTransparent(vec2 range);
+vec2 brickRange(vec3 texture_coord_start, vec3 position);
+float skipBrick(vec3 position, vec3 direction, float t, float t_near, float t_step);
 
 /**
  * Correct opacity for the current sampling rate
@@ -44,13 +48,14 @@ float opacityCorrection(in float alpha, in float sample_ratio)
 /**
  * Accumulation composition
  *
+ * @param previous_value: value of the previous sample.
  * @param sample: current sample value.
  * @param samplingRatio: the ratio between current sampling rate and the original. (ray step)
  * @param composedColor: blended color (both input and output)
  */
-void accumulation(float value, float sample_ratio, inout vec4 composed_color)
+void accumulation(float previous_value, float value, float sample_ratio, inout vec4 composed_color)
 {
-    vec4 color = transferFunction(value);
+    vec4 color = transferFunctionSegment(previous_value, value);
     color.a = opacityCorrection(color.a, sample_ratio);
 
     composed_color += (1.0 - composed_color.a) * color * color.a;
@@ -71,19 +76,32 @@ void main(void)
         return;
     }
 
-    float t_step = (bounding_box.max.x - bounding_box.min.x) / num_samples;
+    // Step along the longest side of the box, so the number of samples doesn't depend on the shape of the volume.
+    vec3 box_size = bounding_box.max - bounding_box.min;
+    float t_step = max(max(box_size.x, box_size.y), box_size.z) / num_samples;
     vec4 final_color = vec4(0.0);
     // ratio between current sampling rate vs. the original sampling rate
     float sample_ratio = 1. / (num_samples * voxel_width);
 
     // Main raycasting loop
     float t = t_near;
+    float previous_value = -1.;
     while(t < t_far) {
         // Normalize texture coordinates based on volume
         vec3 pos = (ray.origin + t * ray.direction - bounding_box.min) / (bounding_box.max - bounding_box.min);
+
+        // Bricks where the transfer function is transparent don't add to the color
+        if (isTransparent(brickRange(texture_coord_start, pos))) {
+            t = skipBrick(pos, ray.direction / box_size, t, t_near, t_step);
+            previous_value = -1.;
+            continue;
+        }
+
         float value = texture(volume, texture_coord_start + pos * texture_coords_offset).r;
 
-        accumulation(value, sample_ratio, final_color);
+        // The first sample after entering or skipping has no segment before it
+        accumulation(previous_value < 0. ? value : previous_value, value, sample_ratio, final_color);
+        previous_value = value;
 
         // Early stoppping
         if (final_color.a >= 1.)
@@ -27,6 +27,8 @@ struct BoundingBox {
 void findPosition(vec3 viewport, out BoundingBox bounding_box, out Ray ray);
 bool intersectBoundingBox(Ray ray, BoundingBox bounding_box, out float t_near, out float t_far);
 vec4 transferFunction(float value);
+vec2 brickRange(vec3 texture_coord_start, vec3 position);
+float skipBrick(vec3 position, vec3 direction, float t, float t_near, float t_step);
 
 
 // Main raycasting loop
@@ -43,7 +45,9 @@ void main(void)
         return;
     }
 
-    float t_step = (bounding_box.max.x - bounding_box.min.x) / num_samples;
+    // Step along the longest side of the box, so the number of samples doesn't depend on the shape of the volume.
+    vec3 box_size = bounding_box.max - bounding_box.min;
+    float t_step = max(max(box_size.x, box_size.y), box_size.z) / num_samples;
     vec4 final_color = vec4(0.0);
 
     // Main raycasting loop
@@ -53,6 +57,15 @@ void main(void)
     while(t < t_far) {
         // Normalize texture coordinates based on volume
         vec3 pos = (ray.origin + t * ray.direction - bounding_box.min) / (bounding_box.max - bounding_box.min);
+
+        // Empty bricks only add samples of 0, so they are counted without sampling them
+        if (brickRange(texture_coord_start, pos).y <= 0.) {
+            float t_next = skipBrick(pos, ray.direction / box_size, t, t_near, t_step);
+            count += int(ceil((min(t_next, t_far) - t) / t_step - 1e-3));
+            t = t_next;
+            continue;
+        }
+
         float value = texture(volume, texture_coord_start + pos * texture_coords_offset).r;
 
         accumulated_intensities += value;
@@ -1,11 +1,12 @@
 #version 410
 
 layout(location = 0) in vec3 vertex_tex_coord;
+layout(location = 1) flat in float vertex_level_of_detail;
 uniform sampler2DArray node_textures;
 
 layout(location = 0) out vec4 frag_color;
 
 void main(void)
 {
-    frag_color = texture(node_textures, vertex_tex_coord);
+    frag_color = textureLod(node_textures, vertex_tex_coord, vertex_level_of_detail);
 }
@@ -1,24 +1,44 @@
 #version 410
 
-layout(location = 0) in vec3 vert_coord;
+layout(location = 0) in vec3 vert_coord;                // Unit plane
 layout(location = 1) in vec3 tex_coord;
-layout(location = 2) in vec3 tex_coord_origin;          // Instanced
-layout(location = 3) in mat4 instance_transformation;   // Instanced
+layout(location = 2) in uvec4 instance_node;            // Instanced: column, row, height and whether it's drawn
+layout(location = 3) in uint instance_element;          // Instanced
 
 uniform vec2 screen_origin;
 uniform vec3 screen_space_projection;
 uniform mat4 projection_matrix;
+uniform float node_lens[32];                            // Side length in pixels of the nodes at each height
+uniform float node_spacing;                             // Space in pixels between neighbouring nodes
+uniform vec3 element_shape;                             // Part of the node covered by the image
+uniform vec2 element_size;                              // Size of the images in texels
+uniform float max_level;                                // Coarsest mip level of the atlas
+uniform sampler2D page_table;                           // Origin of the block of every element in the atlas
 
 layout(location = 0) out vec3 vertex_tex_coord;
+layout(location = 1) flat out float vertex_level_of_detail;
 
 // Project a vector from screen space to world space
 vec4 project(vec3 vector)
 {
-    return vec4(screen_space_projection, 1.) * (instance_transformation * vec4(vector, 1.) + vec4(screen_origin, 0., 0.)) - vec4(1., 1., 0., 0.);
+    return vec4(screen_space_projection, 1.) * (vec4(vector, 1.) + vec4(screen_origin, 0., 0.)) - vec4(1., 1., 0., 0.);
 }
 
 void main(void)
 {
-    gl_Position = projection_matrix * project(vert_coord);
-    vertex_tex_coord = tex_coord_origin + tex_coord;
+    uint page_table_width = uint(textureSize(page_table, 0).x);
+    vec4 page = texelFetch(page_table, ivec2(int(instance_element % page_table_width), int(instance_element / page_table_width)), 0);
+
+    // Images are centered in their cell, scaled down to their shape.
+    float side_len = node_lens[instance_node.z];
+    vec2 size = side_len * element_shape.xy;
+    vec2 origin = vec2(instance_node.xy) * (side_len + node_spacing) + (side_len - size) / 2.;
+    vec3 position = vec3(origin, 0.) + vert_coord * vec3(size, 1.);
+
+    // Free instances are collapsed, leaving the background
+    gl_Position = instance_node.w > 0u ? projection_matrix * project(position) : vec4(0.);
+    vertex_tex_coord = page.xyz + tex_coord;
+
+    // Pick the level with about a texel per pixel, from the on-screen width of the image
+    vertex_level_of_detail = clamp(log2(element_size.x / max(size.x, 1.)), 0., max_level);
 }
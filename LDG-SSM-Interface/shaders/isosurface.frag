@@ -7,6 +7,9 @@ flat in vec3 texture_coord_start;
 flat in vec3 viewport;
 
 uniform sampler3D volume;
+uniform sampler3D gradients;        // Differences of the values around every voxel, laid out like the atlas
+uniform bool has_gradients;
+uniform vec3 voxel_size;            // Size of a voxel relative to the volume
 
 uniform mat4 model_view_matrix;
 
@@ -33,16 +36,29 @@ struct BoundingBox {
 void findPosition(vec3 viewport, out BoundingBox bounding_box, out Ray ray);
 bool intersectBoundingBox(Ray ray, BoundingBox bounding_box, out float t_near, out float t_far);
 vec4 transferFunction(float value);
+vec2 brickRange(vec3 texture_coord_start, vec3 position);
+float skipBrick(vec3 position, vec3 direction, float t, float t_near, float t_step);
 
 
-// Estimate the normal from a finite difference approximation of the gradient
-vec3 normal(vec3 position, float intensity, float step_length)
+// Find the normal from the central differences of the values around a position, which span two voxels along each axis.
+// These are precomputed for the atlas, and only estimated here when there are none.
+// The differences are per voxel, so they're scaled by the size of a voxel in the box along each axis.
+vec3 normal(vec3 position, vec3 box_size)
 {
-    float d = step_length;
-    float dx = texture(volume, texture_coord_start + (position + vec3(d, 0, 0)) * texture_coords_offset).r - intensity;
-    float dy = texture(volume, texture_coord_start + (position + vec3(0, d, 0)) * texture_coords_offset).r - intensity;
-    float dz = texture(volume, texture_coord_start + (position + vec3(0, 0, d)) * texture_coords_offset).r - intensity;
-    return -normalize(vec3(dx, dy, dz));
+    vec3 differences;
+    if (has_gradients) {
+        differences = texture(gradients, texture_coord_start + position * texture_coords_offset).rgb * 1023. - 512.;
+    } else {
+        vec3 dx = vec3(voxel_size.x, 0., 0.);
+        vec3 dy = vec3(0., voxel_size.y, 0.);
+        vec3 dz = vec3(0., 0., voxel_size.z);
+        differences = vec3(
+            texture(volume, texture_coord_start + (position + dx) * texture_coords_offset).r - texture(volume, texture_coord_start + (position - dx) * texture_coords_offset).r,
+            texture(volume, texture_coord_start + (position + dy) * texture_coords_offset).r - texture(volume, texture_coord_start + (position - dy) * texture_coords_offset).r,
+            texture(volume, texture_coord_start + (position + dz) * texture_coords_offset).r - texture(volume, texture_coord_start + (position - dz) * texture_coords_offset).r
+        );
+    }
+    return -normalize(differences / (voxel_size * box_size));
 }
 
 // Main raycasting loop
@@ -59,7 +75,9 @@ void main(void)
         return;
     }
 
-    float t_step = (bounding_box.max.x - bounding_box.min.x) / num_samples;
+    // Step along the longest side of the box, so the number of samples doesn't depend on the shape of the volume.
+    vec3 box_size = bounding_box.max - bounding_box.min;
+    float t_step = max(max(box_size.x, box_size.y), box_size.z) / num_samples;
     vec4 final_color = vec4(background_color, 1.);
 
     // Main raycasting loop
@@ -67,12 +85,18 @@ void main(void)
     while(t < t_far) {
         // Normalize texture coordinates based on volume
         vec3 pos = (ray.origin + t * ray.direction - bounding_box.min) / (bounding_box.max - bounding_box.min);
-        float value = texture(volume, texture_coord_start + pos * texture_coords_offset).r;
 
+        // Bricks entirely below the threshold can't contain the surface
+        if (brickRange(texture_coord_start, pos).y <= threshold) {
+            t = skipBrick(pos, ray.direction / box_size, t, t_near, t_step);
+            continue;
+        }
+
+        float value = texture(volume, texture_coord_start + pos * texture_coords_offset).r;
         if (value > threshold) {
             vec3 L = normalize(vec3(model_view_matrix * vec4(light_position, 1.)) - pos);
             vec3 V = -normalize(ray.direction);
-            vec3 N = normal(pos, value, t_step);
+            vec3 N = normal(pos, box_size);
             vec3 H = normalize(L + V);
 
             // Blinn-Phong shading
@@ -27,6 +27,8 @@ struct BoundingBox {
 void findPosition(vec3 viewport, out BoundingBox bounding_box, out Ray ray);
 bool intersectBoundingBox(Ray ray, BoundingBox bounding_box, out float t_near, out float t_far);
 vec4 transferFunction(float value);
+vec2 brickRange(vec3 texture_coord_start, vec3 position);
+float skipBrick(vec3 position, vec3 direction, float t, float t_near, float t_step);
 
 
 // Main raycasting loop
@@ -43,7 +45,9 @@ void main(void)
         return;
     }
 
-    float t_step = (bounding_box.max.x - bounding_box.min.x) / num_samples;
+    // Step along the longest side of the box, so the number of samples doesn't depend on the shape of the volume.
+    vec3 box_size = bounding_box.max - bounding_box.min;
+    float t_step = max(max(box_size.x, box_size.y), box_size.z) / num_samples;
     vec4 final_color = vec4(0.0);
 
     // Main raycasting loop
@@ -52,6 +56,13 @@ void main(void)
     while(t < t_far) {
         // Normalize texture coordinates based on volume
         vec3 pos = (ray.origin + t * ray.direction - bounding_box.min) / (bounding_box.max - bounding_box.min);
+
+        // Bricks that can't exceed the current maximum don't change it
+        if (brickRange(texture_coord_start, pos).y <= maximum_intensity) {
+            t = skipBrick(pos, ray.direction / box_size, t, t_near, t_step);
+            continue;
+        }
+
         float value = texture(volume, texture_coord_start + pos * texture_coords_offset).r;
         if (value > maximum_intensity) {
             maximum_intensity = value;
@@ -9,6 +9,14 @@ uniform vec3 color_2;
 uniform mat4 model_view_matrix;
 uniform mat3 input_bounding_box;
 
+uniform sampler1D transfer_function;                    // RGBA of every voxel value
+uniform sampler1D opacity_sums;                         // Sum of the opacities of all voxel values before every voxel value
+uniform sampler2D pre_integrated_transfer_function;     // Transfer function averaged between every [front, back] pair of voxel values
+uniform bool is_pre_integrated;
+
+uniform sampler3D occupancy;                            // [min, max] value of every brick of the volumes, laid out like the atlas
+uniform vec3 brick_size;                                // Size of a brick relative to the volume
+
 // Ray
 struct Ray {
     vec3 origin;
@@ -21,38 +29,91 @@ struct BoundingBox {
     vec3 max;
 };
 
+/**
+ * Finds the texture coordinate of the entry of a value in a lookup table, which has an entry for every voxel value.
+ *
+ * @param value The sample value
+ * @return The texture coordinate of the center of its entry
+ */
+float tableCoord(float value)
+{
+    return (value * 255. + 0.5) / 256.;
+}
+
 /**
  * Evaluates the transfer function for a given sample value
- * TODO: Make interactive in some way
  *
  * @param value The sample value
  * @return The color for the given sample value
  */
 vec4 transferFunction(float value)
 {
-    vec4 color = vec4(0.);
-
-    if (value >= 0.0 && value < 0.1) color = vec4(0.19483, 0.08339, 0.26149, value * 0.05);
-
-    if (value >= 0.1 && value < 0.2) color = vec4(0.27648, 0.48144, 0.95064, value * 0.05);
-
-    if (value >= 0.2 && value < 0.3) color = vec4(0.96187, 0.41093, 0.09310, value * 0.05);
-
-    if (value >= 0.3 && value < 0.4) color = vec4(0.49321, 0.01963, 0.00955, value * 0.05);
-
-    if (value >= 0.4 && value < 0.5) color = vec4(0.11167, 0.80569, 0.84525, value * 0.05);
-
-    if (value >= 0.5 && value < 0.6) color = vec4(0.12733, 0.91701, 0.67627, value * 0.05);
+    return texture(transfer_function, tableCoord(value));
+}
 
-    if (value >= 0.6 && value < 0.7) color = vec4(0.63323, 0.99195, 0.23937, value * 0.05);
+/**
+ * Evaluates the transfer function for the segment of a ray between two samples.
+ * When pre-integrated, this is the transfer function averaged over all values between the samples.
+ *
+ * @param front_value The value of the previous sample
+ * @param back_value The value of the current sample
+ * @return The color of the segment
+ */
+vec4 transferFunctionSegment(float front_value, float back_value)
+{
+    if (!is_pre_integrated)
+        return transferFunction(back_value);
+    return texture(pre_integrated_transfer_function, vec2(tableCoord(front_value), tableCoord(back_value)));
+}
 
-    if (value >= 0.7 && value < 0.8) color = vec4(0.99438, 0.66386, 0.19971, value * 0.05);
+/**
+ * Whether the transfer function is fully transparent for every value in a range.
+ *
+ * @param range The [min, max] range of values
+ * @return True if no value in the range is visible
+ */
+bool isTransparent(vec2 range)
+{
+    int first = int(floor(clamp(range.x, 0., 1.) * 255.));
+    int last = int(ceil(clamp(range.y, 0., 1.) * 255.));
+    return texelFetch(opacity_sums, last + 1, 0).r - texelFetch(opacity_sums, first, 0).r <= 0.;
+}
 
-    if (value >= 0.8 && value < 0.9) color = vec4(0.86079, 0.22945, 0.02875, value * 0.05);
+/**
+ * Looks up the range of values of the brick of a volume containing a position.
+ * The bricks of a volume start at the same texture coordinates as the volume itself.
+ *
+ * @param texture_coord_start Origin of the volume in the atlas
+ * @param position Position relative to the volume
+ * @return The [min, max] range of values in the brick, including the voxels interpolated with it
+ */
+vec2 brickRange(vec3 texture_coord_start, vec3 position)
+{
+    ivec3 block_origin = ivec3(round(texture_coord_start * vec3(textureSize(occupancy, 0))));
+    ivec3 brick = ivec3(clamp(position, 0., 1. - 1e-6) / brick_size);
+    return texelFetch(occupancy, block_origin + brick, 0).rg;
+}
 
-    if (value >= 0.9 && value < 1.0) color = vec4(0.57103, 0.04474, 0.00529, value * 0.05);
+/**
+ * Advances a ray past the brick containing a position, to the first sample after it.
+ * Samples stay at the same multiples of the step size from the entry of the ray, so skipping bricks doesn't change them.
+ *
+ * @param position Position relative to the volume
+ * @param direction Direction of the ray relative to the volume
+ * @param t Current distance along the ray
+ * @param t_near Entry of the ray into the volume
+ * @param t_step Distance between samples
+ * @return The distance of the next sample outside the brick
+ */
+float skipBrick(vec3 position, vec3 direction, float t, float t_near, float t_step)
+{
+    vec3 brick_min = floor(clamp(position, 0., 1. - 1e-6) / brick_size) * brick_size;
+    vec3 boundary = mix(brick_min, brick_min + brick_size, greaterThan(direction, vec3(0.)));
+    vec3 t_exit = mix((boundary - position) / direction, vec3(1e30), equal(direction, vec3(0.)));
+    float t_brick = t + min(min(t_exit.x, t_exit.y), t_exit.z);
 
-    return color;
+    float step_index = floor((t - t_near) / t_step + 0.5);
+    return t_near + max(ceil((t_brick - t_near) / t_step), step_index + 1.) * t_step;
 }
 
 /**
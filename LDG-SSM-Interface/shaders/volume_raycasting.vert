@@ -1,13 +1,16 @@
 #version 410
 
-layout(location = 0) in vec3 vert_coord;
-layout(location = 1) in vec3 input_viewport;
-layout(location = 2) in vec3 input_texture_coord_start;
-layout(location = 3) in mat4 instance_transformation;
+layout(location = 0) in vec3 vert_coord;        // Unit cube
+layout(location = 1) in uvec4 input_node;      // Column, row, height and whether it's drawn
+layout(location = 2) in uint input_element;
 
 uniform vec2 screen_origin;
 uniform vec3 screen_space_projection;
 uniform mat4 projection_matrix;
+uniform float base_side_len;                    // Side length in pixels of the nodes at the top of the tree, which is the depth of every cube
+uniform float node_lens[32];                    // Side length in pixels of the nodes at each height
+uniform float node_spacing;                     // Space in pixels between neighbouring nodes
+uniform sampler2D page_table;                   // Origin of the block of every element in the atlas, with w set if it's resident
 
 flat out vec3 texture_coord_start;
 flat out vec3 viewport;
@@ -15,12 +18,23 @@ flat out vec3 viewport;
 // Project a vector from screen space to world space
 vec4 project(vec3 vector)
 {
-    return vec4(screen_space_projection, 1.) * (instance_transformation * vec4(vector, 1.) + vec4(screen_origin, 0., 0.)) - vec4(1., 1., 0., 0.);
+    return vec4(screen_space_projection, 1.) * (vec4(vector, 1.) + vec4(screen_origin, 0., 0.)) - vec4(1., 1., 0., 0.);
 }
 
 void main(void)
 {
-    texture_coord_start = input_texture_coord_start;
-    viewport = input_viewport + vec3(screen_origin, 0.);
-    gl_Position = projection_matrix * project(vert_coord);
+    uint page_table_width = uint(textureSize(page_table, 0).x);
+    vec4 page = texelFetch(page_table, ivec2(int(input_element % page_table_width), int(input_element / page_table_width)), 0);
+
+    // We remove 4 pixels from each side of the cell to deal with overdraw of the overlay.
+    float side_len = node_lens[input_node.z];
+    vec2 origin = vec2(input_node.xy) * (side_len + node_spacing) + 4.;
+    vec3 position = vec3(origin, 0.) + vert_coord * vec3(side_len - 8., side_len - 8., base_side_len);
+
+    // Viewport consists of the origin and side length
+    texture_coord_start = page.xyz;
+    viewport = vec3(origin + screen_origin, side_len);
+
+    // Free instances and volumes that are not in the atlas are collapsed, leaving the background
+    gl_Position = input_node.w > 0u && page.w > 0. ? projection_matrix * project(position) : vec4(0.);
 }
@@ -0,0 +1,253 @@
+#include "util/atlas_cache.h"
+#include "input/dataset_container.h"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QStandardPaths>
+#include <cstring>
+#include <vector>
+
+const qint64 ATLAS_CACHE_MAX_HASHED_FILE_SIZE = 1 << 20;    // Files up to this size, like the configurations, are hashed by their contents.
+
+/**
+ * @brief atlasCacheDirectory
+ * @return Directory holding the cached atlasses, or an empty string if there is no cache location.
+ */
+QString atlasCacheDirectory()
+{
+    QString cache_location = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+    if (cache_location.isEmpty())
+        return QString();
+    return cache_location + "/atlasses";
+}
+
+/**
+ * @brief atlasCacheFileName Determine the cache file of the atlas of a dataset.
+ * The key covers everything the atlas is built from: the source files, the background color and the maximum texture size.
+ * Small files are hashed by their contents, large data files by their size and modification time.
+ * @param draw_properties
+ * @param max_texture_dim
+ * @return File name of the cached atlas, or an empty string if the atlas can't be cached.
+ */
+QString atlasCacheFileName(const TreeDrawProperties *draw_properties, size_t max_texture_dim)
+{
+    QString cache_directory = atlasCacheDirectory();
+    if (cache_directory.isEmpty() || draw_properties->source_files.isEmpty())
+        return QString();
+
+    QCryptographicHash hash(QCryptographicHash::Sha256);
+    auto addValue = [&](auto value) {
+        hash.addData(QByteArrayView(reinterpret_cast<const char *>(&value), sizeof(value)));
+    };
+
+    addValue(ATLAS_CACHE_VERSION);
+    addValue(static_cast<uint64_t>(draw_properties->draw_type));
+    addValue(static_cast<uint64_t>(max_texture_dim));
+    addValue(draw_properties->background_color.x());
+    addValue(draw_properties->background_color.y());
+    addValue(draw_properties->background_color.z());
+
+    for (const QString &source_file : draw_properties->source_files) {
+        QFileInfo file_info(source_file);
+        if (!file_info.exists())
+            return QString();
+
+        hash.addData(file_info.absoluteFilePath().toUtf8());
+        addValue(static_cast<int64_t>(file_info.size()));
+        addValue(static_cast<int64_t>(file_info.lastModified().toMSecsSinceEpoch()));
+
+        if (file_info.size() <= ATLAS_CACHE_MAX_HASHED_FILE_SIZE) {
+            QFile file(source_file);
+            if (!file.open(QIODevice::ReadOnly))
+                return QString();
+            hash.addData(file.readAll());
+        }
+    }
+
+    return cache_directory + "/" + QString::fromLatin1(hash.result().toHex()) + ATLAS_CACHE_EXTENSION;
+}
+
+/**
+ * @brief readAtlasCache Read a cached atlas. The payload is mapped, so it's uploaded straight from the file.
+ * The data of the container stays empty, every page of the atlas is found at page * container.pageSize() in the payload.
+ * @param file_name
+ * @param num_elements Number of elements of the dataset. Entries of other elements make the cached atlas invalid.
+ * @param container Receives the layout of the atlas.
+ * @param mapping Receives the mapped file, which should be kept alive while the payload is used.
+ * @param payload Receives the start of the atlas data.
+ * @return True if the cached atlas is valid.
+ */
+bool readAtlasCache(QString file_name, size_t num_elements, AtlasContainer &container, std::shared_ptr<MappedFile> &mapping, const unsigned char *&payload)
+{
+    if (file_name.isEmpty() || !QFile::exists(file_name))
+        return false;
+
+    auto cache_mapping = std::make_shared<MappedFile>();
+    if (!cache_mapping->open(file_name))
+        return false;
+
+    // Validate the header
+    const unsigned char *data = cache_mapping->data();
+    size_t size = cache_mapping->size();
+    if (size < sizeof(AtlasCacheHeader)) {
+        qDebug() << "File is too small to be a cached atlas: " << file_name;
+        return false;
+    }
+
+    AtlasCacheHeader header;
+    std::memcpy(&header, data, sizeof(AtlasCacheHeader));
+    if (std::memcmp(header.magic, ATLAS_CACHE_MAGIC, sizeof(header.magic)) != 0 || header.version != ATLAS_CACHE_VERSION) {
+        qDebug() << "File is not a supported cached atlas: " << file_name;
+        return false;
+    }
+
+    AtlasContainer cached_container;
+    cached_container.dims = { header.dims[0], header.dims[1], header.dims[2] };
+    cached_container.block_dims = { header.block_dims[0], header.block_dims[1], header.block_dims[2] };
+    cached_container.gutter = header.gutter;
+    cached_container.num_levels = header.num_levels;
+    cached_container.draw_type = static_cast<DrawType>(header.draw_type);
+    cached_container.coord_offsets = QVector3D(header.coord_offsets[0], header.coord_offsets[1], header.coord_offsets[2]);
+
+    if (
+        header.block_dims[0] == 0 || header.block_dims[1] == 0 || header.block_dims[2] == 0 ||
+        header.num_levels == 0 || header.num_levels > ATLAS_MAX_MIP_LEVELS ||
+        header.entries_offset > header.payload_offset ||
+        header.num_entries > (header.payload_offset - header.entries_offset) / sizeof(AtlasCacheEntry) ||
+        header.payload_offset % ATLAS_CACHE_PAGE_SIZE != 0 ||
+        header.payload_size != cached_container.numPages() * cached_container.pageSize() ||
+        header.payload_offset > size || header.payload_size > size - header.payload_offset
+    ) {
+        qDebug() << "Cached atlas has an invalid layout: " << file_name;
+        return false;
+    }
+
+    // Entries
+    size_t num_slots = cached_container.numPages() * cached_container.blocksPerPage();
+    for (size_t idx = 0; idx < header.num_entries; ++idx) {
+        AtlasCacheEntry entry;
+        std::memcpy(&entry, data + header.entries_offset + idx * sizeof(AtlasCacheEntry), sizeof(AtlasCacheEntry));
+        if (entry.slot >= num_slots || entry.element >= num_elements) {
+            qDebug() << "Cached atlas has an invalid block: " << file_name;
+            return false;
+        }
+        cached_container.element_slots.insert(entry.element, entry.slot);
+        cached_container.mapping.insert(entry.element, QVector3D(entry.mapping[0], entry.mapping[1], entry.mapping[2]));
+    }
+
+    // The whole payload is uploaded right away, and the access time is kept for evicting the least recently used atlasses.
+    cache_mapping->advise(MappingAdvice::WILL_NEED, header.payload_offset, header.payload_size);
+    QFile cache_file(file_name);
+    if (cache_file.open(QIODevice::ReadWrite))
+        cache_file.setFileTime(QDateTime::currentDateTime(), QFileDevice::FileModificationTime);
+
+    container = std::move(cached_container);
+    payload = data + header.payload_offset;
+    mapping = std::move(cache_mapping);
+    return true;
+}
+
+/**
+ * @brief writeAtlasCache Write a built atlas to the cache. It's written to a temporary file first, so an interrupted write never leaves a partial atlas behind.
+ * @param file_name
+ * @param container Atlas including its data.
+ * @param progress Optional callback receiving the progress of writing the pages.
+ * @return True if the atlas was written.
+ */
+bool writeAtlasCache(QString file_name, const AtlasContainer &container, const ProgressCallback &progress)
+{
+    size_t num_pages = container.numPages();
+    size_t page_size = container.pageSize();
+    if (file_name.isEmpty() || static_cast<size_t>(container.data.size()) != num_pages * page_size)
+        return false;
+
+    QDir().mkpath(QFileInfo(file_name).absolutePath());
+    QString temporary_file_name = file_name + ".tmp";
+    QFile file(temporary_file_name);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qDebug() << "Could not open file for writing: " << temporary_file_name;
+        return false;
+    }
+
+    // Determine the layout
+    AtlasCacheHeader header;
+    std::memcpy(header.magic, ATLAS_CACHE_MAGIC, sizeof(header.magic));
+    header.version = ATLAS_CACHE_VERSION;
+    header.draw_type = static_cast<uint64_t>(container.draw_type);
+    header.dims[0] = container.dims[0];
+    header.dims[1] = container.dims[1];
+    header.dims[2] = container.dims[2];
+    header.block_dims[0] = container.block_dims[0];
+    header.block_dims[1] = container.block_dims[1];
+    header.block_dims[2] = container.block_dims[2];
+    header.gutter = container.gutter;
+    header.num_levels = container.num_levels;
+    header.coord_offsets[0] = container.coord_offsets.x();
+    header.coord_offsets[1] = container.coord_offsets.y();
+    header.coord_offsets[2] = container.coord_offsets.z();
+    header.num_entries = container.element_slots.size();
+    header.entries_offset = sizeof(AtlasCacheHeader);
+    header.payload_offset = alignTo(header.entries_offset + header.num_entries * sizeof(AtlasCacheEntry), ATLAS_CACHE_PAGE_SIZE);
+    header.payload_size = num_pages * page_size;
+
+    std::vector<AtlasCacheEntry> entries;
+    entries.reserve(header.num_entries);
+    for (auto it = container.element_slots.constBegin(); it != container.element_slots.constEnd(); ++it) {
+        QVector3D origin = container.mapping.value(it.key());
+        entries.push_back({ it.key(), it.value(), { origin.x(), origin.y(), origin.z() }, 0.f });
+    }
+
+    std::vector<char> padding(ATLAS_CACHE_PAGE_SIZE, 0);
+    bool is_written =
+        file.write(reinterpret_cast<const char *>(&header), sizeof(header)) == sizeof(header) &&
+        file.write(reinterpret_cast<const char *>(entries.data()), entries.size() * sizeof(AtlasCacheEntry)) == static_cast<qint64>(entries.size() * sizeof(AtlasCacheEntry)) &&
+        file.write(padding.data(), header.payload_offset - file.pos()) >= 0;
+
+    // Payload, written per page so a cancelled write stops quickly.
+    for (size_t page = 0; is_written && page < num_pages; ++page) {
+        is_written = file.write(reinterpret_cast<const char *>(container.data.constData() + page * page_size), page_size) == static_cast<qint64>(page_size);
+        if (progress && !progress(page + 1, num_pages))
+            is_written = false;
+    }
+
+    if (!is_written || !file.flush()) {
+        file.close();
+        file.remove();
+        return false;
+    }
+    file.close();
+
+    QFile::remove(file_name);
+    if (!QFile::rename(temporary_file_name, file_name)) {
+        qDebug() << "Could not move cached atlas into place: " << file_name;
+        QFile::remove(temporary_file_name);
+        return false;
+    }
+
+    pruneAtlasCache();
+    return true;
+}
+
+/**
+ * @brief pruneAtlasCache Remove the least recently used atlasses until the cache fits in the given size.
+ * @param max_bytes
+ */
+void pruneAtlasCache(size_t max_bytes)
+{
+    QString cache_directory = atlasCacheDirectory();
+    if (cache_directory.isEmpty())
+        return;
+
+    // Newest first, so everything past the budget is removed.
+    QFileInfoList cached_files = QDir(cache_directory).entryInfoList({ "*" + ATLAS_CACHE_EXTENSION }, QDir::Files, QDir::Time);
+    size_t total_size = 0;
+    for (const QFileInfo &file_info : cached_files) {
+        total_size += file_info.size();
+        if (total_size > max_bytes)
+            QFile::remove(file_info.absoluteFilePath());
+    }
+}
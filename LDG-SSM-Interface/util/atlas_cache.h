@@ -0,0 +1,62 @@
+#ifndef ATLAS_CACHE_H
+#define ATLAS_CACHE_H
+
+#include "input/mapped_file.h"
+#include "util/atlas_container.h"
+#include "util/progress.h"
+
+#include <QString>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+const char ATLAS_CACHE_MAGIC[8] = { 'L', 'D', 'G', 'A', 'T', 'L', 'S', '\0' };
+const uint64_t ATLAS_CACHE_VERSION = 3;
+const QString ATLAS_CACHE_EXTENSION = ".ldgatlas";
+const size_t ATLAS_CACHE_PAGE_SIZE = 4096;                  // Alignment of the payload, so it can be mapped directly.
+const size_t ATLAS_CACHE_SIZE = size_t(32) << 30;           // Maximum number of bytes of cached atlasses, the least recently used are removed first.
+
+/**
+ * @brief The AtlasCacheHeader struct Header at the start of a cached atlas. All values are stored little endian.
+ *
+ * The header is followed by the entry of every element in the atlas and finally the page aligned texel payload, which is the atlas data as uploaded.
+ */
+struct AtlasCacheHeader
+{
+    char magic[8];
+    uint64_t version;
+    uint64_t draw_type;
+    uint64_t dims[3];
+    uint64_t block_dims[3];
+    uint64_t gutter;
+    uint64_t num_levels;
+    double coord_offsets[3];
+    uint64_t num_entries;
+    uint64_t entries_offset;
+    uint64_t payload_offset;
+    uint64_t payload_size;
+};
+
+/**
+ * @brief The AtlasCacheEntry struct Block of a single element in the atlas.
+ */
+struct AtlasCacheEntry
+{
+    uint64_t element;
+    uint64_t slot;
+    float mapping[3];           // [u, v, w] origin of the block.
+    float padding;
+};
+
+static_assert(sizeof(AtlasCacheHeader) == 144, "Atlas cache header should not contain padding");
+static_assert(sizeof(AtlasCacheEntry) == 32, "Atlas cache entry should not contain padding");
+
+QString atlasCacheFileName(const TreeDrawProperties *draw_properties, size_t max_texture_dim);
+
+bool readAtlasCache(QString file_name, size_t num_elements, AtlasContainer &container, std::shared_ptr<MappedFile> &mapping, const unsigned char *&payload);
+
+bool writeAtlasCache(QString file_name, const AtlasContainer &container, const ProgressCallback &progress = nullptr);
+
+void pruneAtlasCache(size_t max_bytes = ATLAS_CACHE_SIZE);
+
+#endif // ATLAS_CACHE_H
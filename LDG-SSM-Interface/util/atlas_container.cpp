@@ -1,178 +1,774 @@
 #include "atlas_container.h"
+#include "util/element_cache.h"
+#include "util/image_blend.h"
+#include "util/parallel.h"
+
 #include <QElapsedTimer>
-#include <QPainter>
+#include <algorithm>
+#include <cstring>
 
 /**
- * @brief determineAtlasDims Determine the size of the atlas to be generated. For every image/volume, we allocate a square of max_dim dims.
- * The layout priority is x -> y -> z, so if the data is too large it will overflow in the z-direction.
- * @param draw_properties
- * @param max_texture_dim
- * @return [x, y, z] dims of the atlas along with the block size.
+ * @brief AtlasContainer::blockOrigin Get the origin of a block in texels. For image atlasses, z is the index of the atlas.
+ * @param slot
+ * @return [x, y, z] origin of the block.
  */
-QPair<std::array<size_t, 3>, size_t> determineAtlasDims(TreeDrawProperties *draw_properties, double max_texture_dim)
+std::array<size_t, 3> AtlasContainer::blockOrigin(size_t slot) const
 {
-    auto [x_dim, y_dim, z_dim] = draw_properties->data_dims;
-    double max_dim = std::max(std::max(x_dim, y_dim), std::max(x_dim, z_dim));
-    double num_elements = draw_properties->data->size();
+    size_t blocks_per_row = dims[0] / block_dims[0];
+    size_t blocks_per_layer = blocksPerPage();
+    size_t layer = slot / blocks_per_layer;
+    return {
+        (slot % blocks_per_row) * block_dims[0],
+        ((slot % blocks_per_layer) / blocks_per_row) * block_dims[1],
+        draw_type == DrawType::IMAGE ? layer : layer * block_dims[2]
+    };
+}
 
-    double elements_per_dim = std::floor(max_texture_dim / max_dim);
-    double num_rows = std::ceil(num_elements / elements_per_dim);
-    double depth = std::ceil(num_rows / elements_per_dim);
+/**
+ * @brief AtlasContainer::blockCoords Get the origin of the element in a block as texture coordinates, skipping the gutter of images.
+ * @param slot
+ * @return [u, v, w] origin, where w is the index of the atlas for image atlasses.
+ */
+QVector3D AtlasContainer::blockCoords(size_t slot) const
+{
+    auto [x, y, z] = blockOrigin(slot);
+    return QVector3D{
+        static_cast<float>(x + gutter) / static_cast<float>(dims[0]),
+        static_cast<float>(y + gutter) / static_cast<float>(dims[1]),
+        draw_type == DrawType::IMAGE ? static_cast<float>(z) : static_cast<float>(z) / static_cast<float>(dims[2])
+    };
+}
+
+/**
+ * @brief AtlasContainer::blocksPerPage
+ * @return Number of blocks in a page, which is an image atlas or a slab of volume blocks in a single layer.
+ */
+size_t AtlasContainer::blocksPerPage() const
+{
+    return (dims[0] / block_dims[0]) * (dims[1] / block_dims[1]);
+}
+
+/**
+ * @brief AtlasContainer::numPages
+ * @return
+ */
+size_t AtlasContainer::numPages() const
+{
+    return draw_type == DrawType::IMAGE ? dims[2] : dims[2] / block_dims[2];
+}
+
+/**
+ * @brief AtlasContainer::pageSize
+ * @return Number of bytes of a single page in the atlas data, including all its mip levels.
+ */
+size_t AtlasContainer::pageSize() const
+{
+    return draw_type == DrawType::IMAGE ? levelOffset(num_levels) : dims[0] * dims[1] * block_dims[2];
+}
+
+/**
+ * @brief AtlasContainer::levelOffset
+ * @param level
+ * @return Offset in bytes of a mip level of an image atlas within its page. Every level halves the dims of the previous one.
+ */
+size_t AtlasContainer::levelOffset(size_t level) const
+{
+    size_t offset = 0;
+    for (size_t previous_level = 0; previous_level < level; ++previous_level)
+        offset += (dims[0] >> previous_level) * (dims[1] >> previous_level) * 4;
+    return offset;
+}
+
+/**
+ * @brief AtlasContainer::occupancyBlockDims
+ * @return [x, y, z] bricks of the occupancy grid of a single volume.
+ */
+std::array<size_t, 3> AtlasContainer::occupancyBlockDims() const
+{
+    return {
+        (block_dims[0] + OCCUPANCY_BRICK_SIZE - 1) / OCCUPANCY_BRICK_SIZE,
+        (block_dims[1] + OCCUPANCY_BRICK_SIZE - 1) / OCCUPANCY_BRICK_SIZE,
+        (block_dims[2] + OCCUPANCY_BRICK_SIZE - 1) / OCCUPANCY_BRICK_SIZE
+    };
+}
+
+/**
+ * @brief AtlasContainer::occupancyDims The occupancy grid has a block of bricks for every block of the atlas, so both share the texture coordinates of a block origin.
+ * @return [x, y, z] bricks of the occupancy grid of the atlas.
+ */
+std::array<size_t, 3> AtlasContainer::occupancyDims() const
+{
+    auto occupancy_block_dims = occupancyBlockDims();
     return {
-        {
-            static_cast<size_t>(std::min(num_elements, elements_per_dim) * max_dim),
-            static_cast<size_t>(std::min(num_rows, elements_per_dim) * max_dim),
-            static_cast<size_t>(draw_properties->draw_type == DrawType::IMAGE ? depth : depth * max_dim)
-        },
-        static_cast<size_t>(max_dim)
+        dims[0] / block_dims[0] * occupancy_block_dims[0],
+        dims[1] / block_dims[1] * occupancy_block_dims[1],
+        numPages() * occupancy_block_dims[2]
     };
 }
 
 /**
- * @brief createAtlasContainer Create an atlas container for images given the current data. Frees the tree data after the atlas is created.
+ * @brief AtlasContainer::occupancyOrigin
+ * @param slot
+ * @return [x, y, z] origin of the bricks of a block in the occupancy grid.
+ */
+std::array<size_t, 3> AtlasContainer::occupancyOrigin(size_t slot) const
+{
+    auto origin = blockOrigin(slot);
+    auto occupancy_block_dims = occupancyBlockDims();
+    return {
+        origin[0] / block_dims[0] * occupancy_block_dims[0],
+        origin[1] / block_dims[1] * occupancy_block_dims[1],
+        origin[2] / block_dims[2] * occupancy_block_dims[2]
+    };
+}
+
+/**
+ * @brief The PageTracker class Keeps track of the filled blocks of every page, to report a page as soon as all its blocks are filled.
+ */
+class PageTracker
+{
+    const AtlasContainer &container;
+    const PageCallback &page_ready;
+    std::function<void(size_t page)> complete_page;
+    std::vector<bool> is_slot_filled;
+    std::vector<size_t> num_filled_slots;
+    std::vector<bool> is_page_reported;
+
+    /**
+     * @brief report
+     * @param page
+     */
+    void report(size_t page)
+    {
+        is_page_reported[page] = true;
+        if (complete_page)
+            complete_page(page);
+        if (page_ready)
+            page_ready(page, container.data.constData() + page * container.pageSize());
+    }
+
+public:
+    /**
+     * @brief PageTracker
+     * @param container
+     * @param page_ready
+     * @param complete_page Optional callback finishing a page before it's reported, like building its mip levels.
+     */
+    PageTracker(const AtlasContainer &container, const PageCallback &page_ready, std::function<void(size_t page)> complete_page = nullptr):
+        container(container),
+        page_ready(page_ready),
+        complete_page(std::move(complete_page)),
+        is_slot_filled(container.element_slots.size(), false),
+        num_filled_slots(container.numPages(), 0),
+        is_page_reported(container.numPages(), false)
+    {
+    }
+
+    /**
+     * @brief fill Mark a slot as filled. Slots that are filled again, like when a stream restarts, are counted once.
+     * @param slot
+     */
+    void fill(size_t slot)
+    {
+        if (is_slot_filled[slot])
+            return;
+
+        is_slot_filled[slot] = true;
+        size_t blocks_per_page = container.blocksPerPage();
+        size_t page = slot / blocks_per_page;
+        size_t num_page_slots = std::min(blocks_per_page, is_slot_filled.size() - page * blocks_per_page);
+        if (++num_filled_slots[page] == num_page_slots)
+            report(page);
+    }
+
+    /**
+     * @brief finish Report the pages that aren't complete, for when not all elements could be read.
+     */
+    void finish()
+    {
+        for (size_t page = 0; page < is_page_reported.size(); ++page) {
+            if (!is_page_reported[page])
+                report(page);
+        }
+    }
+};
+
+/**
+ * @brief determineMipLevels Determine the number of mip levels of an image atlas.
+ * Blocks are aligned to the coarsest level and keep a gutter of a texel there, which doubles for every finer level.
+ * Levels are added while the gutter stays within a fraction of the shortest side of the images, which bounds the memory spent on gutters.
  * @param draw_properties
- * @param max_2D_texture_dim
  * @return
  */
-AtlasContainer createImageAtlasContainer(TreeDrawProperties *draw_properties, size_t max_2D_texture_dim)
+size_t determineMipLevels(TreeDrawProperties *draw_properties)
 {
-    QElapsedTimer timer;
-    timer.start();
+    size_t min_dim = std::min(draw_properties->data_dims[0], draw_properties->data_dims[1]);
+    size_t num_levels = 1;
+    while (num_levels < ATLAS_MAX_MIP_LEVELS && (size_t(1) << num_levels) * ATLAS_GUTTER_FRACTION <= min_dim)
+        ++num_levels;
+    return num_levels;
+}
 
-    auto [atlas_dims, atlas_block_size] = determineAtlasDims(draw_properties, max_2D_texture_dim);
-    auto [img_width, img_height, _] = draw_properties->data_dims;
+/**
+ * @brief determineAtlasDims Determine the size of the atlas to be generated. Blocks are packed in shelves of the block height, each filled up to the maximum texture width.
+ * Shelves are stacked up to the maximum texture height, after which a new atlas is started for images, or a new slab of blocks in the z-direction for volumes.
+ * So if the data is too large it will overflow in the z-direction.
+ * @param draw_type
+ * @param block_dims [x, y, z] dims of every block.
+ * @param max_texture_dim
+ * @param num_elements Number of distinct elements to put in the atlas.
+ * @return [x, y, z] dims of the atlas.
+ */
+std::array<size_t, 3> determineAtlasDims(DrawType draw_type, std::array<size_t, 3> block_dims, size_t max_texture_dim, size_t num_elements)
+{
+    size_t blocks_per_shelf = std::max<size_t>(1, max_texture_dim / block_dims[0]);
+    size_t shelves_per_page = std::max<size_t>(1, max_texture_dim / block_dims[1]);
+    size_t num_shelves = (std::max<size_t>(1, num_elements) + blocks_per_shelf - 1) / blocks_per_shelf;
+    size_t num_pages = (num_shelves + shelves_per_page - 1) / shelves_per_page;
+    return {
+        std::min(std::max<size_t>(1, num_elements), blocks_per_shelf) * block_dims[0],
+        std::min(num_shelves, shelves_per_page) * block_dims[1],
+        draw_type == DrawType::IMAGE ? num_pages : num_pages * block_dims[2]
+    };
+}
+
+/**
+ * @brief createAtlasLayout Assign a block of the atlas to every element assigned to a node, without filling the atlas.
+ * Elements assigned to multiple nodes get a single block. Volumes get a block of their own dims, images get a block of their dims plus a gutter on every side.
+ * Volume atlasses that would exceed the maximum texture size are paged instead: the atlas is limited in size, and the blocks are assigned while drawing.
+ * @param draw_properties
+ * @param max_texture_dim
+ * @return Container with the mapping, but without data.
+ */
+AtlasContainer createAtlasLayout(TreeDrawProperties *draw_properties, size_t max_texture_dim)
+{
+    std::vector<bool> is_used(draw_properties->disparities.size(), false);
+    for (int element : draw_properties->elements) {
+        if (element >= 0)
+            is_used[element] = true;
+    }
+    QList<size_t> elements;
+    for (size_t element = 0; element < is_used.size(); ++element) {
+        if (is_used[element])
+            elements.append(element);
+    }
 
-    // Initialize container
     AtlasContainer container;
+    container.draw_type = draw_properties->draw_type;
+    auto [x_dim, y_dim, z_dim] = draw_properties->data_dims;
+    if (draw_properties->draw_type == DrawType::IMAGE) {
+        // Blocks are aligned to the coarsest level, so every level of a block stays within the block.
+        container.num_levels = determineMipLevels(draw_properties);
+        container.gutter = size_t(1) << (container.num_levels - 1);
+        size_t alignment = container.gutter;
+        container.block_dims = {
+            (x_dim + 2 * container.gutter + alignment - 1) / alignment * alignment,
+            (y_dim + 2 * container.gutter + alignment - 1) / alignment * alignment,
+            1
+        };
+    } else {
+        container.num_levels = 1;
+        container.gutter = 0;
+        container.block_dims = { x_dim, y_dim, z_dim };
+    }
+
+    auto atlas_dims = determineAtlasDims(container.draw_type, container.block_dims, max_texture_dim, elements.size());
+    if (container.draw_type == DrawType::VOLUME && atlas_dims[2] > max_texture_dim) {
+        size_t slab_size = atlas_dims[0] * atlas_dims[1] * z_dim;
+        size_t num_slabs = std::max<size_t>(1, std::min(max_texture_dim / z_dim, PAGED_VOLUME_ATLAS_SIZE / slab_size));
+        atlas_dims[2] = num_slabs * z_dim;
+        container.is_paged = true;
+        qDebug() << "Volume atlas exceeds the maximum texture size, paging" << elements.size() << "volumes through" << num_slabs * (atlas_dims[0] / x_dim) * (atlas_dims[1] / y_dim) << "blocks";
+    }
     container.dims = atlas_dims;
     container.coord_offsets = QVector3D{
-        static_cast<float>(atlas_block_size) / static_cast<float>(atlas_dims[0]),
-        static_cast<float>(atlas_block_size) / static_cast<float>(atlas_dims[1]),
-        1.f
+        static_cast<float>(x_dim) / static_cast<float>(atlas_dims[0]),
+        static_cast<float>(y_dim) / static_cast<float>(atlas_dims[1]),
+        draw_properties->draw_type == DrawType::IMAGE ? 1.f : static_cast<float>(z_dim) / static_cast<float>(atlas_dims[2])
     };
 
-    // Initialize atlas canvasses
-    QList<QImage> image_atlasses(atlas_dims[2], QImage{ static_cast<int>(atlas_dims[0]), static_cast<int>(atlas_dims[1]), QImage::Format_RGB32 });
-    for (auto &img : image_atlasses)
-        img.fill(QColor{
-            static_cast<int>(draw_properties->background_color.x() * 255),
-            static_cast<int>(draw_properties->background_color.y() * 255),
-            static_cast<int>(draw_properties->background_color.z() * 255),
-        });
-
-    int images_per_atlas = (atlas_dims[0] * atlas_dims[1]) / (atlas_block_size * atlas_block_size);
-    int images_per_atlas_dim = std::floor(atlas_dims[0] / atlas_block_size);
-    int x_img_offset = (atlas_block_size - img_width) / 2;
-    int y_img_offset = (atlas_block_size - img_height) / 2;
+    if (container.is_paged)
+        return container;
 
-    // Fill mapping and atlasses
     size_t count = 0;
-    for (auto [key, raw_image] : draw_properties->data->asKeyValueRange()) {
-        auto &[height, index] = key;
-        QImage image{ raw_image.data(), static_cast<int>(img_width), static_cast<int>(img_height), QImage::Format_RGBA8888 };
-        int atlas_idx = count / images_per_atlas;
-        int canvas_idx = count % images_per_atlas;
-        int canvas_x = (canvas_idx % images_per_atlas_dim) * atlas_block_size;
-        int canvas_y = (canvas_idx / images_per_atlas_dim) * atlas_block_size;
-        QPainter painter(&image_atlasses[atlas_idx]);
-        painter.drawImage(
-            canvas_x + x_img_offset, // Center x
-            canvas_y + y_img_offset, // Center y
-            image
-        );
-        container.mapping[{ height, index }] = QVector3D{
-            static_cast<float>(canvas_x) / static_cast<float>(atlas_dims[0]),
-            static_cast<float>(canvas_y) / static_cast<float>(atlas_dims[1]),
-            static_cast<float>(atlas_idx)
-        };
-
+    for (size_t element : elements) {
+        container.element_slots[element] = count;
+        container.mapping[element] = container.blockCoords(count);
         ++count;
     }
 
-    // Copy atlas data to container data
-    size_t data_offset = image_atlasses.first().bytesPerLine() * image_atlasses.first().height();
-    for (size_t idx = 0; idx < image_atlasses.size(); ++idx) {
-        auto bits = image_atlasses[idx].bits();
-        container.data.append(QList(bits, bits + data_offset));
-    }
+    return container;
+}
+
+/**
+ * @brief backgroundPixel
+ * @param draw_properties
+ * @return The background color of the tree as an opaque BGRA pixel, in the 0xAARRGGBB format of QRgb.
+ */
+uint32_t backgroundPixel(TreeDrawProperties *draw_properties)
+{
+    return 0xff000000 |
+        static_cast<uint32_t>(draw_properties->background_color.x() * 255) << 16 |
+        static_cast<uint32_t>(draw_properties->background_color.y() * 255) << 8 |
+        static_cast<uint32_t>(draw_properties->background_color.z() * 255);
+}
+
+/**
+ * @brief blendPaddedImageRow Blend a row of the block of an image, including its gutter. The gutter repeats the edges of the image.
+ * @param draw_properties
+ * @param image_data
+ * @param container
+ * @param block_y Row of the block, where the image starts at the gutter.
+ * @param background
+ * @param destination Start of the row of the block.
+ */
+void blendPaddedImageRow(
+    TreeDrawProperties *draw_properties,
+    const unsigned char *image_data,
+    const AtlasContainer &container,
+    size_t block_y,
+    uint32_t background,
+    unsigned char *destination
+)
+{
+    auto [img_width, img_height, _] = draw_properties->data_dims;
+    size_t gutter = container.gutter;
+    size_t y = std::min(block_y > gutter ? block_y - gutter : 0, img_height - 1);
+    blendRGBAOnBackground(image_data + y * img_width * 4, destination + gutter * 4, img_width, background);
 
-    // Not needed anymore
-    delete draw_properties->data;
-    draw_properties->data = nullptr;
+    for (size_t x = 0; x < gutter; ++x)
+        std::memcpy(destination + x * 4, destination + gutter * 4, 4);
+    for (size_t x = gutter + img_width; x < container.block_dims[0]; ++x)
+        std::memcpy(destination + x * 4, destination + (gutter + img_width - 1) * 4, 4);
+}
 
-    qDebug() << "Creating image atlas container took" << timer.elapsed() << "milliseconds";
+/**
+ * @brief downsampleRow Compute a row of the next mip level of a BGRA image by averaging 2x2 texels.
+ * @param source Previous level.
+ * @param source_width Width of the previous level, which is even.
+ * @param y Row of the next level.
+ * @param destination Start of the row in the next level.
+ */
+void downsampleRow(const unsigned char *source, size_t source_width, size_t y, unsigned char *destination)
+{
+    const unsigned char *top = source + 2 * y * source_width * 4;
+    const unsigned char *bottom = top + source_width * 4;
+    for (size_t x = 0; x < source_width / 2; ++x) {
+        for (size_t channel = 0; channel < 4; ++channel) {
+            unsigned int sum = top[8 * x + channel] + top[8 * x + 4 + channel] + bottom[8 * x + channel] + bottom[8 * x + 4 + channel];
+            destination[4 * x + channel] = static_cast<unsigned char>((sum + 2) >> 2);
+        }
+    }
+}
 
-    return container;
+/**
+ * @brief buildMipLevels Build the mip levels of a page or block from its full resolution level, in parallel per row.
+ * The levels follow each other in the data, each halving the dims of the previous one.
+ * As blocks and gutters are aligned to the coarsest level, the texels of a block never mix with those of its neighbours.
+ * @param data Start of the full resolution level.
+ * @param width
+ * @param height
+ * @param num_levels
+ */
+void buildMipLevels(unsigned char *data, size_t width, size_t height, size_t num_levels)
+{
+    unsigned char *source = data;
+    for (size_t level = 1; level < num_levels; ++level) {
+        size_t source_width = width >> (level - 1);
+        size_t source_height = height >> (level - 1);
+        unsigned char *destination = source + source_width * source_height * 4;
+        parallelFor(source_height / 2, [&](size_t y) {
+            downsampleRow(source, source_width, y, destination + y * (source_width / 2) * 4);
+        });
+        source = destination;
+    }
 }
 
 /**
- * @brief createVolumeAtlasContainer Create an atlas container for volumes given the current data. Frees the tree data after the atlas is created.
+ * @brief fillImageAtlas Fill the atlasses of an image atlas layout with the elements while they are read. The element data is freed afterwards.
+ * The images of every chunk are blended on the background straight into the container data, in parallel per row, including the gutter around them.
+ * Every image occupies its own block, so the rows never overlap. The mip levels of every atlas are built once all its images are in.
  * @param draw_properties
- * @param max_3D_texture_dim
- * @return
+ * @param container Layout of the atlas, which receives the data.
+ * @param progress Optional callback receiving the progress of reading the elements. Cancelling leaves the atlas incomplete.
+ * @param page_ready Optional callback receiving every atlas as soon as it's complete, called on the calling thread.
+ * @return True if all images were read.
  */
-AtlasContainer createVolumeAtlasContainer(TreeDrawProperties *draw_properties, size_t max_3D_texture_dim)
+bool fillImageAtlas(TreeDrawProperties *draw_properties, AtlasContainer &container, const ProgressCallback &progress, const PageCallback &page_ready)
 {
     QElapsedTimer timer;
     timer.start();
 
-    auto [atlas_dims, atlas_block_size] = determineAtlasDims(draw_properties, max_3D_texture_dim);
-    auto [volume_width, volume_height, volume_depth] = draw_properties->data_dims;
+    auto &atlas_dims = container.dims;
+    size_t block_height = container.block_dims[1];
 
-    // Initialize container
-    AtlasContainer container;
-    container.dims = atlas_dims;
-    container.coord_offsets = QVector3D{
-        static_cast<float>(atlas_block_size) / static_cast<float>(atlas_dims[0]),
-        static_cast<float>(atlas_block_size) / static_cast<float>(atlas_dims[1]),
-        static_cast<float>(atlas_block_size) / static_cast<float>(atlas_dims[2])
-    };
-    container.data = QList<unsigned char>(atlas_dims[0] * atlas_dims[1] * atlas_dims[2], 0);
+    // Every texel of a block is covered by its image or gutter, so only transparency needs the background.
+    size_t bytes_per_line = atlas_dims[0] * 4;
+    container.data = QList<unsigned char>(container.pageSize() * atlas_dims[2]);
+    uint32_t background = backgroundPixel(draw_properties);
+    unsigned char *atlas_data = container.data.data();
 
-    size_t volumes_per_atlas_dim = std::floor(atlas_dims[0] / atlas_block_size);
-    size_t volumes_per_atlas_slice = volumes_per_atlas_dim * volumes_per_atlas_dim;
+    // Fill atlasses while the elements are read, and pass on every atlas with its mip levels once all its images are in.
+    qint64 mip_nanoseconds = 0;
+    PageTracker page_tracker(container, page_ready, [&](size_t page) {
+        QElapsedTimer mip_timer;
+        mip_timer.start();
+        buildMipLevels(atlas_data + page * container.pageSize(), atlas_dims[0], atlas_dims[1], container.num_levels);
+        mip_nanoseconds += mip_timer.nsecsElapsed();
+    });
+    std::vector<std::pair<const unsigned char *, size_t>> chunk_images;
+    qint64 blend_nanoseconds = 0;
+    bool is_read = draw_properties->element_cache->forEachChunk([&](const ElementChunk &chunk) {
+        chunk_images.clear();
+        for (size_t idx = 0; idx < chunk.elements.size(); ++idx) {
+            auto slot = container.element_slots.find(chunk.elements[idx]);
+            if (slot != container.element_slots.end())
+                chunk_images.emplace_back(chunk.data[idx], slot.value());
+        }
 
-    size_t x_volume_offset = (atlas_block_size - volume_width) / 2;
-    size_t y_volume_offset = (atlas_block_size - volume_height) / 2;
-    size_t z_volume_offset = (atlas_block_size - volume_depth) / 2;
+        QElapsedTimer blend_timer;
+        blend_timer.start();
+        parallelFor(chunk_images.size() * block_height, [&](size_t idx) {
+            auto [raw_image, slot] = chunk_images[idx / block_height];
+            size_t y = idx % block_height;
+            auto [canvas_x, canvas_y, atlas_idx] = container.blockOrigin(slot);
+            unsigned char *destination = atlas_data + atlas_idx * container.pageSize() + (canvas_y + y) * bytes_per_line + canvas_x * 4;
+            blendPaddedImageRow(draw_properties, raw_image, container, y, background, destination);
+        });
+        blend_nanoseconds += blend_timer.nsecsElapsed();
 
-    size_t row_offset = atlas_dims[0];
-    size_t slice_offset = atlas_dims[0] * atlas_dims[1];
+        for (auto &[raw_image, slot] : chunk_images)
+            page_tracker.fill(slot);
+    }, progress);
+    if (!is_read)
+        qDebug() << "Not all images could be read, the atlas is incomplete";
+    page_tracker.finish();
 
-    // Build the atlas by copying data from the volume buffers to the container buffer.
-    size_t count = 0;
-    for (auto [key, volume_data] : draw_properties->data->asKeyValueRange()) {
-        size_t atlas_x = count % volumes_per_atlas_dim;
-        size_t atlas_y = (count % volumes_per_atlas_slice) / volumes_per_atlas_dim;
-        size_t atlas_z = count / volumes_per_atlas_slice;
-        size_t origin = atlas_x * atlas_block_size + x_volume_offset +
-                        atlas_y * row_offset * atlas_block_size + y_volume_offset * row_offset +
-                        atlas_z * slice_offset * atlas_block_size + z_volume_offset * slice_offset;
-
-        container.mapping[key] = QVector3D{
-            static_cast<float>(atlas_x * atlas_block_size) / static_cast<float>(atlas_dims[0]),
-            static_cast<float>(atlas_y * atlas_block_size) / static_cast<float>(atlas_dims[1]),
-            static_cast<float>(atlas_z * atlas_block_size) / static_cast<float>(atlas_dims[2])
-        };
+    // Not needed anymore. This also releases the mapping of the data file.
+    delete draw_properties->element_cache;
+    draw_properties->element_cache = nullptr;
 
-        for (size_t volume_z = 0; volume_z < volume_depth; ++volume_z) {
-            for (size_t volume_y = 0; volume_y < volume_height; ++volume_y) {
-                for (size_t volume_x = 0; volume_x < volume_width; ++volume_x) {
-                    size_t container_idx = origin + volume_x + volume_y * row_offset + volume_z * slice_offset;
-                    size_t volume_idx = volume_x + volume_y * volume_width + volume_z * volume_width * volume_height;
-                    container.data[container_idx] = volume_data[volume_idx];   
+    qDebug() << "Filling image atlas took" << timer.elapsed() << "milliseconds, of which blending images took" << blend_nanoseconds / 1000000 << "milliseconds on" << numParallelWorkers() << "threads using" << imageBlendKernelName();
+    qDebug() << "Building" << container.num_levels << "mip levels took" << mip_nanoseconds / 1000000 << "milliseconds";
+
+    return is_read;
+}
+
+/**
+ * @brief createImageAtlasBlock Create the block of a single image with its gutter and mip levels, blended on the background like in a complete atlas.
+ * @param draw_properties
+ * @param container Layout of the atlas the block is put in.
+ * @param image_data
+ * @return Levels of the block in the same format as the image atlas, each following the previous one.
+ */
+QList<unsigned char> createImageAtlasBlock(TreeDrawProperties *draw_properties, const AtlasContainer &container, const unsigned char *image_data)
+{
+    auto [block_width, block_height, _] = container.block_dims;
+    size_t block_size = 0;
+    for (size_t level = 0; level < container.num_levels; ++level)
+        block_size += (block_width >> level) * (block_height >> level) * 4;
+
+    QList<unsigned char> block(block_size);
+    uint32_t background = backgroundPixel(draw_properties);
+    for (size_t y = 0; y < block_height; ++y)
+        blendPaddedImageRow(draw_properties, image_data, container, y, background, block.data() + y * block_width * 4);
+    buildMipLevels(block.data(), block_width, block_height, container.num_levels);
+    return block;
+}
+
+/**
+ * @brief copyVolumeSlice Copy a single z-slice of a volume into its block in a larger buffer.
+ * Every row of the slice is contiguous in both buffers, so it's copied at once.
+ * @param draw_properties
+ * @param volume_data
+ * @param destination
+ * @param destination_dims [x, y, z] dims of the destination buffer.
+ * @param origin [x, y, z] origin of the block in the destination.
+ * @param volume_z Slice of the volume to copy.
+ */
+void copyVolumeSlice(
+    TreeDrawProperties *draw_properties,
+    const unsigned char *volume_data,
+    unsigned char *destination,
+    std::array<size_t, 3> destination_dims,
+    std::array<size_t, 3> origin,
+    size_t volume_z
+)
+{
+    auto [volume_width, volume_height, volume_depth] = draw_properties->data_dims;
+    size_t row_offset = destination_dims[0];
+    size_t slice_offset = destination_dims[0] * destination_dims[1];
+    size_t start = origin[0] + origin[1] * row_offset + (origin[2] + volume_z) * slice_offset;
+
+    const unsigned char *source_slice = volume_data + volume_z * volume_width * volume_height;
+    for (size_t volume_y = 0; volume_y < volume_height; ++volume_y)
+        std::memcpy(destination + start + volume_y * row_offset, source_slice + volume_y * volume_width, volume_width);
+}
+
+/**
+ * @brief computeOccupancyLayer Determine the [min, max] value of a layer of bricks of a volume.
+ * Every brick includes the voxels next to it, as these are interpolated with the voxels of the brick when sampling.
+ * @param volume_data Start of the volume.
+ * @param row_stride Number of bytes between rows of the volume.
+ * @param slice_stride Number of bytes between z-slices of the volume.
+ * @param volume_dims [x, y, z] dims of the volume.
+ * @param brick_z Layer of bricks.
+ * @param destination Start of the layer in the occupancy grid.
+ * @param destination_row_stride Number of bytes between rows of bricks in the occupancy grid.
+ */
+void computeOccupancyLayer(
+    const unsigned char *volume_data,
+    size_t row_stride,
+    size_t slice_stride,
+    std::array<size_t, 3> volume_dims,
+    size_t brick_z,
+    unsigned char *destination,
+    size_t destination_row_stride
+)
+{
+    auto voxelRange = [&](size_t brick, size_t dim) {
+        size_t first = brick * OCCUPANCY_BRICK_SIZE;
+        return std::make_pair(first > 0 ? first - 1 : 0, std::min(first + OCCUPANCY_BRICK_SIZE, volume_dims[dim] - 1));
+    };
+
+    size_t num_bricks_x = (volume_dims[0] + OCCUPANCY_BRICK_SIZE - 1) / OCCUPANCY_BRICK_SIZE;
+    size_t num_bricks_y = (volume_dims[1] + OCCUPANCY_BRICK_SIZE - 1) / OCCUPANCY_BRICK_SIZE;
+    auto [first_z, last_z] = voxelRange(brick_z, 2);
+    for (size_t brick_y = 0; brick_y < num_bricks_y; ++brick_y) {
+        auto [first_y, last_y] = voxelRange(brick_y, 1);
+        for (size_t brick_x = 0; brick_x < num_bricks_x; ++brick_x) {
+            auto [first_x, last_x] = voxelRange(brick_x, 0);
+            unsigned char minimum = 255, maximum = 0;
+            for (size_t z = first_z; z <= last_z; ++z) {
+                for (size_t y = first_y; y <= last_y; ++y) {
+                    const unsigned char *row = volume_data + z * slice_stride + y * row_stride;
+                    auto [row_minimum, row_maximum] = std::minmax_element(row + first_x, row + last_x + 1);
+                    minimum = std::min(minimum, *row_minimum);
+                    maximum = std::max(maximum, *row_maximum);
                 }
             }
+            destination[brick_y * destination_row_stride + brick_x * 2] = minimum;
+            destination[brick_y * destination_row_stride + brick_x * 2 + 1] = maximum;
         }
+    }
+}
 
-        ++count;
+/**
+ * @brief fillVolumeOccupancy Determine the occupancy grid of all blocks of a page of a volume atlas, in parallel per layer of bricks. The grid is allocated on first use.
+ * @param container
+ * @param page Index of the slab of blocks.
+ * @param page_data
+ */
+void fillVolumeOccupancy(AtlasContainer &container, size_t page, const unsigned char *page_data)
+{
+    auto occupancy_dims = container.occupancyDims();
+    auto occupancy_block_dims = container.occupancyBlockDims();
+    if (container.occupancy.isEmpty())
+        container.occupancy = QList<unsigned char>(occupancy_dims[0] * occupancy_dims[1] * occupancy_dims[2] * 2, 0);
+    unsigned char *occupancy_data = container.occupancy.data();
+
+    size_t blocks_per_page = container.blocksPerPage();
+    size_t first_slot = page * blocks_per_page;
+    size_t row_stride = container.dims[0];
+    size_t slice_stride = container.dims[0] * container.dims[1];
+    size_t occupancy_row_stride = occupancy_dims[0] * 2;
+    size_t occupancy_slice_stride = occupancy_row_stride * occupancy_dims[1];
+    parallelFor(blocks_per_page * occupancy_block_dims[2], [&](size_t idx) {
+        size_t slot = first_slot + idx / occupancy_block_dims[2];
+        size_t brick_z = idx % occupancy_block_dims[2];
+        auto [x, y, z] = container.blockOrigin(slot);
+        auto [occupancy_x, occupancy_y, occupancy_z] = container.occupancyOrigin(slot);
+        computeOccupancyLayer(
+            page_data + (z - page * container.block_dims[2]) * slice_stride + y * row_stride + x, row_stride, slice_stride,
+            container.block_dims, brick_z,
+            occupancy_data + (occupancy_z + brick_z) * occupancy_slice_stride + occupancy_y * occupancy_row_stride + occupancy_x * 2, occupancy_row_stride
+        );
+    });
+}
+
+/**
+ * @brief createVolumeOccupancyBlock Determine the occupancy grid of a single volume, for volumes that are put in the atlas one at a time.
+ * @param container Layout of the atlas the volume is put in.
+ * @param volume_data
+ * @return [min, max] value of every brick of the volume.
+ */
+QList<unsigned char> createVolumeOccupancyBlock(const AtlasContainer &container, const unsigned char *volume_data)
+{
+    auto occupancy_block_dims = container.occupancyBlockDims();
+    QList<unsigned char> block(occupancy_block_dims[0] * occupancy_block_dims[1] * occupancy_block_dims[2] * 2);
+    size_t row_stride = container.block_dims[0];
+    size_t slice_stride = container.block_dims[0] * container.block_dims[1];
+    size_t occupancy_slice_stride = occupancy_block_dims[0] * occupancy_block_dims[1] * 2;
+    for (size_t brick_z = 0; brick_z < occupancy_block_dims[2]; ++brick_z) {
+        computeOccupancyLayer(
+            volume_data, row_stride, slice_stride, container.block_dims, brick_z,
+            block.data() + brick_z * occupancy_slice_stride, occupancy_block_dims[0] * 2
+        );
     }
+    return block;
+}
 
-    // Not needed anymore
-    delete draw_properties->data;
-    draw_properties->data = nullptr;
+/**
+ * @brief packGradient Pack the differences of the voxel values around a voxel along every axis, which lie in [-510, 510], into the RGB components of an RGB10A2 texel.
+ * The differences are offset by 512, so they're stored exactly and are restored as texel * 1023 - 512.
+ * @param dx
+ * @param dy
+ * @param dz
+ * @return
+ */
+static inline quint32 packGradient(int dx, int dy, int dz)
+{
+    return quint32(dx + 512) | (quint32(dy + 512) << 10) | (quint32(dz + 512) << 20);
+}
 
-    qDebug() << "Creating volume atlas container took" << timer.elapsed() << "milliseconds";
+/**
+ * @brief computeGradientSlice Determine the gradient of a z-slice of a volume by central differences.
+ * At the sides of the volume the one-sided difference is doubled, so all differences span two voxels and never reach into neighbouring blocks.
+ * @param volume_data Start of the volume.
+ * @param row_stride Number of bytes between rows of the volume.
+ * @param slice_stride Number of bytes between z-slices of the volume.
+ * @param volume_dims [x, y, z] dims of the volume.
+ * @param z
+ * @param destination Start of the slice in the gradients.
+ * @param destination_row_stride Number of texels between rows of the gradients.
+ */
+void computeGradientSlice(
+    const unsigned char *volume_data,
+    size_t row_stride,
+    size_t slice_stride,
+    std::array<size_t, 3> volume_dims,
+    size_t z,
+    quint32 *destination,
+    size_t destination_row_stride
+)
+{
+    auto [width, height, depth] = volume_dims;
+    auto difference = [](const unsigned char *previous, const unsigned char *next, bool is_side) {
+        int value = int(*next) - int(*previous);
+        return is_side ? 2 * value : value;
+    };
 
-    return container;
+    const unsigned char *slice = volume_data + z * slice_stride;
+    const unsigned char *previous_slice = volume_data + (z > 0 ? z - 1 : z) * slice_stride;
+    const unsigned char *next_slice = volume_data + (z + 1 < depth ? z + 1 : z) * slice_stride;
+    bool is_side_z = z == 0 || z + 1 == depth;
+    for (size_t y = 0; y < height; ++y) {
+        size_t previous_y = y > 0 ? y - 1 : y;
+        size_t next_y = y + 1 < height ? y + 1 : y;
+        bool is_side_y = y == 0 || y + 1 == height;
+        const unsigned char *row = slice + y * row_stride;
+        quint32 *destination_row = destination + y * destination_row_stride;
+        for (size_t x = 0; x < width; ++x) {
+            size_t previous_x = x > 0 ? x - 1 : x;
+            size_t next_x = x + 1 < width ? x + 1 : x;
+            destination_row[x] = packGradient(
+                difference(row + previous_x, row + next_x, x == 0 || x + 1 == width),
+                difference(slice + previous_y * row_stride + x, slice + next_y * row_stride + x, is_side_y),
+                difference(previous_slice + y * row_stride + x, next_slice + y * row_stride + x, is_side_z)
+            );
+        }
+    }
+}
+
+/**
+ * @brief createVolumeGradientPage Determine the gradients of all blocks of a page of a volume atlas, in parallel per z-slice.
+ * Gradients are determined per page, so the loader can bound the pages that are held at a time instead of holding the whole atlas.
+ * @param container
+ * @param page Index of the slab of blocks.
+ * @param page_data
+ * @return Gradient of every voxel of the page, see packGradient. Laid out like the page.
+ */
+QList<quint32> createVolumeGradientPage(const AtlasContainer &container, size_t page, const unsigned char *page_data)
+{
+    QList<quint32> page_gradients(container.pageSize(), packGradient(0, 0, 0));
+
+    size_t blocks_per_page = container.blocksPerPage();
+    size_t first_slot = page * blocks_per_page;
+    size_t volume_depth = container.block_dims[2];
+    size_t row_stride = container.dims[0];
+    size_t slice_stride = container.dims[0] * container.dims[1];
+    parallelFor(blocks_per_page * volume_depth, [&](size_t idx) {
+        auto [x, y, z] = container.blockOrigin(first_slot + idx / volume_depth);
+        size_t offset = (z - page * volume_depth) * slice_stride + y * row_stride + x;
+        computeGradientSlice(page_data + offset, row_stride, slice_stride, container.block_dims, idx % volume_depth, page_gradients.data() + offset + (idx % volume_depth) * slice_stride, row_stride);
+    });
+    return page_gradients;
+}
+
+/**
+ * @brief createVolumeGradientBlock Determine the gradients of a single volume, for volumes that are put in the atlas one at a time.
+ * @param container Layout of the atlas the volume is put in.
+ * @param volume_data
+ * @return Gradient of every voxel of the volume, see packGradient.
+ */
+QList<quint32> createVolumeGradientBlock(const AtlasContainer &container, const unsigned char *volume_data)
+{
+    auto [width, height, depth] = container.block_dims;
+    QList<quint32> block(width * height * depth);
+    for (size_t z = 0; z < depth; ++z)
+        computeGradientSlice(volume_data, width, width * height, container.block_dims, z, block.data() + z * width * height, width);
+    return block;
+}
+
+/**
+ * @brief fillVolumeAtlas Fill a volume atlas layout with the elements while they are read. The element data is freed afterwards.
+ * The volumes of every chunk are copied in parallel, split into slices so that chunks holding a single large volume are spread as well.
+ * Every volume occupies its own block, so the copies never overlap.
+ * @param draw_properties
+ * @param container Layout of the atlas, which receives the data.
+ * @param progress Optional callback receiving the progress of reading the elements. Cancelling leaves the atlas incomplete.
+ * @param page_ready Optional callback receiving every slab of blocks as soon as it's complete, called on the calling thread.
+ * @return True if all volumes were read.
+ */
+bool fillVolumeAtlas(TreeDrawProperties *draw_properties, AtlasContainer &container, const ProgressCallback &progress, const PageCallback &page_ready)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    auto &atlas_dims = container.dims;
+    container.data = QList<unsigned char>(atlas_dims[0] * atlas_dims[1] * atlas_dims[2], 0);
+    unsigned char *atlas_data = container.data.data();
+    size_t volume_depth = draw_properties->data_dims[2];
+
+    // Build the atlas by copying the volumes to the container buffer while they are read, and pass on every slab with its occupancy once all its volumes are in.
+    qint64 occupancy_nanoseconds = 0;
+    PageTracker page_tracker(container, page_ready, [&](size_t page) {
+        QElapsedTimer page_timer;
+        page_timer.start();
+        fillVolumeOccupancy(container, page, atlas_data + page * container.pageSize());
+        occupancy_nanoseconds += page_timer.nsecsElapsed();
+    });
+    std::vector<std::pair<const unsigned char *, size_t>> chunk_volumes;
+    qint64 copy_nanoseconds = 0;
+    bool is_read = draw_properties->element_cache->forEachChunk([&](const ElementChunk &chunk) {
+        chunk_volumes.clear();
+        for (size_t idx = 0; idx < chunk.elements.size(); ++idx) {
+            auto slot = container.element_slots.find(chunk.elements[idx]);
+            if (slot != container.element_slots.end())
+                chunk_volumes.emplace_back(chunk.data[idx], slot.value());
+        }
+
+        QElapsedTimer copy_timer;
+        copy_timer.start();
+        parallelFor(chunk_volumes.size() * volume_depth, [&](size_t idx) {
+            auto [volume_data, slot] = chunk_volumes[idx / volume_depth];
+            copyVolumeSlice(draw_properties, volume_data, atlas_data, atlas_dims, container.blockOrigin(slot), idx % volume_depth);
+        });
+        copy_nanoseconds += copy_timer.nsecsElapsed();
+
+        for (auto &[volume_data, slot] : chunk_volumes)
+            page_tracker.fill(slot);
+    }, progress);
+    if (!is_read)
+        qDebug() << "Not all volumes could be read, the atlas is incomplete";
+    page_tracker.finish();
+
+    // Not needed anymore. This also releases the mapping of the data file.
+    delete draw_properties->element_cache;
+    draw_properties->element_cache = nullptr;
+
+    qDebug() << "Filling volume atlas took" << timer.elapsed() << "milliseconds, of which copying volumes took" << copy_nanoseconds / 1000000 << "milliseconds on" << numParallelWorkers() << "threads";
+    qDebug() << "Determining the occupancy of" << OCCUPANCY_BRICK_SIZE << "voxel bricks took" << occupancy_nanoseconds / 1000000 << "milliseconds";
+
+    return is_read;
 }
@@ -4,21 +4,55 @@
 #include <QImage>
 #include <QVector3D>
 #include <QMap>
+#include <functional>
 
 #include <drawing/model/tree_draw_properties.h>
+#include <util/progress.h>
+
+const size_t ATLAS_MAX_MIP_LEVELS = 6;              // Maximum number of levels of an image atlas, including the full resolution.
+const size_t ATLAS_GUTTER_FRACTION = 16;            // The gutter of an image stays within this fraction of its shortest side.
+const size_t OCCUPANCY_BRICK_SIZE = 8;              // Voxels along every side of a brick of the occupancy grid of volumes.
+const size_t PAGED_VOLUME_ATLAS_SIZE = size_t(1) << 30;    // Maximum number of bytes of a volume atlas that holds the elements on demand.
 
 /**
  * @brief The AtlasContainer class Container containing either an image atlas or a volume atlas.
  */
 struct AtlasContainer
 {
-    QMap<QPair<size_t, size_t>, QVector3D> mapping; // Mapping of the [height, index] to a vector of [u, v, w].
-    QVector3D coord_offsets;                        // [u, v, w] offsets to apply to the mapping origin.
-    QList<unsigned char> data;                      // Actual data of the atlas, to be loaded into an OpenGL Texture
+    QMap<size_t, QVector3D> mapping;                // Mapping of the element to a vector of [u, v, w]. Nodes sharing an element share its block.
+    QMap<size_t, size_t> element_slots;             // Mapping of the element to the block it occupies in the atlas.
+    QVector3D coord_offsets;                        // [u, v, w] extent of a block, to apply to the mapping origin.
+    QList<unsigned char> data;                      // Actual data of the atlas, to be loaded into an OpenGL Texture. Empty when loading lazily.
+    QList<unsigned char> occupancy;                 // [min, max] value of every brick of the volume blocks, laid out like the atlas. Empty for images and when loading lazily.
     std::array<size_t, 3> dims;
+    std::array<size_t, 3> block_dims;               // [x, y, z] texels reserved for every element, which are the dims of the element and its gutter. z is 1 for images.
+    size_t gutter = 0;                                // Texels around every image filled with its edges, so filtering never reaches neighbouring blocks. 0 for volumes.
+    size_t num_levels = 1;                            // Number of mip levels, stored one after the other in every page. 1 for volumes.
+    DrawType draw_type;
+    bool is_paged = false;                          // The atlas is too small for all elements, so blocks are assigned on demand and the slots and mapping start empty.
+
+    std::array<size_t, 3> blockOrigin(size_t slot) const;
+    QVector3D blockCoords(size_t slot) const;
+    size_t blocksPerPage() const;
+    size_t numPages() const;
+    size_t pageSize() const;
+    size_t levelOffset(size_t level) const;
+    std::array<size_t, 3> occupancyBlockDims() const;
+    std::array<size_t, 3> occupancyDims() const;
+    std::array<size_t, 3> occupancyOrigin(size_t slot) const;
 };
 
-AtlasContainer createImageAtlasContainer(TreeDrawProperties *draw_properties, size_t max_2D_texture_dim);
-AtlasContainer createVolumeAtlasContainer(TreeDrawProperties *draw_properties, size_t max_3D_texture_dim);
+using PageCallback = std::function<void(size_t page, const unsigned char *page_data)>;    // Receives a complete page of the atlas data.
+
+AtlasContainer createAtlasLayout(TreeDrawProperties *draw_properties, size_t max_texture_dim);
+bool fillImageAtlas(TreeDrawProperties *draw_properties, AtlasContainer &container, const ProgressCallback &progress = nullptr, const PageCallback &page_ready = nullptr);
+bool fillVolumeAtlas(TreeDrawProperties *draw_properties, AtlasContainer &container, const ProgressCallback &progress = nullptr, const PageCallback &page_ready = nullptr);
+
+void fillVolumeOccupancy(AtlasContainer &container, size_t page, const unsigned char *page_data);
+QList<unsigned char> createVolumeOccupancyBlock(const AtlasContainer &container, const unsigned char *volume_data);
+QList<quint32> createVolumeGradientPage(const AtlasContainer &container, size_t page, const unsigned char *page_data);
+QList<quint32> createVolumeGradientBlock(const AtlasContainer &container, const unsigned char *volume_data);
+
+QList<unsigned char> createImageAtlasBlock(TreeDrawProperties *draw_properties, const AtlasContainer &container, const unsigned char *image_data);
 
 #endif // IMAGE_ATLAS_H
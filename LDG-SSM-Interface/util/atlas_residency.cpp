@@ -0,0 +1,69 @@
+#include "atlas_residency.h"
+
+/**
+ * @brief AtlasResidency::AtlasResidency
+ * @param num_slots Number of blocks in the atlas.
+ */
+AtlasResidency::AtlasResidency(size_t num_slots)
+{
+    // Lowest slots first, so a partially used atlas fills its first pages.
+    free_slots.reserve(num_slots);
+    for (size_t slot = num_slots; slot > 0; --slot)
+        free_slots.push_back(slot - 1);
+}
+
+/**
+ * @brief AtlasResidency::touch Mark a resident element as used, so it's evicted last.
+ * @param element
+ * @return True if the element is resident.
+ */
+bool AtlasResidency::touch(size_t element)
+{
+    auto entry = entries.find(element);
+    if (entry == entries.end())
+        return false;
+
+    lru_order.splice(lru_order.begin(), lru_order, entry->lru_position);
+    return true;
+}
+
+/**
+ * @brief AtlasResidency::acquire Assign a block to an element that isn't resident. If no block is free, the least recently used element that isn't pinned is evicted.
+ * @param element
+ * @param pinned_elements Elements that may not be evicted, like the ones currently drawn.
+ * @param slot Receives the block of the element.
+ * @param evicted_element Receives the element that was evicted, or -1 if a free block was used.
+ * @return False if all blocks are pinned, in which case the element stays out of the atlas.
+ */
+bool AtlasResidency::acquire(size_t element, const QSet<size_t> &pinned_elements, size_t &slot, long long &evicted_element)
+{
+    evicted_element = -1;
+    if (free_slots.empty()) {
+        auto victim = lru_order.rbegin();
+        while (victim != lru_order.rend() && pinned_elements.contains(*victim))
+            ++victim;
+        if (victim == lru_order.rend())
+            return false;
+
+        size_t evicted = *victim;
+        evicted_element = static_cast<long long>(evicted);
+        free_slots.push_back(entries[evicted].slot);
+        lru_order.erase(entries[evicted].lru_position);
+        entries.remove(evicted);
+    }
+
+    slot = free_slots.back();
+    free_slots.pop_back();
+    lru_order.push_front(element);
+    entries.insert(element, { slot, lru_order.begin() });
+    return true;
+}
+
+/**
+ * @brief AtlasResidency::size
+ * @return Number of resident elements.
+ */
+size_t AtlasResidency::size() const
+{
+    return entries.size();
+}
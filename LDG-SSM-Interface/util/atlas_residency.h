@@ -0,0 +1,35 @@
+#ifndef ATLAS_RESIDENCY_H
+#define ATLAS_RESIDENCY_H
+
+#include <QHash>
+#include <QSet>
+#include <cstddef>
+#include <list>
+#include <vector>
+
+/**
+ * @brief The AtlasResidency class Keeps track of the elements occupying the blocks of a paged atlas, which holds fewer blocks than there are elements.
+ * Blocks are handed out on demand, evicting the least recently used element when the atlas is full.
+ */
+class AtlasResidency
+{
+    struct Entry
+    {
+        size_t slot;
+        std::list<size_t>::iterator lru_position;
+    };
+
+    std::list<size_t> lru_order;            // Resident elements, most recently used first.
+    QHash<size_t, Entry> entries;
+    std::vector<size_t> free_slots;
+
+public:
+    explicit AtlasResidency(size_t num_slots);
+
+    bool touch(size_t element);
+    bool acquire(size_t element, const QSet<size_t> &pinned_elements, size_t &slot, long long &evicted_element);
+
+    size_t size() const;
+};
+
+#endif // ATLAS_RESIDENCY_H
@@ -0,0 +1,322 @@
+#include "dataset_loader.h"
+#include "drawing/atlas_texture.h"
+#include "util/atlas_cache.h"
+#include "input/data_buffer.h"
+#include "util/element_cache.h"
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QElapsedTimer>
+
+/**
+ * @brief DatasetLoader::DatasetLoader
+ * @param render_view View whose context receives the atlas texture.
+ * @param parent
+ */
+DatasetLoader::DatasetLoader(RenderView *render_view, QObject *parent):
+    QObject(parent),
+    render_view(render_view),
+    thread(nullptr),
+    is_cancelled(false),
+    reported_progress(-1),
+    pending_gradient_pages(MAX_PENDING_GRADIENT_PAGES),
+    tree_properties(nullptr),
+    atlas_texture(nullptr),
+    gradient_texture(nullptr)
+{
+}
+
+/**
+ * @brief DatasetLoader::~DatasetLoader Cancel a running load and wait for it to stop.
+ */
+DatasetLoader::~DatasetLoader()
+{
+    stop();
+}
+
+/**
+ * @brief DatasetLoader::load Start loading a dataset in the background. A load that is still running is cancelled first.
+ * @param file_name
+ * @param loading_mode
+ * @param background_color Background color the atlas is built with.
+ */
+void DatasetLoader::load(QString file_name, LoadingMode loading_mode, QVector3D background_color)
+{
+    stop();
+
+    size_t max_2D_texture_dim = render_view->maxTextureDim(DrawType::IMAGE);
+    size_t max_3D_texture_dim = render_view->maxTextureDim(DrawType::VOLUME);
+
+    is_cancelled = false;
+    thread = QThread::create([=]() {
+        run(file_name, loading_mode, background_color, max_2D_texture_dim, max_3D_texture_dim);
+    });
+    thread->start();
+}
+
+/**
+ * @brief DatasetLoader::cancel Request the running load to stop. It stops at the next progress report and reports itself as cancelled.
+ */
+void DatasetLoader::cancel()
+{
+    is_cancelled = true;
+}
+
+/**
+ * @brief DatasetLoader::takeTreeProperties Take the tree properties of the last successful load. The caller becomes the owner.
+ * @return The loaded properties, or nullptr if there are none.
+ */
+TreeDrawProperties *DatasetLoader::takeTreeProperties()
+{
+    TreeDrawProperties *loaded_properties = tree_properties;
+    tree_properties = nullptr;
+    return loaded_properties;
+}
+
+/**
+ * @brief DatasetLoader::takeAtlasContainer Take the layout of the atlas built during the last successful load.
+ * The atlas data itself is released, as it has been uploaded to the atlas texture.
+ * @return
+ */
+AtlasContainer DatasetLoader::takeAtlasContainer()
+{
+    AtlasContainer loaded_container = std::move(atlas_container);
+    atlas_container = AtlasContainer();
+    atlas_mapping.reset();
+    loaded_container.data = QList<unsigned char>();
+    return loaded_container;
+}
+
+/**
+ * @brief DatasetLoader::takeAtlasTexture Take the texture of the atlas built during the last successful load. The caller becomes the owner.
+ * @return The texture, or nullptr if there is none.
+ */
+QOpenGLTexture *DatasetLoader::takeAtlasTexture()
+{
+    QOpenGLTexture *loaded_texture = atlas_texture;
+    atlas_texture = nullptr;
+    return loaded_texture;
+}
+
+/**
+ * @brief DatasetLoader::takeGradientTexture Take the gradient texture of the volume atlas built during the last successful load. The caller becomes the owner.
+ * @return The texture, or nullptr if there is none.
+ */
+QOpenGLTexture *DatasetLoader::takeGradientTexture()
+{
+    QOpenGLTexture *loaded_texture = gradient_texture;
+    gradient_texture = nullptr;
+    return loaded_texture;
+}
+
+/**
+ * @brief DatasetLoader::stop Cancel the running load, wait for it and discard its results and pending signals.
+ */
+void DatasetLoader::stop()
+{
+    if (thread != nullptr) {
+        cancel();
+        thread->wait();
+        delete thread;
+        thread = nullptr;
+    }
+
+    // Signals and uploads of the stopped load shouldn't be handled anymore.
+    // The gradient pages of the removed uploads are freed with them, so they no longer count as pending.
+    QCoreApplication::removePostedEvents(this, QEvent::MetaCall);
+    int num_removed_pages = MAX_PENDING_GRADIENT_PAGES - pending_gradient_pages.available();
+    if (num_removed_pages > 0)
+        pending_gradient_pages.release(num_removed_pages);
+    discardResults();
+}
+
+/**
+ * @brief DatasetLoader::discardResults Free the results of the last load that haven't been taken.
+ */
+void DatasetLoader::discardResults()
+{
+    if (tree_properties != nullptr)
+        delete tree_properties->element_cache;
+    delete tree_properties;
+    tree_properties = nullptr;
+    atlas_container = AtlasContainer();
+    atlas_mapping.reset();
+
+    if (atlas_texture != nullptr || gradient_texture != nullptr) {
+        render_view->makeCurrent();
+        delete atlas_texture;
+        delete gradient_texture;
+        render_view->doneCurrent();
+        atlas_texture = nullptr;
+        gradient_texture = nullptr;
+    }
+}
+
+/**
+ * @brief DatasetLoader::run Read the dataset and build its atlas. Runs on the worker thread.
+ * Reading, packing and uploading overlap: elements are read ahead of packing, and every completed page is uploaded while the next ones are packed.
+ * A built atlas is written to the atlas cache after the load has finished, and uploaded straight from the cache the next time the dataset is opened.
+ * @param file_name
+ * @param loading_mode
+ * @param background_color
+ * @param max_2D_texture_dim
+ * @param max_3D_texture_dim
+ */
+void DatasetLoader::run(QString file_name, LoadingMode loading_mode, QVector3D background_color, size_t max_2D_texture_dim, size_t max_3D_texture_dim)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    ProgressCallback progress = [this](size_t processed, size_t total) {
+        return reportProgress(processed, total);
+    };
+
+    auto *loaded_properties = new TreeDrawProperties();
+    loaded_properties->background_color = background_color;
+
+    setPhase("Reading dataset");
+    bool is_loaded = readInput(file_name, *loaded_properties, loading_mode, progress) && !is_cancelled;
+
+    AtlasContainer loaded_container;
+    std::shared_ptr<MappedFile> loaded_mapping;
+    const unsigned char *cached_data = nullptr;
+    QString cache_file_name;
+    if (is_loaded) {
+        size_t max_texture_dim = loaded_properties->draw_type == DrawType::IMAGE ? max_2D_texture_dim : max_3D_texture_dim;
+        if (loading_mode == LoadingMode::EAGER) {
+            setPhase("Reading cached atlas");
+            cache_file_name = atlasCacheFileName(loaded_properties, max_texture_dim);
+            if (readAtlasCache(cache_file_name, loaded_properties->disparities.size(), loaded_container, loaded_mapping, cached_data)) {
+                delete loaded_properties->element_cache;
+                loaded_properties->element_cache = nullptr;
+            }
+        }
+
+        // A paged atlas is filled while drawing like a lazy one, so the elements stay available.
+        if (cached_data == nullptr) {
+            setPhase(loading_mode == LoadingMode::LAZY ? "Preparing atlas" : "Building atlas");
+            loaded_container = createAtlasLayout(loaded_properties, max_texture_dim);
+        }
+
+        // Compressed elements that are read eagerly can only be streamed in order, while a paged atlas reads them at random.
+        if (loading_mode == LoadingMode::EAGER && cached_data == nullptr && loaded_container.is_paged) {
+            setPhase("Preparing elements");
+            is_loaded = makeElementsRandomAccess(*loaded_properties, progress) && !is_cancelled;
+        }
+    }
+
+    if (is_loaded) {
+        bool is_image = loaded_properties->draw_type == DrawType::IMAGE;
+
+        // The texture lives in the context of the view, so it's created and filled on the thread of the loader.
+        // The uploads only use a copy of the layout, as the data of the container is still being written.
+        // A paged atlas already takes up the memory for volumes, so it has no gradients.
+        const AtlasContainer layout = loaded_container;
+        bool has_gradients = !is_image && !layout.is_paged;
+        QMetaObject::invokeMethod(this, [this, layout, has_gradients]() {
+            render_view->makeCurrent();
+            atlas_texture = createAtlasTexture(layout);
+            if (has_gradients)
+                gradient_texture = createGradientTexture(layout);
+            render_view->doneCurrent();
+        }, Qt::QueuedConnection);
+
+        // The gradients of a volume page are determined into a buffer of their own, which is released once uploaded.
+        // Only a few of these pages may wait for their upload, so the worker waits when the uploads fall behind, unless the load is cancelled.
+        qint64 gradient_nanoseconds = 0;
+        PageCallback page_ready = [this, &layout, has_gradients, &gradient_nanoseconds](size_t page, const unsigned char *page_data) {
+            QList<quint32> page_gradients;
+            if (has_gradients) {
+                while (!pending_gradient_pages.tryAcquire(1, 100)) {
+                    if (is_cancelled)
+                        return;
+                }
+
+                QElapsedTimer gradient_timer;
+                gradient_timer.start();
+                page_gradients = createVolumeGradientPage(layout, page, page_data);
+                gradient_nanoseconds += gradient_timer.nsecsElapsed();
+            }
+
+            QMetaObject::invokeMethod(this, [this, layout, page, page_data, page_gradients]() {
+                render_view->makeCurrent();
+                uploadAtlasPage(atlas_texture, layout, page, page_data);
+                if (!page_gradients.isEmpty()) {
+                    uploadGradientPage(gradient_texture, layout, page, page_gradients.constData());
+                    pending_gradient_pages.release();
+                }
+                render_view->doneCurrent();
+            }, Qt::QueuedConnection);
+        };
+        if (cached_data != nullptr) {
+            // The occupancy and gradients of volumes aren't cached, as they're quickly determined from the pages while they are uploaded.
+            for (size_t page = 0; page < layout.numPages(); ++page) {
+                if (!is_image)
+                    fillVolumeOccupancy(loaded_container, page, cached_data + page * layout.pageSize());
+                page_ready(page, cached_data + page * layout.pageSize());
+            }
+        } else if (loading_mode == LoadingMode::EAGER && !layout.is_paged) {
+            if (is_image)
+                fillImageAtlas(loaded_properties, loaded_container, progress, page_ready);
+            else
+                fillVolumeAtlas(loaded_properties, loaded_container, progress, page_ready);
+        }
+        if (gradient_nanoseconds > 0)
+            qDebug() << "Determining the gradients took" << gradient_nanoseconds / 1000000 << "milliseconds";
+        is_loaded = !is_cancelled;
+    }
+
+    // The atlas data is kept until the results are handled, as pending uploads still read from it.
+    // A freshly built atlas is cached from a shallow copy, as the results may be taken while it's written.
+    AtlasContainer built_container = is_loaded && cached_data == nullptr ? loaded_container : AtlasContainer();
+    tree_properties = loaded_properties;
+    atlas_container = std::move(loaded_container);
+    atlas_mapping = std::move(loaded_mapping);
+    if (is_loaded)
+        qDebug() << "Loading dataset in the background took" << timer.elapsed() << "milliseconds";
+
+    bool was_cancelled = is_cancelled;
+    QMetaObject::invokeMethod(this, [this, is_loaded, was_cancelled]() {
+        if (!is_loaded)
+            discardResults();
+        emit finished(is_loaded, was_cancelled);
+    }, Qt::QueuedConnection);
+
+    // Writing the cache doesn't hold up the interface, but is cancelled by a new load.
+    if (!built_container.data.isEmpty()) {
+        timer.restart();
+        if (writeAtlasCache(cache_file_name, built_container, [this](size_t, size_t) { return !is_cancelled; }))
+            qDebug() << "Writing atlas cache took" << timer.elapsed() << "milliseconds";
+    }
+}
+
+/**
+ * @brief DatasetLoader::setPhase Report the start of a new phase of loading. Runs on the worker thread.
+ * @param description
+ */
+void DatasetLoader::setPhase(QString description)
+{
+    reported_progress = 0;
+    QMetaObject::invokeMethod(this, [this, description]() {
+        emit phaseChanged(description);
+        emit progressChanged(0);
+    }, Qt::QueuedConnection);
+}
+
+/**
+ * @brief DatasetLoader::reportProgress Report the progress of the current phase. Runs on the worker thread.
+ * @param processed
+ * @param total
+ * @return False if the load was cancelled.
+ */
+bool DatasetLoader::reportProgress(size_t processed, size_t total)
+{
+    int per_mille = total == 0 ? 1000 : static_cast<int>(std::min<size_t>(processed, total) * 1000 / total);
+    if (per_mille != reported_progress) {
+        reported_progress = per_mille;
+        QMetaObject::invokeMethod(this, [this, per_mille]() {
+            emit progressChanged(per_mille);
+        }, Qt::QueuedConnection);
+    }
+    return !is_cancelled;
+}
@@ -0,0 +1,66 @@
+#ifndef DATASET_LOADER_H
+#define DATASET_LOADER_H
+
+#include "drawing/model/tree_draw_properties.h"
+#include "input/mapped_file.h"
+#include "util/atlas_container.h"
+#include "widgets/render_view.h"
+
+#include <QObject>
+#include <QSemaphore>
+#include <QString>
+#include <QThread>
+#include <QVector3D>
+#include <atomic>
+#include <memory>
+
+const int MAX_PENDING_GRADIENT_PAGES = 2;           // Gradient pages that may wait for their upload, which bounds their memory.
+
+/**
+ * @brief The DatasetLoader class Reads a dataset and builds its atlas on a worker thread, so the interface stays responsive.
+ * Every completed page of the atlas is uploaded on the thread of the loader while the next pages are built.
+ * Built atlasses are kept in the atlas cache, so reopening a dataset only uploads the cached atlas.
+ * Progress and the result are reported through signals on the thread of the loader.
+ */
+class DatasetLoader : public QObject
+{
+    Q_OBJECT;
+
+    RenderView *render_view;                        // View whose context holds the atlas texture.
+    QThread *thread;
+    std::atomic<bool> is_cancelled;
+    int reported_progress;                          // Last reported progress in per mille, so the receiver isn't flooded with signals.
+    QSemaphore pending_gradient_pages;              // Acquired for every gradient page that is queued, released once it's uploaded.
+
+    // Results of the last load. Owned by the loader until taken.
+    TreeDrawProperties *tree_properties;
+    AtlasContainer atlas_container;
+    QOpenGLTexture *atlas_texture;
+    QOpenGLTexture *gradient_texture;               // Gradients of a volume atlas, filled page by page like the atlas. None for images and paged atlasses.
+    std::shared_ptr<MappedFile> atlas_mapping;      // Cached atlas whose pages are still being uploaded.
+
+    void run(QString file_name, LoadingMode loading_mode, QVector3D background_color, size_t max_2D_texture_dim, size_t max_3D_texture_dim);
+    void setPhase(QString description);
+    bool reportProgress(size_t processed, size_t total);
+    void stop();
+    void discardResults();
+
+public:
+    DatasetLoader(RenderView *render_view, QObject *parent = nullptr);
+    ~DatasetLoader();
+
+    void load(QString file_name, LoadingMode loading_mode, QVector3D background_color);
+    void cancel();
+
+    TreeDrawProperties *takeTreeProperties();
+    AtlasContainer takeAtlasContainer();
+    QOpenGLTexture *takeAtlasTexture();
+    QOpenGLTexture *takeGradientTexture();
+
+signals:
+    void phaseChanged(QString description);
+    void progressChanged(int per_mille);
+    void finished(bool is_loaded, bool is_cancelled);
+};
+
+#endif // DATASET_LOADER_H
@@ -0,0 +1,176 @@
+#include "element_cache.h"
+#include "input/element_pipeline.h"
+
+#include <QDebug>
+#include <QMutexLocker>
+
+/**
+ * @brief ElementCache::ElementCache
+ * @param source
+ * @param max_bytes Maximum number of bytes of decoded elements to keep. With 0 bytes, every element is decoded when requested.
+ */
+ElementCache::ElementCache(std::shared_ptr<ElementSource> source, size_t max_bytes):
+    source(source),
+    max_bytes(max_bytes),
+    num_bytes(0)
+{
+    prefetch_pool.setMaxThreadCount(ELEMENT_PREFETCH_THREADS);
+}
+
+/**
+ * @brief ElementCache::~ElementCache Cancel outstanding prefetches and wait for the running ones.
+ */
+ElementCache::~ElementCache()
+{
+    prefetch_pool.clear();
+    prefetch_pool.waitForDone();
+}
+
+/**
+ * @brief ElementCache::decode Read an element from the source into newly allocated memory.
+ * @param element
+ * @return The element data, or nullptr if the element could not be read.
+ */
+std::shared_ptr<const unsigned char> ElementCache::decode(size_t element)
+{
+    std::shared_ptr<unsigned char[]> data(new unsigned char[source->elementSize()]);
+    if (!source->readElement(element, data.get())) {
+        qDebug() << "Could not read element" << element;
+        return nullptr;
+    }
+    return std::shared_ptr<const unsigned char>(data, data.get());
+}
+
+/**
+ * @brief ElementCache::insert Add a decoded element and evict the least recently used elements until the cache fits its budget.
+ * Should be called with the mutex locked.
+ * @param element
+ * @param data
+ * @return The cached data of the element, which is the existing data if another thread inserted it first.
+ */
+std::shared_ptr<const unsigned char> ElementCache::insert(size_t element, std::shared_ptr<const unsigned char> data)
+{
+    auto existing = entries.find(element);
+    if (existing != entries.end())
+        return existing->data;
+
+    size_t element_size = source->elementSize();
+    if (data == nullptr || element_size > max_bytes)
+        return data;
+
+    lru_order.push_front(element);
+    entries.insert(element, { data, lru_order.begin() });
+    num_bytes += element_size;
+
+    // Evicted elements that are still in use stay alive until their last user releases them.
+    while (num_bytes > max_bytes) {
+        entries.remove(lru_order.back());
+        lru_order.pop_back();
+        num_bytes -= element_size;
+    }
+    return data;
+}
+
+/**
+ * @brief ElementCache::element Get the data of an element, reading it from the source if it's not cached.
+ * @param element
+ * @return The element data, which stays valid as long as the pointer is held. nullptr if the element could not be read.
+ */
+std::shared_ptr<const unsigned char> ElementCache::element(size_t element)
+{
+    const unsigned char *direct_data = source->elementData(element);
+    if (direct_data != nullptr)
+        return std::shared_ptr<const unsigned char>(source, direct_data);
+
+    {
+        QMutexLocker locker(&mutex);
+        auto entry = entries.find(element);
+        if (entry != entries.end()) {
+            lru_order.splice(lru_order.begin(), lru_order, entry->lru_position);
+            return entry->data;
+        }
+    }
+
+    // Decode outside of the lock, so prefetches and lookups of other elements continue meanwhile.
+    std::shared_ptr<const unsigned char> data = decode(element);
+    QMutexLocker locker(&mutex);
+    return insert(element, data);
+}
+
+/**
+ * @brief ElementCache::prefetch Read elements in the background, so they are cached by the time they are requested.
+ * @param elements
+ */
+void ElementCache::prefetch(const QList<size_t> &elements)
+{
+    for (size_t element : elements) {
+        if (source->elementData(element) != nullptr) {
+            source->prefetch(element);
+            continue;
+        }
+
+        QMutexLocker locker(&mutex);
+        if (max_bytes == 0 || entries.contains(element) || pending_prefetches.contains(element))
+            continue;
+
+        pending_prefetches.insert(element);
+        prefetch_pool.start([this, element]() {
+            std::shared_ptr<const unsigned char> data = decode(element);
+            QMutexLocker locker(&mutex);
+            insert(element, data);
+            pending_prefetches.remove(element);
+        });
+    }
+}
+
+/**
+ * @brief ElementCache::forEachElement Pass every element of the source to the callback in order, without caching them.
+ * The next elements are read on another thread while the callback processes the current ones.
+ * @param callback
+ * @param progress
+ * @return True if all elements were read.
+ */
+bool ElementCache::forEachElement(const ElementCallback &callback, const ProgressCallback &progress)
+{
+    return forEachElementPipelined(*source, callback, progress);
+}
+
+/**
+ * @brief ElementCache::forEachChunk Pass all elements of the source to the callback in chunks of consecutive elements, without caching them.
+ * The next chunks are read on another thread while the callback processes the current one.
+ * @param callback
+ * @param progress
+ * @return True if all elements were read.
+ */
+bool ElementCache::forEachChunk(const ChunkCallback &callback, const ProgressCallback &progress)
+{
+    return forEachChunkPipelined(*source, callback, progress);
+}
+
+/**
+ * @brief ElementCache::elementSource
+ * @return Source the elements are decoded from.
+ */
+std::shared_ptr<ElementSource> ElementCache::elementSource() const
+{
+    return source;
+}
+
+/**
+ * @brief ElementCache::elementSize
+ * @return Size of a single element in bytes.
+ */
+size_t ElementCache::elementSize() const
+{
+    return source->elementSize();
+}
+
+/**
+ * @brief ElementCache::size
+ * @return Number of bytes of decoded elements currently cached.
+ */
+size_t ElementCache::size()
+{
+    QMutexLocker locker(&mutex);
+    return num_bytes;
+}
@@ -0,0 +1,61 @@
+#ifndef ELEMENT_CACHE_H
+#define ELEMENT_CACHE_H
+
+#include "input/element_pipeline.h"
+#include "input/element_source.h"
+
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QSet>
+#include <QThreadPool>
+#include <cstddef>
+#include <list>
+#include <memory>
+
+const size_t ELEMENT_CACHE_SIZE = size_t(512) << 20;    // Maximum number of bytes of decoded elements kept in memory when elements are read while drawing.
+const int ELEMENT_PREFETCH_THREADS = 2;                 // Number of threads reading elements ahead of time.
+
+/**
+ * @brief The ElementCache class Least recently used cache of decoded elements, bounded by a byte budget.
+ * Elements that can be read without copying are never stored, these are only prefetched by the source.
+ */
+class ElementCache
+{
+    struct Entry
+    {
+        std::shared_ptr<const unsigned char> data;
+        std::list<size_t>::iterator lru_position;
+    };
+
+    std::shared_ptr<ElementSource> source;
+    size_t max_bytes;
+    size_t num_bytes;
+
+    std::list<size_t> lru_order;            // Cached elements, most recently used first.
+    QHash<size_t, Entry> entries;
+    QSet<size_t> pending_prefetches;
+    QMutex mutex;
+    QThreadPool prefetch_pool;
+
+    std::shared_ptr<const unsigned char> decode(size_t element);
+    std::shared_ptr<const unsigned char> insert(size_t element, std::shared_ptr<const unsigned char> data);
+
+public:
+    ElementCache(std::shared_ptr<ElementSource> source, size_t max_bytes);
+    ~ElementCache();
+
+    ElementCache(const ElementCache &) = delete;
+    ElementCache &operator=(const ElementCache &) = delete;
+
+    std::shared_ptr<const unsigned char> element(size_t element);
+    void prefetch(const QList<size_t> &elements);
+    bool forEachElement(const ElementCallback &callback, const ProgressCallback &progress = nullptr);
+    bool forEachChunk(const ChunkCallback &callback, const ProgressCallback &progress = nullptr);
+
+    std::shared_ptr<ElementSource> elementSource() const;
+    size_t elementSize() const;
+    size_t size();
+};
+
+#endif // ELEMENT_CACHE_H
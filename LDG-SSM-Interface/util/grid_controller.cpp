@@ -1,6 +1,10 @@
 #include "grid_controller.h"
+#include "parallel.h"
 #include "tree_functions.h"
-#include <QQueue>
+
+#include <QDebug>
+#include <QElapsedTimer>
+#include <limits>
 
 /**
  * @brief GridController::GridController
@@ -11,7 +15,9 @@
 GridController::GridController(TreeDrawProperties *tree_properties, WindowDrawProperties *window_properties, VolumeDrawProperties *volume_properties):
     tree_properties(tree_properties),
     window_properties(window_properties),
-    volume_properties(volume_properties)
+    volume_properties(volume_properties),
+    cut_threshold(0.),
+    is_cut_drawn(false)
 {
 }
 
@@ -22,10 +28,15 @@ GridController::GridController(TreeDrawProperties *tree_properties, WindowDrawPr
  */
 void GridController::splitNode(size_t height, size_t index)
 {
-    tree_properties->draw_array.remove({ height, index });
+    is_cut_drawn = false;
+    tree_properties->hideNode(tree_properties->nodeId(height, index));
     for (auto &child_index : getChildrenIndices(height, index, tree_properties)) {
-        if (child_index != -1 && !tree_properties->invalid_nodes.contains({ height - 1, child_index }))
-            tree_properties->draw_array.insert({ height - 1, child_index });
+        if (child_index == -1)
+            continue;
+
+        size_t child = tree_properties->nodeId(height - 1, child_index);
+        if (!tree_properties->invalid_nodes.contains(child))
+            tree_properties->drawNode(child);
     }
 }
 
@@ -35,35 +46,36 @@ void GridController::splitNode(size_t height, size_t index)
  * @param index
  * @param nodes_merged
  */
-void GridController::mergeNode(size_t height, size_t index, QSet<QPair<size_t, size_t>> *nodes_merged = nullptr)
+void GridController::mergeNode(size_t height, size_t index, NodeSet *nodes_merged = nullptr)
 {
+    is_cut_drawn = false;
+
     // Unset previous values, including children.
     auto parent_index = getParentIndex(height, index, tree_properties);
-    QQueue<std::pair<size_t, int>> queue;
+    merge_stack.clear();
     for (auto &child_index : getChildrenIndices(height + 1, parent_index, tree_properties))
-        queue.enqueue({ height, child_index });
-
-    while (!queue.isEmpty()) {
-        auto [node_height, node_index] = queue.dequeue();
-        bool is_removed = node_index != -1 && tree_properties->draw_array.remove({ node_height, node_index });
-
-        if (
-            !is_removed &&
-            node_index != -1 &&
-            node_height > 0 &&
-            !tree_properties->invalid_nodes.contains({ node_height, node_index })
-        ) {
+        merge_stack.push_back({ height, child_index });
+
+    while (!merge_stack.empty()) {
+        auto [node_height, node_index] = merge_stack.back();
+        merge_stack.pop_back();
+        if (node_index == -1)
+            continue;
+
+        size_t node = tree_properties->nodeId(node_height, node_index);
+        bool is_removed = tree_properties->hideNode(node);
+        if (!is_removed && node_height > 0 && !tree_properties->invalid_nodes.contains(node)) {
             for (auto &child_index : getChildrenIndices(node_height, node_index, tree_properties))
-                queue.enqueue({ node_height - 1, child_index });
+                merge_stack.push_back({ node_height - 1, child_index });
         }
 
         // Keep track of the nodes that have been merged
         if (is_removed && nodes_merged != nullptr)
-            nodes_merged->insert({ node_height, node_index });
+            nodes_merged->insert(node);
     }
 
     // Finally, add the parent
-    tree_properties->draw_array.insert({ height + 1, parent_index });
+    tree_properties->drawNode(tree_properties->nodeId(height + 1, parent_index));
 }
 
 /**
@@ -76,10 +88,12 @@ void GridController::selectHeight(size_t height)
         auto [num_rows, num_cols] = tree_properties->height_dims[height];
 
         // Update draw array
-        tree_properties->draw_array.clear();
-        for (size_t idx = 0; idx < num_rows * num_cols; ++idx) {
-            if (!tree_properties->invalid_nodes.contains({ height, idx }))
-                tree_properties->draw_array.insert({ height, idx });
+        is_cut_drawn = false;
+        tree_properties->hideAllNodes();
+        size_t start = tree_properties->nodeId(height, 0);
+        for (size_t node = start; node < start + num_rows * num_cols; ++node) {
+            if (!tree_properties->invalid_nodes.contains(node))
+                tree_properties->drawNode(node);
         }
 
         emit gridChanged();
@@ -87,40 +101,173 @@ void GridController::selectHeight(size_t height)
 }
 
 /**
- * @brief GridController::selectDisparity
- * @param disparity
+ * @brief GridController::initializeCut Determine the threshold interval in which every node is in the cut of the tree, in parallel per row of a height.
+ * Should be called whenever a new tree is loaded.
  */
-void GridController::selectDisparity(double disparity_threshold)
+void GridController::initializeCut()
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    const double infinity = std::numeric_limits<double>::infinity();
+    cut_exits.assign(tree_properties->numNodes(), -infinity);
+    is_cut_drawn = false;
+    if (cut_exits.empty())
+        return;
+
+    // The root is in the cut of every threshold above its entry. Below it, the exits only decrease towards the leaves.
+    size_t root = tree_properties->nodeId(tree_properties->tree_max_height, 0);
+    if (!tree_properties->invalid_nodes.contains(root))
+        cut_exits[root] = infinity;
+
+    for (size_t height = tree_properties->tree_max_height; height-- > 0;) {
+        auto [num_rows, num_cols] = tree_properties->height_dims[height];
+        parallelFor(num_rows, [&, height = height, num_cols = num_cols](size_t row) {
+            for (size_t index = row * num_cols; index < (row + 1) * num_cols; ++index) {
+                size_t node = tree_properties->nodeId(height, index);
+                size_t parent = tree_properties->nodeId(height + 1, getParentIndex(height, index, tree_properties));
+                if (!tree_properties->invalid_nodes.contains(node) && cut_exits[parent] > -infinity)
+                    cut_exits[node] = std::min(cut_exits[parent], tree_properties->nodeDisparity(parent));
+            }
+        });
+    }
+
+    qDebug() << "Determining the disparity cut intervals of" << cut_exits.size() << "nodes took" << timer.elapsed() << "milliseconds";
+}
+
+/**
+ * @brief GridController::cutEntry
+ * @param node
+ * @return The lowest threshold at which the node can be in the cut, see cut_exits.
+ */
+double GridController::cutEntry(size_t node) const
+{
+    if (tree_properties->nodeLocation(node).first == 0)
+        return -std::numeric_limits<double>::infinity();
+    return tree_properties->nodeDisparity(node);
+}
+
+/**
+ * @brief GridController::buildCut Replace the draw array with the cut of a threshold, by descending from the root into every node whose disparity exceeds the threshold.
+ * @param disparity_threshold
+ */
+void GridController::buildCut(double disparity_threshold)
+{
+    tree_properties->hideAllNodes();
+
+    size_t root = tree_properties->nodeId(tree_properties->tree_max_height, 0);
+    drawn_nodes.clear();
+    if (!tree_properties->invalid_nodes.contains(root))
+        drawn_nodes.push_back(root);
+
+    while (!drawn_nodes.empty()) {
+        size_t node = drawn_nodes.back();
+        drawn_nodes.pop_back();
+        if (disparity_threshold >= cutEntry(node)) {
+            tree_properties->drawNode(node);
+            continue;
+        }
+
+        auto [height, index] = tree_properties->nodeLocation(node);
+        for (auto &child_index : getChildrenIndices(height, index, tree_properties)) {
+            if (child_index == -1)
+                continue;
+
+            size_t child = tree_properties->nodeId(height - 1, child_index);
+            if (!tree_properties->invalid_nodes.contains(child))
+                drawn_nodes.push_back(child);
+        }
+    }
+}
+
+/**
+ * @brief GridController::raiseCut Move the drawn cut up to a higher threshold. Every node that passed its exit is replaced by the ancestor whose interval holds the threshold.
+ * @param disparity_threshold
+ * @return True if any node was replaced.
+ */
+bool GridController::raiseCut(double disparity_threshold)
 {
     bool changed = false;
-    QSet<QPair<size_t, size_t>> nodes_merged;
-    size_t changes;
+    tree_properties->draw_array.values(drawn_nodes);
+    for (size_t node : drawn_nodes) {
+        if (disparity_threshold < cut_exits[node])
+            continue;
+        changed = true;
 
-    do {
-        changes = 0;
+        // Siblings replaced earlier already put the ancestor in the draw array.
+        tree_properties->hideNode(node);
+        auto [height, index] = tree_properties->nodeLocation(node);
+        do {
+            index = getParentIndex(height, index, tree_properties);
+            ++height;
+        } while (disparity_threshold >= cut_exits[tree_properties->nodeId(height, index)]);
+        tree_properties->drawNode(tree_properties->nodeId(height, index));
+    }
+    return changed;
+}
 
-        for (auto location : tree_properties->draw_array.values()) {
-            auto [height, index] = location;
-            double node_disparity = tree_properties->disparities[location];
+/**
+ * @brief GridController::lowerCut Move the drawn cut down to a lower threshold. Every node below its entry is replaced by the descendants whose interval holds the threshold.
+ * @param disparity_threshold
+ * @return True if any node was replaced.
+ */
+bool GridController::lowerCut(double disparity_threshold)
+{
+    bool changed = false;
+    tree_properties->draw_array.values(drawn_nodes);
+    for (size_t node : drawn_nodes) {
+        if (disparity_threshold >= cutEntry(node))
+            continue;
+        changed = true;
+
+        // The node itself is split first, leaves are never split.
+        tree_properties->hideNode(node);
+        auto [node_height, node_index] = tree_properties->nodeLocation(node);
+        merge_stack.clear();
+        merge_stack.push_back({ node_height, static_cast<int>(node_index) });
+        while (!merge_stack.empty()) {
+            auto [height, index] = merge_stack.back();
+            merge_stack.pop_back();
 
-            // If the disparity is bigger than the threshold, consider the children.
-            if (node_disparity > disparity_threshold && height > 0) {
-                splitNode(height, index);
-                ++changes;
+            size_t descendant = tree_properties->nodeId(height, index);
+            if (disparity_threshold >= cutEntry(descendant)) {
+                tree_properties->drawNode(descendant);
+                continue;
             }
 
-            // If the disparity is smaller than the threshold, consider the parents. Check if we haven't already merged this node.
-            if (node_disparity < disparity_threshold && height < tree_properties->tree_max_height && !nodes_merged.contains({ height, index })) {
-                auto parent_index = getParentIndex(height, index, tree_properties);
-                if (tree_properties->disparities[{ height + 1, parent_index }] <= disparity_threshold) {
-                    mergeNode(height, index, &nodes_merged);
-                    ++changes;
-                }
+            for (auto &child_index : getChildrenIndices(height, index, tree_properties)) {
+                if (child_index != -1 && !tree_properties->invalid_nodes.contains(tree_properties->nodeId(height - 1, child_index)))
+                    merge_stack.push_back({ height - 1, child_index });
             }
         }
-        changed = changed || changes > 0;
-    } while (changes > 0);
+    }
+    return changed;
+}
+
+/**
+ * @brief GridController::selectDisparity Draw the cut of the tree at a disparity threshold: every node whose disparity is at most the threshold, and whose ancestors all exceed it.
+ * Only the nodes whose interval starts or ends between the drawn threshold and the new one are changed, so moving the threshold scales with the drawn nodes.
+ * @param disparity_threshold
+ */
+void GridController::selectDisparity(double disparity_threshold)
+{
+    if (cut_exits.size() != tree_properties->numNodes())
+        initializeCut();
+
+    bool changed;
+    if (!is_cut_drawn) {
+        buildCut(disparity_threshold);
+        changed = true;
+    } else if (disparity_threshold > cut_threshold) {
+        changed = raiseCut(disparity_threshold);
+    } else if (disparity_threshold < cut_threshold) {
+        changed = lowerCut(disparity_threshold);
+    } else {
+        return;
+    }
 
+    cut_threshold = disparity_threshold;
+    is_cut_drawn = true;
     if (changed)
         emit gridChanged();
 }
@@ -6,6 +6,7 @@
 #include <QObject>
 #include <QMouseEvent>
 #include <QPoint>
+#include <vector>
 
 #include <drawing/model/volume_draw_properties.h>
 #include <drawing/model/window_draw_properties.h>
@@ -22,11 +23,27 @@ class GridController: public QObject
     WindowDrawProperties *window_properties;
     VolumeDrawProperties *volume_properties;
 
+    // Buffers reused between grid operations, so these don't allocate once they have grown.
+    std::vector<std::pair<size_t, int>> merge_stack;
+    std::vector<size_t> drawn_nodes;
+
+    // A node is in the cut of a disparity threshold if the threshold is in [entry, exit) of the node.
+    // The entry is the disparity of the node, or -infinity for leaves, and the exit the lowest disparity of its ancestors.
+    std::vector<double> cut_exits;                  // Exit threshold of every node by node id. -infinity for void nodes and their descendants.
+    double cut_threshold;                           // Threshold of the cut in the draw array, if it's still drawn.
+    bool is_cut_drawn;                              // The draw array holds the cut of the threshold, and hasn't been changed by hand.
+
+    double cutEntry(size_t node) const;
+    void buildCut(double disparity_threshold);
+    bool raiseCut(double disparity_threshold);
+    bool lowerCut(double disparity_threshold);
+
 public:
     GridController(TreeDrawProperties *draw_properties, WindowDrawProperties *window_properties, VolumeDrawProperties *volume_properties);
 
     void splitNode(size_t height, size_t index);
-    void mergeNode(size_t height, size_t index, QSet<QPair<size_t, size_t>> *nodes_merged);
+    void mergeNode(size_t height, size_t index, NodeSet *nodes_merged);
+    void initializeCut();
 
 public slots:
     void selectHeight(size_t height);
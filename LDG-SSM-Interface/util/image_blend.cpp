@@ -0,0 +1,203 @@
+#include "image_blend.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LDG_SSM_HAS_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+/**
+ * @brief divideBy255 Divide by 255 with rounding, exact for every value up to 255 * 255.
+ * @param value
+ * @return
+ */
+inline uint32_t divideBy255(uint32_t value)
+{
+    value += 128;
+    return (value + (value >> 8)) >> 8;
+}
+
+/**
+ * @brief blendScalar Blend straight alpha RGBA pixels on the background and write them as opaque BGRA pixels.
+ * @param rgba
+ * @param bgra
+ * @param num_pixels
+ * @param background Background as 0xAARRGGBB.
+ */
+void blendScalar(const unsigned char *rgba, unsigned char *bgra, size_t num_pixels, uint32_t background)
+{
+    uint32_t background_b = background & 0xff;
+    uint32_t background_g = (background >> 8) & 0xff;
+    uint32_t background_r = (background >> 16) & 0xff;
+
+    for (size_t pixel = 0; pixel < num_pixels; ++pixel, rgba += 4, bgra += 4) {
+        uint32_t alpha = rgba[3];
+        uint32_t inverse_alpha = 255 - alpha;
+        bgra[0] = divideBy255(rgba[2] * alpha + background_b * inverse_alpha);
+        bgra[1] = divideBy255(rgba[1] * alpha + background_g * inverse_alpha);
+        bgra[2] = divideBy255(rgba[0] * alpha + background_r * inverse_alpha);
+        bgra[3] = 255;
+    }
+}
+
+#ifdef LDG_SSM_HAS_X86_KERNELS
+
+/**
+ * @brief blendChannelsSSSE3 Blend 16-bit channels on the background channels, see blendScalar.
+ * @param channels
+ * @param alpha Alpha of the pixel for each of its channels.
+ * @param background_channels
+ * @return Blended channels.
+ */
+__attribute__((target("ssse3")))
+inline __m128i blendChannelsSSSE3(__m128i channels, __m128i alpha, __m128i background_channels)
+{
+    __m128i value = _mm_add_epi16(
+        _mm_add_epi16(_mm_mullo_epi16(channels, alpha), _mm_mullo_epi16(background_channels, _mm_sub_epi16(_mm_set1_epi16(255), alpha))),
+        _mm_set1_epi16(128)
+    );
+    return _mm_srli_epi16(_mm_add_epi16(value, _mm_srli_epi16(value, 8)), 8);
+}
+
+/**
+ * @brief blendChannelsAVX2 Blend 16-bit channels on the background channels, see blendScalar.
+ * @param channels
+ * @param alpha Alpha of the pixel for each of its channels.
+ * @param background_channels
+ * @return Blended channels.
+ */
+__attribute__((target("avx2")))
+inline __m256i blendChannelsAVX2(__m256i channels, __m256i alpha, __m256i background_channels)
+{
+    __m256i value = _mm256_add_epi16(
+        _mm256_add_epi16(_mm256_mullo_epi16(channels, alpha), _mm256_mullo_epi16(background_channels, _mm256_sub_epi16(_mm256_set1_epi16(255), alpha))),
+        _mm256_set1_epi16(128)
+    );
+    return _mm256_srli_epi16(_mm256_add_epi16(value, _mm256_srli_epi16(value, 8)), 8);
+}
+
+/**
+ * @brief blendSSSE3 Blend four pixels at once. The channels are widened to 16 bits, as the products of two channels need 16 bits.
+ * @param rgba
+ * @param bgra
+ * @param num_pixels
+ * @param background
+ */
+__attribute__((target("ssse3")))
+void blendSSSE3(const unsigned char *rgba, unsigned char *bgra, size_t num_pixels, uint32_t background)
+{
+    const __m128i swap_red_blue = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+    const __m128i low_alpha = _mm_setr_epi8(3, -1, 3, -1, 3, -1, 3, -1, 7, -1, 7, -1, 7, -1, 7, -1);
+    const __m128i high_alpha = _mm_setr_epi8(11, -1, 11, -1, 11, -1, 11, -1, 15, -1, 15, -1, 15, -1, 15, -1);
+    const __m128i opaque = _mm_set1_epi32(static_cast<int>(0xff000000));
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i background_channels = _mm_unpacklo_epi8(_mm_set1_epi32(static_cast<int>(background)), zero);
+
+    size_t pixel = 0;
+    for (; pixel + 4 <= num_pixels; pixel += 4) {
+        __m128i source = _mm_loadu_si128(reinterpret_cast<const __m128i *>(rgba + pixel * 4));
+        __m128i swizzled = _mm_shuffle_epi8(source, swap_red_blue);
+        __m128i low = blendChannelsSSSE3(_mm_unpacklo_epi8(swizzled, zero), _mm_shuffle_epi8(source, low_alpha), background_channels);
+        __m128i high = blendChannelsSSSE3(_mm_unpackhi_epi8(swizzled, zero), _mm_shuffle_epi8(source, high_alpha), background_channels);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(bgra + pixel * 4), _mm_or_si128(_mm_packus_epi16(low, high), opaque));
+    }
+    blendScalar(rgba + pixel * 4, bgra + pixel * 4, num_pixels - pixel, background);
+}
+
+/**
+ * @brief blendAVX2 Blend eight pixels at once. Shuffles, unpacks and packs work per 128-bit lane, so the lanes are handled like two SSSE3 registers.
+ * @param rgba
+ * @param bgra
+ * @param num_pixels
+ * @param background
+ */
+__attribute__((target("avx2")))
+void blendAVX2(const unsigned char *rgba, unsigned char *bgra, size_t num_pixels, uint32_t background)
+{
+    const __m256i swap_red_blue = _mm256_setr_epi8(
+        2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+        2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15
+    );
+    const __m256i low_alpha = _mm256_setr_epi8(
+        3, -1, 3, -1, 3, -1, 3, -1, 7, -1, 7, -1, 7, -1, 7, -1,
+        3, -1, 3, -1, 3, -1, 3, -1, 7, -1, 7, -1, 7, -1, 7, -1
+    );
+    const __m256i high_alpha = _mm256_setr_epi8(
+        11, -1, 11, -1, 11, -1, 11, -1, 15, -1, 15, -1, 15, -1, 15, -1,
+        11, -1, 11, -1, 11, -1, 11, -1, 15, -1, 15, -1, 15, -1, 15, -1
+    );
+    const __m256i opaque = _mm256_set1_epi32(static_cast<int>(0xff000000));
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i background_channels = _mm256_unpacklo_epi8(_mm256_set1_epi32(static_cast<int>(background)), zero);
+
+    size_t pixel = 0;
+    for (; pixel + 8 <= num_pixels; pixel += 8) {
+        __m256i source = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(rgba + pixel * 4));
+        __m256i swizzled = _mm256_shuffle_epi8(source, swap_red_blue);
+        __m256i low = blendChannelsAVX2(_mm256_unpacklo_epi8(swizzled, zero), _mm256_shuffle_epi8(source, low_alpha), background_channels);
+        __m256i high = blendChannelsAVX2(_mm256_unpackhi_epi8(swizzled, zero), _mm256_shuffle_epi8(source, high_alpha), background_channels);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(bgra + pixel * 4), _mm256_or_si256(_mm256_packus_epi16(low, high), opaque));
+    }
+    blendSSSE3(rgba + pixel * 4, bgra + pixel * 4, num_pixels - pixel, background);
+}
+
+#endif
+
+using BlendKernel = void (*)(const unsigned char *rgba, unsigned char *bgra, size_t num_pixels, uint32_t background);
+
+/**
+ * @brief The BlendDispatch struct Fastest kernel supported by the CPU, determined once.
+ */
+struct BlendDispatch
+{
+    BlendKernel kernel = blendScalar;
+    const char *name = "scalar";
+
+    /**
+     * @brief BlendDispatch
+     */
+    BlendDispatch()
+    {
+#ifdef LDG_SSM_HAS_X86_KERNELS
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            kernel = blendAVX2;
+            name = "AVX2";
+        } else if (__builtin_cpu_supports("ssse3")) {
+            kernel = blendSSSE3;
+            name = "SSSE3";
+        }
+#endif
+    }
+};
+
+/**
+ * @brief blendDispatch
+ * @return
+ */
+const BlendDispatch &blendDispatch()
+{
+    static const BlendDispatch dispatch;
+    return dispatch;
+}
+
+/**
+ * @brief blendRGBAOnBackground Blend straight alpha RGBA pixels on an opaque background, like drawing them with a QPainter on an RGB32 image.
+ * The result is written as BGRA, which is the byte order of RGB32 images and of the atlas texture.
+ * @param rgba
+ * @param bgra Destination, which may not overlap the source.
+ * @param num_pixels
+ * @param background Background as 0xAARRGGBB, like a QRgb.
+ */
+void blendRGBAOnBackground(const unsigned char *rgba, unsigned char *bgra, size_t num_pixels, uint32_t background)
+{
+    blendDispatch().kernel(rgba, bgra, num_pixels, background);
+}
+
+/**
+ * @brief imageBlendKernelName
+ * @return Name of the kernel used by blendRGBAOnBackground.
+ */
+const char *imageBlendKernelName()
+{
+    return blendDispatch().name;
+}
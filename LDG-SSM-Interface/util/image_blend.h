@@ -0,0 +1,11 @@
+#ifndef IMAGE_BLEND_H
+#define IMAGE_BLEND_H
+
+#include <cstddef>
+#include <cstdint>
+
+void blendRGBAOnBackground(const unsigned char *rgba, unsigned char *bgra, size_t num_pixels, uint32_t background);
+
+const char *imageBlendKernelName();
+
+#endif // IMAGE_BLEND_H
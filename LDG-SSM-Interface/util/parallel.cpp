@@ -0,0 +1,39 @@
+#include "parallel.h"
+
+#include <QSemaphore>
+#include <QThreadPool>
+#include <atomic>
+
+/**
+ * @brief parallelFor Call the function for every index in [0, count) on the global thread pool and wait until all calls are done.
+ * Helpers are only started on idle pool threads and the calling thread always participates, so nested calls can't deadlock.
+ * @param count
+ * @param function
+ */
+void parallelFor(size_t count, const std::function<void(size_t)> &function)
+{
+    std::atomic<size_t> next_index = 0;
+    auto work = [&]() {
+        for (size_t index = next_index++; index < count; index = next_index++)
+            function(index);
+    };
+
+    QThreadPool *pool = QThreadPool::globalInstance();
+    QSemaphore finished;
+    size_t max_helpers = count > 1 ? std::min<size_t>(count - 1, pool->maxThreadCount()) : 0;
+    size_t num_helpers = 0;
+    while (num_helpers < max_helpers && pool->tryStart([&]() { work(); finished.release(); }))
+        ++num_helpers;
+
+    work();
+    finished.acquire(num_helpers);
+}
+
+/**
+ * @brief numParallelWorkers
+ * @return The maximum number of threads parallelFor can use.
+ */
+size_t numParallelWorkers()
+{
+    return std::max(1, QThreadPool::globalInstance()->maxThreadCount());
+}
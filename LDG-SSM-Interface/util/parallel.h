@@ -0,0 +1,11 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <cstddef>
+#include <functional>
+
+void parallelFor(size_t count, const std::function<void(size_t)> &function);
+
+size_t numParallelWorkers();
+
+#endif // PARALLEL_H
@@ -0,0 +1,12 @@
+#ifndef PROGRESS_H
+#define PROGRESS_H
+
+#include <cstddef>
+#include <functional>
+
+/**
+ * Callback for reporting progress, receiving the processed and total amount of work. Returning false cancels the work.
+ */
+using ProgressCallback = std::function<bool(size_t processed, size_t total)>;
+
+#endif // PROGRESS_H
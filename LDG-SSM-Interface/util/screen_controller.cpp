@@ -54,7 +54,7 @@ std::pair<int, int> ScreenController::resolveGridPosition(QPointF &position)
     for (size_t height = 0; height <= tree_properties->tree_max_height; ++height, col /= 2, row /= 2) {
         auto [num_rows, num_cols] = tree_properties->height_dims[height];
         int possible_index = row * num_cols + col;
-        if (col < num_cols && row < num_rows && tree_properties->draw_array.contains({ height, possible_index })) {
+        if (col < num_cols && row < num_rows && tree_properties->draw_array.contains(tree_properties->nodeId(height, possible_index))) {
             found_index = possible_index;
             found_height = height;
             break;
@@ -38,3 +38,29 @@ std::array<int, 4> getChildrenIndices(size_t height, size_t index, TreeDrawPrope
         col + 1 < child_num_cols && row + 1 < child_num_rows ? new_index + static_cast<int>(child_num_cols) + 1 : -1
     };
 }
+
+/**
+ * @brief getChildElements Get the elements assigned to the children of nodes. The children of drawn nodes are the most likely to be drawn next.
+ * @param nodes
+ * @param tree_properties
+ * @return
+ */
+QList<size_t> getChildElements(const std::vector<size_t> &nodes, TreeDrawProperties *tree_properties)
+{
+    QList<size_t> elements;
+    for (size_t node : nodes) {
+        auto [height, index] = tree_properties->nodeLocation(node);
+        if (height == 0)
+            continue;
+
+        for (int child_index : getChildrenIndices(height, index, tree_properties)) {
+            if (child_index < 0)
+                continue;
+
+            int element = tree_properties->elements[tree_properties->nodeId(height - 1, child_index)];
+            if (element >= 0)
+                elements.append(element);
+        }
+    }
+    return elements;
+}
@@ -7,4 +7,6 @@ size_t getParentIndex(size_t height, size_t index, TreeDrawProperties *tree_prop
 
 std::array<int, 4> getChildrenIndices(size_t height, size_t index, TreeDrawProperties *tree_properties);
 
+QList<size_t> getChildElements(const std::vector<size_t> &nodes, TreeDrawProperties *tree_properties);
+
 #endif // TREE_FUNCTIONS_H
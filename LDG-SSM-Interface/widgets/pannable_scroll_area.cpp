@@ -48,6 +48,7 @@ void PannableScrollArea::updateViewport()
             std::max(0.f, (static_cast<float>(width()) - window_properties->scaled_window_size.x() + 2) / 2.f) - horizontalScrollBar()->value(),
             std::max(0.f, (static_cast<float>(height()) - window_properties->scaled_window_size.y() + 2) / 2.f) - verticalScrollBar()->value()
         };
+        window_properties->viewport_size = { static_cast<float>(width()), static_cast<float>(height()) };
     }
 }
 
@@ -20,6 +20,7 @@ RenderView::RenderView(
 ):
     tree_properties(tree_properties),
     window_properties(window_properties),
+    renderer(nullptr),
     QOpenGLWidget(parent)
 {
     setMouseTracking(true); // Deferred to the parent
@@ -158,6 +159,20 @@ void RenderView::updateUniforms()
     }
 }
 
+/**
+ * @brief RenderView::maxTextureDim Get the maximum texture size supported for the textures of a draw type, so atlasses can be built without a context.
+ * @param draw_type
+ * @return Maximum side length of a 2D texture for images, or of a 3D texture for volumes.
+ */
+size_t RenderView::maxTextureDim(DrawType draw_type)
+{
+    GLint max_texture_size;
+    makeCurrent();
+    gl->glGetIntegerv(draw_type == DrawType::IMAGE ? GL_MAX_TEXTURE_SIZE : GL_MAX_3D_TEXTURE_SIZE, &max_texture_size);
+    doneCurrent();
+    return max_texture_size;
+}
+
 /**
  * @brief RenderView::deleteRenderer
  */
@@ -165,5 +180,6 @@ void RenderView::deleteRenderer()
 {
     makeCurrent();
     delete renderer;
+    renderer = nullptr;
     doneCurrent();
 }
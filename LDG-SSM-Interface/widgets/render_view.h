@@ -32,6 +32,7 @@ public:
 
     void setRenderer(Renderer *renderer);
     void deleteRenderer();
+    size_t maxTextureDim(DrawType draw_type);
 
 public slots:
     void onGLMessageLogged(QOpenGLDebugMessage message);